@@ -0,0 +1,262 @@
+// ===========================================================================
+// Microbenchmarks for the resilience interface.
+//
+// Usage: bench [name ...]
+//
+// Runs the named benchmarks, or all of them, inside MPI_Reinit and prints
+// one CSV row per result on rank 0:
+//
+//   benchmark,ranks,bytes,value,unit
+//
+// The header is printed by `make bench`, which also runs the rollback
+// benchmark at several rank counts.  Iteration counts and the checkpoint
+// size can be set with BENCH_ITERS and BENCH_CKPT_MB.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+#include "ckpt.h"
+
+static int rank, size;
+static long iters;
+static size_t ckpt_bytes;
+
+static long env_long(const char *name, long def) {
+  const char *value = getenv(name);
+  return value && *value ? strtol(value, NULL, 0) : def;
+}
+
+static void report(const char *name, size_t bytes, double value,
+                   const char *unit) {
+  if (rank == 0) {
+    printf("%s,%d,%zu,%.6g,%s\n", name, size, bytes, value, unit);
+    fflush(stdout);
+  }
+}
+
+// Slowest rank's time, so results reflect the whole job.
+static double max_time(double t) {
+  MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  return t;
+}
+
+// ===========================================================================
+// Per-call costs
+// ===========================================================================
+static void bench_probe(void) {
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  for (long i = 0; i < iters; i++) {
+    MPI_Fault_probe();
+  }
+  double t = max_time(MPI_Wtime() - start);
+  report("fault_probe", 0, t / iters * 1e9, "ns");
+}
+
+static MPI_Cleanup_code nop_handler(MPI_Start_state start_state,
+                                    void *state) {
+  return MPI_CLEANUP_SUCCESS;
+}
+
+static void bench_cleanup(void) {
+  MPI_Cleanup_handler handler;
+  void *state;
+  long n = iters / 10;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  for (long i = 0; i < n; i++) {
+    MPI_Cleanup_handler_push(nop_handler, 0);
+    MPI_Cleanup_handler_pop(&handler, &state);
+  }
+  double t = max_time(MPI_Wtime() - start);
+  report("cleanup_push_pop", 0, t / n * 1e9, "ns");
+}
+
+static void bench_mode(void) {
+  MPI_Fault_mode mode;
+  long n = iters / 10;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  for (long i = 0; i < n; i++) {
+    MPI_Get_fault_mode(&mode);
+  }
+  double t = max_time(MPI_Wtime() - start);
+  report("get_fault_mode", 0, t / n * 1e9, "ns");
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  start = MPI_Wtime();
+  for (long i = 0; i < n; i++) {
+    MPI_Set_fault_mode(MPI_ASYNCHRONOUS_FAULTS);
+    MPI_Set_fault_mode(MPI_SYNCHRONOUS_FAULTS);
+  }
+  t = max_time(MPI_Wtime() - start);
+  report("set_fault_mode", 0, t / (2 * n) * 1e9, "ns");
+}
+
+// ===========================================================================
+// Checkpoint tiers
+// ===========================================================================
+
+// Aggregate bandwidth over all ranks for one operation on one tier.
+static void report_bw(const char *name, double t, int reps) {
+  double bytes = (double) ckpt_bytes * size * reps;
+  report(name, ckpt_bytes, bytes / t / 1e9, "GB/s");
+}
+
+static void bench_ckpt(void) {
+  int reps = (int) env_long("BENCH_CKPT_REPS", 5);
+  char *buf = malloc(ckpt_bytes);
+  for (size_t i = 0; i < ckpt_bytes; i++) {
+    buf[i] = (char) (i * 31 + rank);
+  }
+  ckpt_init(MPI_COMM_WORLD, NULL);
+
+  static const struct {
+    int         tier;
+    const char *store;
+    const char *load;
+  } tiers[] = {
+    { CKPT_MEMORY,  "ckpt_memory_store",  "ckpt_memory_load" },
+    { CKPT_PARTNER, "ckpt_partner_store", "ckpt_partner_load" },
+    { CKPT_FILE,    "ckpt_file_store",    "ckpt_file_load" },
+  };
+
+  for (int i = 0; i < (int) (sizeof(tiers) / sizeof(tiers[0])); i++) {
+    int tier = tiers[i].tier;
+    if (tier == CKPT_PARTNER && size < 2) {
+      continue;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    for (int r = 0; r < reps; r++) {
+      ckpt_store(tier, r, buf, ckpt_bytes);
+    }
+    report_bw(tiers[i].store, max_time(MPI_Wtime() - start), reps);
+
+    // Loading from a partner is what a replacement does: every rank gets
+    // its state back from the rank that holds it.
+    MPI_Barrier(MPI_COMM_WORLD);
+    start = MPI_Wtime();
+    for (int r = 0; r < reps; r++) {
+      size_t bytes;
+      int step;
+      if (tier == CKPT_MEMORY) {
+        memcpy(buf, ckpt_memory(-1, &bytes), ckpt_bytes);
+      } else if (tier == CKPT_PARTNER) {
+        // Alternate the order so the ring of transfers cannot deadlock.
+        int held = (rank - 1 + size) % size;
+        if (rank % 2) {
+          ckpt_send_partner(held);
+        }
+        memcpy(buf, ckpt_recv_partner(&step, &bytes), ckpt_bytes);
+        if (!(rank % 2)) {
+          ckpt_send_partner(held);
+        }
+      } else {
+        void *data = ckpt_load_file(rank, -1, &bytes);
+        memcpy(buf, data, ckpt_bytes);
+        free(data);
+      }
+    }
+    report_bw(tiers[i].load, max_time(MPI_Wtime() - start), reps);
+  }
+
+  ckpt_finalize();
+  free(buf);
+}
+
+// ===========================================================================
+// Rollback
+//
+// Rank 0 raises a fault while everyone else waits in a barrier, and the
+// latency is the time from MPI_Fault until the last rank is back in the
+// restart point.  Everything here is static so it survives the rollback.
+// ===========================================================================
+static int    rollbacks;
+static int    rollback_reps;
+static double fault_time;
+static double rollback_total;
+
+static void bench_rollback(MPI_Start_state start_state) {
+  if (start_state == MPI_START_RESTARTED) {
+    double back = MPI_Wtime();
+    MPI_Allreduce(MPI_IN_PLACE, &back, 1, MPI_DOUBLE, MPI_MAX,
+                  MPI_COMM_WORLD);
+    MPI_Bcast(&fault_time, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    rollback_total += back - fault_time;
+    rollbacks++;
+  } else {
+    rollback_reps = (int) env_long("BENCH_ROLLBACKS", 20);
+  }
+
+  if (rollbacks < rollback_reps) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+      fault_time = MPI_Wtime();
+      MPI_Fault();
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+  if (rollbacks) {
+    report("rollback", 0, rollback_total / rollbacks * 1e6, "us");
+  }
+}
+
+// ===========================================================================
+// Driver
+// ===========================================================================
+static const struct {
+  const char *name;
+  void      (*run)(void);
+} benchmarks[] = {
+  { "probe",   bench_probe },
+  { "cleanup", bench_cleanup },
+  { "mode",    bench_mode },
+  { "ckpt",    bench_ckpt },
+};
+
+#define NUM_BENCHMARKS ((int) (sizeof(benchmarks) / sizeof(benchmarks[0])))
+
+static int selected(int argc, char **argv, const char *name) {
+  if (argc < 2) {
+    return 1;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], name)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  // Only the rollback benchmark ever restarts.
+  if (start_state == MPI_START_NEW) {
+    for (int i = 0; i < NUM_BENCHMARKS; i++) {
+      if (selected(argc, argv, benchmarks[i].name)) {
+        benchmarks[i].run();
+      }
+    }
+  }
+  if (selected(argc, argv, "rollback")) {
+    bench_rollback(start_state);
+  }
+}
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+  iters = env_long("BENCH_ITERS", 10000000);
+  ckpt_bytes = (size_t) env_long("BENCH_CKPT_MB", 64) << 20;
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,775 @@
+// ===========================================================================
+// Multi-level checkpointing for resilient MPI applications.
+//
+// Every memory tier is double-buffered: a store fills the spare copy and
+// only then makes it current, so rolling back out of a store leaves the last
+// complete checkpoint in place.  Until the next store starts, the spare copy
+// still holds the checkpoint before that one.  Keeping both lets processes
+// that were interrupted on either side of a store agree on a step that
+// everyone holds.  Files get atomicity from rename(), and the previous file
+// is kept for the same reason.
+//
+// Partner copies are cut into stripes held by the next few ranks, so a rank
+// with a large state spreads it over several holders, and a replacement
+// pulls it back from all of them at once.  When the job shrinks instead,
+// the holder of the first stripe of each lost rank pulls in the rest and
+// adopts the state; holders of different lost ranks do so at once.  When
+// it grows, processes keep their own state under their new ranks, and the
+// application moves it onto the added ones.
+// ===========================================================================
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ckpt.h"
+
+#define CKPT_TAG    0x7ced
+#define CKPT_CHUNK  ((size_t) 1 << 30)   //!< Max bytes per message.
+#define CKPT_MAGIC  0x636b7074
+
+//! One checkpoint, or one stripe of one, held in memory.
+struct copy {
+  int     owner;        //!< Rank the state belongs to.
+  int     step;
+  size_t  bytes;        //!< Bytes held.
+  size_t  total;        //!< Bytes in the whole checkpoint.
+  size_t  offset;       //!< Offset of this stripe in the whole checkpoint.
+  size_t  cap;
+  char   *data;
+};
+
+//! Current and spare copy of one in-memory tier.
+struct tier {
+  struct copy copies[2];
+  int         cur;      //!< Index of the current copy, or -1.
+};
+
+//! Header of a checkpoint file and of a partner transfer.
+struct header {
+  uint32_t magic;
+  int32_t  step;
+  uint64_t bytes;
+  uint64_t total;
+  uint64_t offset;
+};
+
+static MPI_Comm    comm = MPI_COMM_NULL;
+static int         rank, size;
+static char        dir[4096];
+static int         stripes = 1;
+#define EMPTY_TIER { { { .owner = -1 }, { .owner = -1 } }, -1 }
+
+static struct tier mine = EMPTY_TIER;       //!< This process's state.
+static struct tier adopted = EMPTY_TIER;    //!< A lost rank's state.
+
+//! held[i] is stripe i of the state of rank - 1 - i.
+static struct tier held[CKPT_MAX_STRIPES] = {
+  [0 ... CKPT_MAX_STRIPES - 1] = EMPTY_TIER
+};
+
+int ckpt_init(MPI_Comm c, const char *d) {
+  // Keep checkpoints from before a restart; they are what we restart from.
+  comm = c;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  if (!d) {
+    d = getenv("CKPT_DIR");
+  }
+  snprintf(dir, sizeof(dir), "%s", d ? d : "/tmp");
+  return MPI_SUCCESS;
+}
+
+void ckpt_finalize(void) {
+  for (int i = 0; i < 2; i++) {
+    free(mine.copies[i].data);
+    free(adopted.copies[i].data);
+    for (int s = 0; s < CKPT_MAX_STRIPES; s++) {
+      free(held[s].copies[i].data);
+    }
+  }
+  mine = (struct tier) EMPTY_TIER;
+  adopted = (struct tier) EMPTY_TIER;
+  for (int s = 0; s < CKPT_MAX_STRIPES; s++) {
+    held[s] = (struct tier) EMPTY_TIER;
+  }
+}
+
+// ===========================================================================
+// Memory tiers
+// ===========================================================================
+
+// Get the spare copy of a tier, big enough for bytes.  It no longer holds a
+// valid checkpoint until it is committed.
+static struct copy *spare(struct tier *t, size_t bytes) {
+  struct copy *c = &t->copies[t->cur == 0 ? 1 : 0];
+  c->owner = -1;
+  if (!c->data || c->cap < bytes) {
+    char *data = realloc(c->data, bytes ? bytes : 1);
+    if (!data) {
+      return NULL;
+    }
+    c->data = data;
+    c->cap = bytes;
+  }
+  return c;
+}
+
+static void commit(struct tier *t, struct copy *c, int owner,
+                   const struct header *h) {
+  c->owner  = owner;
+  c->step   = h->step;
+  c->bytes  = h->bytes;
+  c->total  = h->total;
+  c->offset = h->offset;
+  t->cur    = (int) (c - t->copies);
+}
+
+// Find the copy of the given owner's state for step in a tier, newest first.
+static struct copy *find(struct tier *t, int owner, int step) {
+  if (t->cur < 0) {
+    return NULL;
+  }
+  for (int i = 0; i < 2; i++) {
+    struct copy *c = &t->copies[t->cur ^ i];
+    if (c->owner == owner && (step < 0 || c->step == step)) {
+      return c;
+    }
+    if (step < 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+const void *ckpt_memory(int step, size_t *bytes) {
+  struct copy *c = find(&mine, rank, step);
+  if (!c) {
+    return NULL;
+  }
+  *bytes = c->bytes;
+  return c->data;
+}
+
+// ===========================================================================
+// Partner tier
+// ===========================================================================
+
+//! Rank that holds stripe i of r's state.
+static int holder_of(int r, int i) {
+  return (r + 1 + i) % size;
+}
+
+//! Rank whose stripe i this process holds.
+static int held_for(int i) {
+  return ((rank - 1 - i) % size + size) % size;
+}
+
+int ckpt_set_stripes(int n) {
+  n = n < 1 ? 1 : n > CKPT_MAX_STRIPES ? CKPT_MAX_STRIPES : n;
+  if (size > 1 && n > size - 1) {
+    n = size - 1;
+  }
+  if (n != stripes) {
+    for (int i = 0; i < CKPT_MAX_STRIPES; i++) {
+      held[i].copies[0].owner = held[i].copies[1].owner = -1;
+    }
+    stripes = n;
+  }
+  return MPI_SUCCESS;
+}
+
+static int chunks(size_t bytes) {
+  return (int) ((bytes + CKPT_CHUNK - 1) / CKPT_CHUNK);
+}
+
+// Post the transfer of one buffer in chunks.  Returns the requests posted.
+static int post(int send, char *buf, size_t bytes, int peer,
+                MPI_Request *reqs) {
+  int n = 0;
+  for (size_t off = 0; off < bytes; off += CKPT_CHUNK) {
+    size_t len = bytes - off < CKPT_CHUNK ? bytes - off : CKPT_CHUNK;
+    if (send) {
+      MPI_Isend(buf + off, (int) len, MPI_BYTE, peer, CKPT_TAG, comm,
+                &reqs[n++]);
+    } else {
+      MPI_Irecv(buf + off, (int) len, MPI_BYTE, peer, CKPT_TAG, comm,
+                &reqs[n++]);
+    }
+  }
+  return n;
+}
+
+// Shift one stripe around the ring: send ours to dest and receive the one
+// from source into a held tier.
+static int shift(int dest, const struct header *sh, const char *sbuf,
+                 int source, struct tier *into) {
+  struct header rh;
+  MPI_Sendrecv(sh, sizeof(*sh), MPI_BYTE, dest, CKPT_TAG,
+               &rh, sizeof(rh), MPI_BYTE, source, CKPT_TAG, comm,
+               MPI_STATUS_IGNORE);
+  struct copy *c = spare(into, rh.bytes);
+  if (!c) {
+    return MPI_ERR_NO_MEM;
+  }
+  MPI_Request *reqs = malloc((chunks(rh.bytes) + chunks(sh->bytes) + 1) *
+                             sizeof(*reqs));
+  int n = post(0, c->data, rh.bytes, source, reqs);
+  n += post(1, (char *) sbuf, sh->bytes, dest, reqs + n);
+  MPI_Waitall(n, reqs, MPI_STATUSES_IGNORE);
+  free(reqs);
+  commit(into, c, source, &rh);
+  return MPI_SUCCESS;
+}
+
+static int store_partner(int step, const char *buf, size_t bytes) {
+  if (size < 2) {
+    return MPI_SUCCESS;
+  }
+  size_t len = (bytes + stripes - 1) / stripes;
+  for (int i = 0; i < stripes; i++) {
+    size_t off = i * len < bytes ? i * len : bytes;
+    size_t n = bytes - off < len ? bytes - off : len;
+    struct header sh = { CKPT_MAGIC, step, n, bytes, off };
+    int rc = shift(holder_of(rank, i), &sh, buf + off, held_for(i), &held[i]);
+    if (rc != MPI_SUCCESS) {
+      return rc;
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int ckpt_partner_step(int r) {
+  int step = -1;
+  for (int i = 0; i < stripes; i++) {
+    struct copy *c = held_for(i) == r ? find(&held[i], r, -1) : NULL;
+    if (c && c->step > step) {
+      step = c->step;
+    }
+  }
+  return step;
+}
+
+// ===========================================================================
+// Restoring from partners
+//
+// Holders send every copy of every stripe they hold for a lost rank, oldest
+// first, and the lost rank keeps each step that arrived whole.  Headers go
+// first so receive buffers can be sized, and within each phase every
+// transfer is posted before any is waited for, so holders that serve
+// several lost ranks cannot deadlock.
+// ===========================================================================
+
+//! One stripe copy received.
+struct piece {
+  struct header h;
+  char         *data;
+};
+
+//! Transfers of one restore.
+struct restore {
+  int           nreqs, cap;
+  MPI_Request  *reqs;
+  int           counts_out[CKPT_MAX_STRIPES];
+  struct header sent[CKPT_MAX_STRIPES][2];
+  int           counts_in[CKPT_MAX_STRIPES];
+  struct header hdrs[CKPT_MAX_STRIPES][2];
+  int           npieces;
+  struct piece  pieces[2 * CKPT_MAX_STRIPES];
+};
+
+static MPI_Request *next_reqs(struct restore *x, int n) {
+  if (x->nreqs + n > x->cap) {
+    x->cap = 2 * (x->nreqs + n);
+    x->reqs = realloc(x->reqs, x->cap * sizeof(*x->reqs));
+  }
+  x->nreqs += n;
+  return &x->reqs[x->nreqs - n];
+}
+
+static void wait_all(struct restore *x) {
+  MPI_Waitall(x->nreqs, x->reqs, MPI_STATUSES_IGNORE);
+  x->nreqs = 0;
+}
+
+static void restore_free(struct restore *x) {
+  for (int p = 0; p < x->npieces; p++) {
+    free(x->pieces[p].data);
+  }
+  free(x->reqs);
+}
+
+// Copies of stripe i held for r, oldest first, without repeated steps.
+static int held_copies(int i, int r, struct copy *out[2]) {
+  int n = 0;
+  if (held_for(i) != r || held[i].cur < 0) {
+    return 0;
+  }
+  for (int k = 1; k >= 0; k--) {
+    struct copy *c = &held[i].copies[held[i].cur ^ k];
+    if (c->owner == r) {
+      if (n && out[n - 1]->step == c->step) {
+        n--;
+      }
+      out[n++] = c;
+    }
+  }
+  return n;
+}
+
+// Send the headers of the stripes held for r to dest, which is r itself
+// unless the job shrank.
+static void send_headers(struct restore *x, int r, int dest) {
+  for (int i = 0; i < stripes; i++) {
+    struct copy *c[2];
+    if (held_for(i) != r) {
+      continue;
+    }
+    int n = x->counts_out[i] = held_copies(i, r, c);
+    for (int k = 0; k < n; k++) {
+      x->sent[i][k] = (struct header) {
+        CKPT_MAGIC, c[k]->step, c[k]->bytes, c[k]->total, c[k]->offset
+      };
+    }
+    MPI_Isend(&x->counts_out[i], 1, MPI_INT, dest, CKPT_TAG, comm,
+              next_reqs(x, 1));
+    MPI_Isend(x->sent[i], sizeof(x->sent[i]), MPI_BYTE, dest, CKPT_TAG, comm,
+              next_reqs(x, 1));
+  }
+}
+
+static void send_data(struct restore *x, int r, int dest) {
+  for (int i = 0; i < stripes; i++) {
+    struct copy *c[2];
+    int n = held_copies(i, r, c);
+    for (int k = 0; k < n; k++) {
+      post(1, c[k]->data, c[k]->bytes, dest,
+           next_reqs(x, chunks(c[k]->bytes)));
+    }
+  }
+}
+
+// Receive the headers of the stripes of owner from their holders, from[i]
+// for stripe i.  A negative holder means this process holds the stripe.
+static void recv_headers(struct restore *x, int owner, const int from[]) {
+  for (int i = 0; i < stripes; i++) {
+    if (from[i] < 0) {
+      struct copy *c[2];
+      x->counts_in[i] = held_copies(i, owner, c);
+      for (int k = 0; k < x->counts_in[i]; k++) {
+        x->hdrs[i][k] = (struct header) {
+          CKPT_MAGIC, c[k]->step, c[k]->bytes, c[k]->total, c[k]->offset
+        };
+      }
+      continue;
+    }
+    MPI_Irecv(&x->counts_in[i], 1, MPI_INT, from[i], CKPT_TAG, comm,
+              next_reqs(x, 1));
+    MPI_Irecv(x->hdrs[i], sizeof(x->hdrs[i]), MPI_BYTE, from[i], CKPT_TAG,
+              comm, next_reqs(x, 1));
+  }
+}
+
+static int recv_data(struct restore *x, int owner, const int from[]) {
+  for (int i = 0; i < stripes; i++) {
+    for (int k = 0; k < x->counts_in[i] && k < 2; k++) {
+      struct piece *p = &x->pieces[x->npieces];
+      p->h = x->hdrs[i][k];
+      p->data = malloc(p->h.bytes ? p->h.bytes : 1);
+      if (!p->data) {
+        return MPI_ERR_NO_MEM;
+      }
+      x->npieces++;
+      if (from[i] < 0) {
+        memcpy(p->data, find(&held[i], owner, p->h.step)->data, p->h.bytes);
+      } else {
+        post(0, p->data, p->h.bytes, from[i],
+             next_reqs(x, chunks(p->h.bytes)));
+      }
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// Holders of this process's stripes.
+static void my_holders(int from[]) {
+  for (int i = 0; i < stripes; i++) {
+    from[i] = holder_of(rank, i);
+  }
+}
+
+// Make every step of owner's state that arrived whole a checkpoint in a
+// tier, oldest first.  Returns the newest step, or -1 if none arrived whole.
+static int assemble(struct restore *x, struct tier *into, int owner) {
+  // Stripe 0 comes first, oldest first, and every step has one.
+  int steps[2], nsteps = 0;
+  while (nsteps < x->npieces && nsteps < x->counts_in[0] && nsteps < 2) {
+    steps[nsteps] = x->pieces[nsteps].h.step;
+    nsteps++;
+  }
+
+  int newest = -1;
+  for (int s = 0; s < nsteps; s++) {
+    size_t total = x->pieces[s].h.total, got = 0;
+    for (int p = 0; p < x->npieces; p++) {
+      if (x->pieces[p].h.step == steps[s] && x->pieces[p].h.total == total) {
+        got += x->pieces[p].h.bytes;
+      }
+    }
+    struct copy *c = got == total ? spare(into, total) : NULL;
+    if (!c) {
+      continue;
+    }
+    for (int p = 0; p < x->npieces; p++) {
+      struct piece *pc = &x->pieces[p];
+      if (pc->h.step == steps[s] && pc->h.total == total) {
+        memcpy(c->data + pc->h.offset, pc->data, pc->h.bytes);
+      }
+    }
+    struct header h = { CKPT_MAGIC, steps[s], total, total, 0 };
+    commit(into, c, owner, &h);
+    newest = steps[s];
+  }
+  return newest;
+}
+
+int ckpt_restore_partners(const int died[]) {
+  // Every stripe of a lost rank needs a surviving holder.  All ranks see
+  // the same died[], so they all give up together.
+  for (int r = 0; r < size; r++) {
+    for (int i = 0; died[r] && i < stripes; i++) {
+      if (size < 2 || died[holder_of(r, i)]) {
+        return MPI_ERR_OTHER;
+      }
+    }
+  }
+
+  struct restore x;
+  memset(&x, 0, sizeof(x));
+  int from[CKPT_MAX_STRIPES];
+  my_holders(from);
+  for (int r = 0; r < size; r++) {
+    if (died[r]) {
+      send_headers(&x, r, r);
+    }
+  }
+  if (died[rank]) {
+    recv_headers(&x, rank, from);
+  }
+  wait_all(&x);
+
+  int rc = MPI_SUCCESS;
+  for (int r = 0; r < size; r++) {
+    if (died[r]) {
+      send_data(&x, r, r);
+    }
+  }
+  if (died[rank]) {
+    rc = recv_data(&x, rank, from);
+  }
+  wait_all(&x);
+
+  if (rc == MPI_SUCCESS && died[rank] && assemble(&x, &mine, rank) < 0) {
+    rc = MPI_ERR_OTHER;
+  }
+  restore_free(&x);
+  return rc;
+}
+
+int ckpt_send_partner(int r) {
+  if (ckpt_partner_step(r) < 0) {
+    return MPI_ERR_RANK;
+  }
+  struct restore x;
+  memset(&x, 0, sizeof(x));
+  send_headers(&x, r, r);
+  wait_all(&x);
+  send_data(&x, r, r);
+  wait_all(&x);
+  restore_free(&x);
+  return MPI_SUCCESS;
+}
+
+const void *ckpt_recv_partner(int *step, size_t *bytes) {
+  struct restore x;
+  memset(&x, 0, sizeof(x));
+  int from[CKPT_MAX_STRIPES];
+  my_holders(from);
+  recv_headers(&x, rank, from);
+  wait_all(&x);
+  int rc = recv_data(&x, rank, from);
+  wait_all(&x);
+  *step = rc == MPI_SUCCESS ? assemble(&x, &mine, rank) : -1;
+  restore_free(&x);
+  return *step < 0 ? NULL : ckpt_memory(*step, bytes);
+}
+
+// ===========================================================================
+// Resizing
+// ===========================================================================
+
+int ckpt_redistribute(MPI_Comm c, const int map[], int old_size) {
+  int me;
+  MPI_Comm_rank(c, &me);
+
+  // Only processes of the old job hold anything, and processes added as the
+  // job grew must be new.  Every stripe of a lost rank needs a surviving
+  // holder.  Adopted checkpoints that were never discarded complete own
+  // ones from before the last resize, which are no good without them.  All
+  // ranks see the same map.
+  int old = -1;
+  for (int r = 0; r < old_size; r++) {
+    old = map[r] == me ? r : old;
+  }
+  int holds = comm != MPI_COMM_NULL;
+  int ok = holds ? size == old_size && old == rank && adopted.cur < 0
+               : old < 0;
+  for (int r = 0; ok && holds && r < old_size; r++) {
+    for (int i = 0; map[r] == MPI_UNDEFINED && i < stripes; i++) {
+      if (old_size < 2 || map[holder_of(r, i)] == MPI_UNDEFINED) {
+        ok = 0;
+      }
+    }
+  }
+  comm = c;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+
+  adopted.cur = -1;
+  adopted.copies[0].owner = adopted.copies[1].owner = -1;
+  int rc = ok ? MPI_SUCCESS : MPI_ERR_OTHER;
+  if (ok && holds) {
+    struct restore x;
+    memset(&x, 0, sizeof(x));
+    int lost = -1;
+    int from[CKPT_MAX_STRIPES];
+    for (int r = 0; r < old_size; r++) {
+      if (map[r] != MPI_UNDEFINED) {
+        continue;
+      }
+      int adopter = map[holder_of(r, 0)];
+      if (adopter != me) {
+        send_headers(&x, r, adopter);
+      } else {
+        lost = r;
+        for (int i = 0; i < stripes; i++) {
+          from[i] = i ? map[holder_of(r, i)] : -1;
+        }
+        recv_headers(&x, r, from);
+      }
+    }
+    wait_all(&x);
+
+    for (int r = 0; r < old_size; r++) {
+      int adopter = map[r] == MPI_UNDEFINED ? map[holder_of(r, 0)] : me;
+      if (adopter != me) {
+        send_data(&x, r, adopter);
+      }
+    }
+    if (lost >= 0) {
+      rc = recv_data(&x, lost, from);
+    }
+    wait_all(&x);
+    if (rc == MPI_SUCCESS && lost >= 0 &&
+        assemble(&x, &adopted, lost) < 0) {
+      rc = MPI_ERR_OTHER;
+    }
+    restore_free(&x);
+  }
+
+  // Renumber.  Partner copies follow the old ring, so they are dropped.
+  for (int k = 0; k < 2; k++) {
+    if (ok && mine.copies[k].owner == rank) {
+      mine.copies[k].owner = me;
+    }
+    for (int i = 0; i < CKPT_MAX_STRIPES; i++) {
+      held[i].copies[k].owner = -1;
+    }
+  }
+  rank = me;
+  MPI_Comm_size(comm, &size);
+  return rc;
+}
+
+const void *ckpt_adopted(int step, int *owner, size_t *bytes) {
+  if (adopted.cur < 0) {
+    return NULL;
+  }
+  *owner = adopted.copies[adopted.cur].owner;
+  struct copy *c = find(&adopted, *owner, step);
+  if (!c) {
+    return NULL;
+  }
+  *bytes = c->bytes;
+  return c->data;
+}
+
+// ===========================================================================
+// File tier
+// ===========================================================================
+
+static void file_path(char *path, size_t len, int r, const char *suffix) {
+  snprintf(path, len, "%s/ckpt.%d%s", dir, r, suffix);
+}
+
+static int write_all(int fd, const void *buf, size_t bytes) {
+  const char *p = buf;
+  while (bytes) {
+    ssize_t n = write(fd, p, bytes);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    bytes -= n;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void *buf, size_t bytes) {
+  char *p = buf;
+  while (bytes) {
+    ssize_t n = read(fd, p, bytes);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    bytes -= n;
+  }
+  return 0;
+}
+
+static int store_file(int step, const void *buf, size_t bytes) {
+  char tmp[4200], path[4200], prev[4200];
+  file_path(tmp, sizeof(tmp), rank, ".tmp");
+  file_path(path, sizeof(path), rank, "");
+  file_path(prev, sizeof(prev), rank, ".prev");
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return MPI_ERR_OTHER;
+  }
+  struct header h = { CKPT_MAGIC, step, bytes, bytes, 0 };
+  int err = write_all(fd, &h, sizeof(h)) || write_all(fd, buf, bytes) ||
+            fsync(fd);
+  close(fd);
+  if (err || (rename(path, prev) && errno != ENOENT) || rename(tmp, path)) {
+    unlink(tmp);
+    return MPI_ERR_OTHER;
+  }
+  return MPI_SUCCESS;
+}
+
+// Open the newest file of rank r for step, or for any step if step < 0.
+static int open_file(int r, int step, struct header *h) {
+  static const char *const suffixes[] = { "", ".prev" };
+  int fd = -1;
+  for (int i = 0; i < 2; i++) {
+    char path[4200];
+    struct header fh;
+    file_path(path, sizeof(path), r, suffixes[i]);
+    int f = open(path, O_RDONLY);
+    if (f < 0) {
+      continue;
+    }
+    if (read_all(f, &fh, sizeof(fh)) || fh.magic != CKPT_MAGIC ||
+        (step >= 0 && fh.step != step) || (fd >= 0 && fh.step <= h->step)) {
+      close(f);
+      continue;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = f;
+    *h = fh;
+  }
+  return fd;
+}
+
+int ckpt_file_step(int r) {
+  struct header h;
+  int fd = open_file(r, -1, &h);
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+  return h.step;
+}
+
+void *ckpt_load_file(int r, int step, size_t *bytes) {
+  struct header h;
+  int fd = open_file(r, step, &h);
+  if (fd < 0) {
+    return NULL;
+  }
+  char *buf = malloc(h.bytes ? h.bytes : 1);
+  if (buf && read_all(fd, buf, h.bytes)) {
+    free(buf);
+    buf = NULL;
+  }
+  close(fd);
+  *bytes = h.bytes;
+  return buf;
+}
+
+// ===========================================================================
+// Storing
+// ===========================================================================
+int ckpt_store(int tiers, int step, const void *buf, size_t bytes) {
+  if (tiers & CKPT_MEMORY) {
+    struct copy *c = spare(&mine, bytes);
+    if (!c) {
+      return MPI_ERR_NO_MEM;
+    }
+    memcpy(c->data, buf, bytes);
+    struct header h = { CKPT_MAGIC, step, bytes, bytes, 0 };
+    commit(&mine, c, rank, &h);
+  }
+  if (tiers & CKPT_PARTNER) {
+    int rc = store_partner(step, buf, bytes);
+    if (rc != MPI_SUCCESS) {
+      return rc;
+    }
+  }
+  int rc = MPI_SUCCESS;
+  if (tiers & CKPT_FILE) {
+    rc = store_file(step, buf, bytes);
+  }
+#ifdef MPIX_LOCAL
+  if (rc == MPI_SUCCESS) {
+    MPIX_Trace_event(MPIX_EVENT_CHECKPOINT_STORED, step, (long) bytes);
+    MPIX_Work_committed(step);
+  }
+#endif
+  return rc;
+}
+
+int ckpt_discard(int tiers) {
+  if (tiers & CKPT_MEMORY) {
+    mine.copies[0].owner = mine.copies[1].owner = -1;
+    adopted.copies[0].owner = adopted.copies[1].owner = -1;
+    adopted.cur = -1;
+  }
+  if (tiers & CKPT_PARTNER) {
+    for (int i = 0; i < CKPT_MAX_STRIPES; i++) {
+      held[i].copies[0].owner = held[i].copies[1].owner = -1;
+    }
+  }
+  if (tiers & CKPT_FILE) {
+    static const char *const suffixes[] = { "", ".prev" };
+    for (int i = 0; i < 2; i++) {
+      char path[4200];
+      file_path(path, sizeof(path), rank, suffixes[i]);
+      if (unlink(path) && errno != ENOENT) {
+        return MPI_ERR_OTHER;
+      }
+    }
+  }
+  return MPI_SUCCESS;
+}
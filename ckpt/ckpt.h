@@ -0,0 +1,185 @@
+// ===========================================================================
+// Multi-level checkpointing for resilient MPI applications.
+//
+// Checkpoints are opaque byte buffers that may differ in size between ranks
+// and steps.  There are three tiers, from fastest to most durable:
+//
+//   CKPT_MEMORY   a copy in this process's memory.  Survives a rollback of
+//                 this process, but not its loss.
+//   CKPT_PARTNER  a copy in the memory of the next ranks, so a replacement
+//                 process can fetch its state from its partners.  The copy
+//                 can be cut into stripes held by different ranks.
+//   CKPT_FILE     a file per rank in a directory.  Survives anything.
+//
+// Stores are atomic per tier: a fault part way through a store leaves the
+// previous checkpoint of that tier intact.  Every tier also keeps the
+// checkpoint before the latest one, so ranks interrupted on either side of
+// a store can still restart from the same step.
+// ===========================================================================
+#ifndef CKPT_H
+#define CKPT_H
+
+#include <stddef.h>
+
+#include <mpi.h>
+
+//! Most stripes a partner copy can be cut into.
+#define CKPT_MAX_STRIPES 16
+
+//! Checkpoint tiers, as a bit mask.
+enum {
+  CKPT_MEMORY  = 1,
+  CKPT_PARTNER = 2,
+  CKPT_FILE    = 4,
+};
+
+/*!
+ * Set up checkpointing for the processes in comm.  Call it again after a
+ * restart to pick up a new communicator; checkpoints already held are kept.
+ *
+ * @param[in] comm  Communicator whose ranks checkpoint together.
+ * @param[in] dir   Directory for the file tier.  If NULL, $CKPT_DIR is used
+ *                  if set, and /tmp otherwise.
+ */
+int ckpt_init(MPI_Comm comm, const char *dir);
+
+/*!
+ * Free every in-memory checkpoint.  Files are kept.
+ */
+void ckpt_finalize(void);
+
+/*!
+ * Store this process's state for a step in the given tiers.  Storing to
+ * CKPT_PARTNER is collective over the checkpoint communicator.
+ *
+ * @param[in] tiers  Bit mask of CKPT_* tiers.
+ * @param[in] step   Step the state belongs to.
+ * @param[in] buf    State to save.
+ * @param[in] bytes  Size of buf, which may differ between ranks.
+ */
+int ckpt_store(int tiers, int step, const void *buf, size_t bytes);
+
+/*!
+ * Look up one of this process's last two in-memory checkpoints.  Returns a
+ * pointer to the saved state, or NULL if there is none for the step.  The
+ * pointer is valid until the next store to CKPT_MEMORY.
+ *
+ * @param[in]  step   Step to look for, or -1 for the latest one.
+ * @param[out] bytes  Size of the saved state.
+ */
+const void *ckpt_memory(int step, size_t *bytes);
+
+/*!
+ * Cut partner copies into n stripes, held by the n ranks after each rank.
+ * More stripes spread the copies of large states over more holders and
+ * restore them in parallel, but every holder of a stripe must survive for
+ * the copy to be usable.  Partner copies already held are dropped if n
+ * changes.  Collective; the default is 1.
+ *
+ * @param[in] n  Number of stripes, clamped to [1, min(CKPT_MAX_STRIPES,
+ *               size - 1)].
+ */
+int ckpt_set_stripes(int n);
+
+/*!
+ * Returns the step of the latest in-memory checkpoint held on behalf of
+ * rank, or -1 if this process holds none for it.
+ */
+int ckpt_partner_step(int rank);
+
+/*!
+ * Give every lost rank its checkpoints back from its partners.  Collective:
+ * holders send and lost ranks receive at the same time, so any number of
+ * ranks can be restored at once as long as the holders of their stripes
+ * survived.  On a lost rank the checkpoints become its in-memory ones, to
+ * be found with ckpt_memory.
+ *
+ * Returns an error on every rank if some stripe of a lost rank has no
+ * surviving holder, and on a lost rank if no step arrived whole, so
+ * callers should reduce the result before relying on it.
+ *
+ * @param[in] died  For each rank, nonzero if it was replaced.  Must be the
+ *                  same on every rank.
+ */
+int ckpt_restore_partners(const int died[]);
+
+/*!
+ * Send the checkpoints held on behalf of rank back to it.  Call this on the
+ * holder when rank was replaced; the replacement calls ckpt_recv_partner.
+ * With more than one stripe, every holder of rank must call it.  Prefer
+ * ckpt_restore_partners when several ranks may be lost at once.
+ */
+int ckpt_send_partner(int rank);
+
+/*!
+ * Receive this process's checkpoints from the ranks that hold them and make
+ * them the in-memory checkpoints.  Returns a pointer to the latest one, as
+ * for ckpt_memory, or NULL if none arrived whole.
+ *
+ * @param[out] step   Step of the latest received state.
+ * @param[out] bytes  Size of the received state.
+ */
+const void *ckpt_recv_partner(int *step, size_t *bytes);
+
+/*!
+ * Use instead of ckpt_init after the job restarted at a different size.
+ * The process that held the first stripe of the partner copy of each lost
+ * rank collects the other stripes and adopts the checkpoints, to be found
+ * with ckpt_adopted; the adopters of different lost ranks work at once.
+ * Each process's own checkpoints are kept under its new rank, and processes
+ * added as the job grew start with none.  Partner copies held for others
+ * are dropped, since the ranks are numbered anew, until the next store.
+ * Collective over the new communicator.
+ *
+ * Returns an error on every rank if some stripe of a lost rank has no
+ * surviving holder or some process of the old job has no checkpoints from
+ * before, e.g. a replacement started in the same recovery.  Checkpointing
+ * is set up for the new communicator either way.
+ *
+ * @param[in] comm      Communicator of the ranks now.
+ * @param[in] map       New rank of each old rank, or MPI_UNDEFINED for a
+ *                      lost one, as from MPI_Reinit_remap.
+ * @param[in] old_size  Number of ranks before the job was resized.
+ */
+int ckpt_redistribute(MPI_Comm comm, const int map[], int old_size);
+
+/*!
+ * Look up a checkpoint of a lost rank that ckpt_redistribute gave to this
+ * process.  Returns NULL if there is none for the step.  The pointer is
+ * valid until ckpt_discard drops the memory tier.
+ *
+ * @param[in]  step   Step to look for, or -1 for the latest one.
+ * @param[out] owner  Rank the state belonged to before the job shrank.
+ * @param[out] bytes  Size of the saved state.
+ */
+const void *ckpt_adopted(int step, int *owner, size_t *bytes);
+
+/*!
+ * Returns the step of the latest checkpoint of rank in the file tier, or -1
+ * if there is none.  rank may be any rank, so a job restarted at a
+ * different size can read the state of ranks that no longer exist.
+ */
+int ckpt_file_step(int rank);
+
+/*!
+ * Read the checkpoint of rank from the file tier, which holds its last two
+ * checkpoints.  Returns a buffer to be released with free(), or NULL if
+ * there is no checkpoint for the step.
+ *
+ * @param[in]  rank   Rank whose checkpoint to read.
+ * @param[in]  step   Step to read, or -1 for the latest one.
+ * @param[out] bytes  Size of the returned state.
+ */
+void *ckpt_load_file(int rank, int step, size_t *bytes);
+
+/*!
+ * Drop this process's checkpoints from the given tiers, e.g. files left by
+ * an earlier job when starting from initial conditions.
+ *
+ * @param[in] tiers  Bit mask of CKPT_* tiers.  CKPT_MEMORY also drops adopted
+ *                   checkpoints, CKPT_PARTNER the copies this process
+ *                   holds for its neighbors.
+ */
+int ckpt_discard(int tiers);
+
+#endif // CKPT_H
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <limits.h>
 
 #include <mpi.h>
@@ -16,6 +17,7 @@ static int time_step;
 extern int deallocate_app_data();
 extern int reinit_libraries();
 extern int initialize_libraries();
+extern int finalize_libraries();
 
 extern int store_checkpoint();
 extern int can_load_checkpoint_from_memory();
@@ -28,12 +30,49 @@ extern int send_neighbor_checkpoint_to(int rank);
 extern int receive_neighbor_checkpoint();
 
 extern int converged();
+extern int save_solver_state();
+extern int restore_solver_state();
+extern int adapt_mesh();
 extern int physics_looks_ridiculous();
 extern int parse_start_step(int argc, char **argv);
 extern int can_run_at_size();
 extern int MAX_STEP;
 
 
+// ===========================================================================
+// Agreement among restarting processes.  It is on the critical path of
+// recovery, so it uses persistent collectives where there are any: one per
+// buffer, built the first time and kept across rollbacks.
+// ===========================================================================
+enum { AGREE_DIED, AGREE_HELD, AGREE_STEP, AGREE_COUNT };
+
+// Combine count ints at buf over all processes with op, in place.  A
+// collective is built again only if its buffer or count changed.
+static void agree(int which, int *buf, int count, MPI_Op op) {
+#if defined(MPIX_LOCAL) || MPI_VERSION >= 4
+  static MPI_Request requests[AGREE_COUNT] = {
+    MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL
+  };
+  static int *bufs[AGREE_COUNT];
+  static int counts[AGREE_COUNT];
+  if (requests[which] != MPI_REQUEST_NULL &&
+      (bufs[which] != buf || counts[which] != count)) {
+    MPI_Request_free(&requests[which]);
+  }
+  if (requests[which] == MPI_REQUEST_NULL) {
+    MPI_Allreduce_init(MPI_IN_PLACE, buf, count, MPI_INT, op, MPI_COMM_WORLD,
+                       MPI_INFO_NULL, &requests[which]);
+    bufs[which] = buf;
+    counts[which] = count;
+  }
+  MPI_Start(&requests[which]);
+  MPI_Wait(&requests[which], MPI_STATUS_IGNORE);
+#else
+  MPI_Allreduce(MPI_IN_PLACE, buf, count, MPI_INT, op, MPI_COMM_WORLD);
+#endif
+}
+
+
 // ===========================================================================
 // Application cleanup handler.
 // ===========================================================================
@@ -52,6 +91,21 @@ MPI_Cleanup_code application_cleanup_handler(MPI_Start_state start_state,
 }
 
 
+// ===========================================================================
+// Solver phase of one time step.  This is a nested restart scope.
+// ===========================================================================
+void solve(void *state, MPI_Start_state start_state) {
+  if (start_state == MPI_START_RESTARTED) {
+    restore_solver_state();
+  }
+
+  while (!converged()) {
+    // ... do some work ...
+    MPI_Fault_probe();
+  }
+}
+
+
 // ===========================================================================
 // Real main method of the application.  This is the entry point for rollbacks.
 // ===========================================================================
@@ -61,34 +115,56 @@ void resilient_main(int argc, char **argv, MPI_Start_state start_state) {
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
   // Check if the new world size is acceptable.  If it is not, then just abort.
-  if (can_run_at_size(size)) {
+  if (!can_run_at_size(size)) {
     MPI_Abort(MPI_COMM_WORLD, 1);
   }
 
   if (start_state != MPI_START_NEW) {
-    // Figure out who died.
+    // Figure out who died.  The buffers stay put unless the job is resized,
+    // so that the agreements on them are not built again.
+    static int *died, *held, agreed_size;
+    if (agreed_size != size) {
+      died = realloc(died, size * sizeof(int));
+      held = realloc(held, size * sizeof(int));
+      agreed_size = size;
+    }
     int i_died = (start_state == MPI_START_ADDED ? 1 : 0);
-    int someone_died, who_died;
-    MPI_Allreduce(&i_died, &someone_died, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
-    MPI_Allreduce(&i_died, &who_died, 1, MPI_INT, MPI_MAXLOC, MPI_COMM_WORLD);
+    for (int r = 0; r < size; r++) {
+      died[r] = r == rank && i_died;
+    }
+    agree(AGREE_DIED, died, size, MPI_MAX);
 
-    if (someone_died) {
-      int have_cp = have_neighbor_checkpoint_for(who_died);
-      MPI_Allreduce(MPI_IN_PLACE, &have_cp, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    // Neighbors can only help if every process that died has one that still
+    // holds its checkpoint.  Otherwise, everyone falls back to the disk.
+    // A checkpoint may have several holders, so count processes, not holders.
+    for (int r = 0; r < size; r++) {
+      held[r] = died[r] && have_neighbor_checkpoint_for(r);
+    }
+    agree(AGREE_HELD, held, size, MPI_MAX);
 
-      if (i_died) {
-        if (have_cp) {
+    int num_died = 0, have_cp = 0;
+    for (int r = 0; r < size; r++) {
+      num_died += died[r];
+      have_cp += held[r];
+    }
+
+    if (num_died) {
+      if (have_cp == num_died) {
+        for (int r = 0; r < size; r++) {
+          if (died[r] && have_neighbor_checkpoint_for(r)) {
+            send_neighbor_checkpoint_to(r);
+          }
+        }
+        if (i_died) {
           time_step = receive_neighbor_checkpoint();
-        } else {
-          time_step = last_checkpoint_on_disk(rank);
         }
-      } else if (have_neighbor_checkpoint_for(who_died)) {
-        send_neighbor_checkpoint_to(who_died);
+      } else if (i_died) {
+        time_step = last_checkpoint_on_disk(rank);
       }
     }
 
     // Take the minimum reached time step and start from there.
-    MPI_Allreduce(MPI_IN_PLACE, &time_step, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    agree(AGREE_STEP, &time_step, 1, MPI_MIN);
   }
 
   // Load a checkpoint based on start_step.  If this is a restart, it will be
@@ -104,19 +180,26 @@ void resilient_main(int argc, char **argv, MPI_Start_state start_state) {
   // Main restart loop for the application.
   //
   for (; time_step < MAX_STEP; time_step++) {
-    // Real application work.
-    while (!converged()) {
-      // ... do some work ...
-      MPI_Fault_probe();
-    }
+    // Real application work.  If a fault hits while every process is still
+    // solving, only the solve is redone instead of reloading a checkpoint.
+    save_solver_state();
+    MPI_Restart_scope(solve, 0);
+
+    // Mesh adaptation rewrites app data in place.  Run it as a transaction
+    // so that a fault part way through rolls back only what it touched.
+    MPI_Tx_begin();
+    adapt_mesh();
+    MPI_Tx_commit();
 
     // Application's own check for faults (assuming it knows how)
     if (physics_looks_ridiculous()) {
       MPI_Fault();
     }
 
-    // Checkpoint store routine.
+    // Checkpoint store routine.  Once the checkpoint is committed, older
+    // receive determinants are no longer needed for replay.
     store_checkpoint(time_step);
+    MPI_Replay_mark();
   }
 }
 
@@ -145,5 +228,6 @@ int main(int argc, char **argv) {
   // default start step so that the first invocation starts there.
   MPI_Reinit(argc, argv, resilient_main);
 
+  finalize_libraries();
   MPI_Finalize();
 }
@@ -0,0 +1,478 @@
+// ===========================================================================
+// Collectives for the local runtime, built on point-to-point messages with
+// internal tags.  All builtin operations are commutative, so reductions use
+// simple binomial trees.
+// ===========================================================================
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+// ===========================================================================
+// Reduction operations
+// ===========================================================================
+#define ARITH_OPS(T)                                                     \
+  case MPI_MAX:  for (i = 0; i < n; i++) if (a[i] > b[i]) b[i] = a[i];   \
+                 return MPI_SUCCESS;                                     \
+  case MPI_MIN:  for (i = 0; i < n; i++) if (a[i] < b[i]) b[i] = a[i];   \
+                 return MPI_SUCCESS;                                     \
+  case MPI_SUM:  for (i = 0; i < n; i++) b[i] = a[i] + b[i];             \
+                 return MPI_SUCCESS;                                     \
+  case MPI_PROD: for (i = 0; i < n; i++) b[i] = a[i] * b[i];             \
+                 return MPI_SUCCESS;                                     \
+  case MPI_LAND: for (i = 0; i < n; i++) b[i] = a[i] && b[i];            \
+                 return MPI_SUCCESS;                                     \
+  case MPI_LOR:  for (i = 0; i < n; i++) b[i] = a[i] || b[i];            \
+                 return MPI_SUCCESS;
+
+#define BIT_OPS(T)                                                       \
+  case MPI_BAND: for (i = 0; i < n; i++) b[i] = a[i] & b[i];             \
+                 return MPI_SUCCESS;                                     \
+  case MPI_BOR:  for (i = 0; i < n; i++) b[i] = a[i] | b[i];             \
+                 return MPI_SUCCESS;
+
+#define INT_REDUCE(T)                                                    \
+  static int reduce_##T(MPI_Op op, const void *in, void *inout, int n) { \
+    const T *a = in; T *b = inout; int i;                                \
+    switch (op) { ARITH_OPS(T) BIT_OPS(T) }                              \
+    return MPI_ERR_OP;                                                   \
+  }
+
+#define FLOAT_REDUCE(T)                                                  \
+  static int reduce_##T(MPI_Op op, const void *in, void *inout, int n) { \
+    const T *a = in; T *b = inout; int i;                                \
+    switch (op) { ARITH_OPS(T) }                                         \
+    return MPI_ERR_OP;                                                   \
+  }
+
+// MAXLOC and MINLOC keep the lowest index among equal values.
+#define LOC_REDUCE(NAME, T)                                              \
+  static int reduce_##NAME(MPI_Op op, const void *in, void *inout,      \
+                           int n) {                                      \
+    const T *a = in; T *b = inout; int i;                                \
+    if (op != MPI_MAXLOC && op != MPI_MINLOC) return MPI_ERR_OP;         \
+    for (i = 0; i < n; i++) {                                            \
+      int better = op == MPI_MAXLOC ? a[i].value > b[i].value            \
+                                    : a[i].value < b[i].value;           \
+      if (better || (a[i].value == b[i].value &&                         \
+                     a[i].index < b[i].index)) {                         \
+        b[i] = a[i];                                                     \
+      }                                                                  \
+    }                                                                    \
+    return MPI_SUCCESS;                                                  \
+  }
+
+typedef unsigned long ulong;
+typedef long long llong;
+typedef struct { int value; int index; } int_int;
+typedef struct { double value; int index; } double_int;
+
+INT_REDUCE(char)
+INT_REDUCE(int)
+INT_REDUCE(unsigned)
+INT_REDUCE(long)
+INT_REDUCE(ulong)
+INT_REDUCE(llong)
+INT_REDUCE(int64_t)
+INT_REDUCE(uint64_t)
+FLOAT_REDUCE(float)
+FLOAT_REDUCE(double)
+LOC_REDUCE(int_int, int_int)
+LOC_REDUCE(double_int, double_int)
+
+// Combine in into inout elementwise: inout = in op inout.
+static int reduce(MPI_Op op, MPI_Datatype type, const void *in, void *inout,
+                  int n) {
+  switch (type) {
+    case MPI_CHAR:          return reduce_char(op, in, inout, n);
+    case MPI_BYTE:          return reduce_char(op, in, inout, n);
+    case MPI_INT:           return reduce_int(op, in, inout, n);
+    case MPI_UNSIGNED:      return reduce_unsigned(op, in, inout, n);
+    case MPI_LONG:          return reduce_long(op, in, inout, n);
+    case MPI_UNSIGNED_LONG: return reduce_ulong(op, in, inout, n);
+    case MPI_LONG_LONG:     return reduce_llong(op, in, inout, n);
+    case MPI_INT64_T:       return reduce_int64_t(op, in, inout, n);
+    case MPI_UINT64_T:      return reduce_uint64_t(op, in, inout, n);
+    case MPI_FLOAT:         return reduce_float(op, in, inout, n);
+    case MPI_DOUBLE:        return reduce_double(op, in, inout, n);
+    case MPI_2INT:          return reduce_int_int(op, in, inout, n);
+    case MPI_DOUBLE_INT:    return reduce_double_int(op, in, inout, n);
+  }
+  return MPI_ERR_TYPE;
+}
+
+// ===========================================================================
+// Collectives
+// ===========================================================================
+int MPI_Barrier(MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Barrier"));
+  }
+
+  // Dissemination barrier.
+  for (int dist = 1; dist < c->size; dist *= 2) {
+    int to   = (c->rank + dist) % c->size;
+    int from = (c->rank - dist + c->size) % c->size;
+    local_send(NULL, 0, to, LOCAL_TAG_BARRIER, c);
+    local_recv(NULL, 0, from, LOCAL_TAG_BARRIER, c, MPI_STATUS_IGNORE);
+  }
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+static void bcast(void *buf, size_t bytes, int root, struct local_comm *c) {
+  int size = c->size;
+  int rel = (c->rank - root + size) % size;
+
+  int mask = 1;
+  while (mask < size) {
+    if (rel & mask) {
+      int from = (c->rank - mask + size) % size;
+      local_recv(buf, bytes, from, LOCAL_TAG_BCAST, c, MPI_STATUS_IGNORE);
+      break;
+    }
+    mask <<= 1;
+  }
+  for (mask >>= 1; mask > 0; mask >>= 1) {
+    if (rel + mask < size) {
+      local_send(buf, bytes, (c->rank + mask) % size, LOCAL_TAG_BCAST, c);
+    }
+  }
+}
+
+int MPI_Bcast(void *buf, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Bcast"));
+  } else if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Bcast"));
+  } else if (root < 0 || root >= c->size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_ROOT, "MPI_Bcast"));
+  }
+  bcast(buf, (size_t) count * size, root, c);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+// Binomial tree reduction of sendbuf into recvbuf at root.
+static int reduce_tree(const void *sendbuf, void *recvbuf, int count,
+                       MPI_Datatype type, MPI_Op op, int root,
+                       struct local_comm *c) {
+  size_t bytes = (size_t) count * local_type_size(type);
+  int size = c->size;
+  int rel = (c->rank - root + size) % size;
+
+  char *acc = malloc(bytes ? bytes : 1);
+  char *tmp = malloc(bytes ? bytes : 1);
+  memcpy(acc, sendbuf, bytes);
+
+  int rc = MPI_SUCCESS;
+  for (int mask = 1; mask < size; mask <<= 1) {
+    if (rel & mask) {
+      local_send(acc, bytes, (c->rank - mask + size) % size,
+                 LOCAL_TAG_REDUCE, c);
+      break;
+    } else if (rel + mask < size) {
+      local_recv(tmp, bytes, (c->rank + mask) % size, LOCAL_TAG_REDUCE, c,
+                 MPI_STATUS_IGNORE);
+      if (rc == MPI_SUCCESS) {
+        rc = reduce(op, type, tmp, acc, count);
+      }
+    }
+  }
+
+  if (c->rank == root) {
+    memcpy(recvbuf, acc, bytes);
+  }
+  free(tmp);
+  free(acc);
+  return rc;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+               MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Reduce"));
+  } else if (!local_type_size(datatype)) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Reduce"));
+  } else if (root < 0 || root >= c->size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_ROOT, "MPI_Reduce"));
+  }
+  if (sendbuf == MPI_IN_PLACE) {
+    sendbuf = recvbuf;
+  }
+  int rc = reduce_tree(sendbuf, recvbuf, count, datatype, op, root, c);
+  if (rc != MPI_SUCCESS) {
+    local_error(comm, rc, "MPI_Reduce");
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Allreduce"));
+  } else if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Allreduce"));
+  }
+  if (sendbuf == MPI_IN_PLACE) {
+    sendbuf = recvbuf;
+  }
+  int rc = reduce_tree(sendbuf, recvbuf, count, datatype, op, 0, c);
+  if (rc != MPI_SUCCESS) {
+    return LOCAL_EXIT(local_error(comm, rc, "MPI_Allreduce"));
+  }
+  bcast(recvbuf, (size_t) count * size, 0, c);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+// ===========================================================================
+// Persistent collectives
+//
+// A schedule is built once, when the request is made: the tree is worked out
+// and the buffers allocated, and every MPI_Start only moves and combines
+// data.  Schedules outlive rollbacks, so an agreement that restarting ranks
+// run with one is ready on the critical path of recovery.  If the
+// communicator was dropped and made again from its creation record, the
+// schedule follows it by that record, and it works out the tree again only
+// if the membership changed.  One made without a record cannot be told
+// from an unrelated communicator after the rollback, so its schedules fail
+// to start.
+// ===========================================================================
+struct local_sched {
+  MPI_Comm      comm;
+  int           context;
+  int           memo;               //!< Record of comm, or LOCAL_MEMO_*,
+  struct local_memo record;         //!< and what it recorded then.
+  uint32_t      resets;             //!< Communicator resets before comm.
+  const void   *sendbuf;
+  void         *recvbuf;
+  int           count;
+  MPI_Datatype  type;
+  MPI_Op        op;
+  size_t        bytes;
+  char         *acc, *tmp;
+  int           rank, size;         //!< Membership the tree was built for.
+  int           parent;             //!< -1 at the root.
+  int           nchildren;
+  int           children[32];       //!< Nearest first.
+};
+
+// The binomial tree of reduce_tree and bcast, rooted at 0.
+static void sched_tree(struct local_sched *s, struct local_comm *c) {
+  s->rank = c->rank;
+  s->size = c->size;
+  s->parent = -1;
+  s->nchildren = 0;
+  for (int mask = 1; mask < c->size; mask <<= 1) {
+    if (c->rank & mask) {
+      s->parent = c->rank - mask;
+      break;
+    } else if (c->rank + mask < c->size) {
+      s->children[s->nchildren++] = c->rank + mask;
+    }
+  }
+}
+
+// Whether c is the communicator of s.  Contexts are reused after a
+// rollback, so there a derived communicator must also have been made from
+// the same record: the same parent, the same place among its children, and
+// the same context.
+static int sched_owns(struct local_sched *s, struct local_comm *c) {
+  if (c->context != s->context || c->memo != s->memo) {
+    return 0;
+  } else if (s->memo >= 0) {
+    struct local_memo *m = local_comm_memo(s->memo);
+    return m->context == s->record.context &&
+           m->parent == s->record.parent &&
+           m->parent_context == s->record.parent_context &&
+           m->seq == s->record.seq;
+  }
+  return s->memo != LOCAL_MEMO_NONE || s->resets == local.comm_resets;
+}
+
+// The communicator of s, found again by its record after a rollback.
+static struct local_comm *sched_comm(struct local_sched *s) {
+  struct local_comm *c = local_comm_get(s->comm);
+  if (c && sched_owns(s, c)) {
+    return c;
+  }
+  for (int i = 0; i < LOCAL_MAX_COMMS; i++) {
+    if (local.comms[i].context >= 0 && sched_owns(s, &local.comms[i])) {
+      s->comm = i;
+      return &local.comms[i];
+    }
+  }
+  return NULL;
+}
+
+int local_sched_run(struct local_sched *s) {
+  struct local_comm *c = sched_comm(s);
+  if (!c) {
+    return MPI_ERR_COMM;
+  }
+  if (c->rank != s->rank || c->size != s->size) {
+    sched_tree(s, c);
+  }
+
+  memcpy(s->acc, s->sendbuf, s->bytes);
+  int rc = MPI_SUCCESS;
+  for (int i = 0; i < s->nchildren; i++) {
+    local_recv(s->tmp, s->bytes, s->children[i], LOCAL_TAG_REDUCE, c,
+               MPI_STATUS_IGNORE);
+    if (rc == MPI_SUCCESS) {
+      rc = reduce(s->op, s->type, s->tmp, s->acc, s->count);
+    }
+  }
+  if (s->parent >= 0) {
+    local_send(s->acc, s->bytes, s->parent, LOCAL_TAG_REDUCE, c);
+    local_recv(s->acc, s->bytes, s->parent, LOCAL_TAG_BCAST, c,
+               MPI_STATUS_IGNORE);
+  }
+  for (int i = s->nchildren - 1; i >= 0; i--) {
+    local_send(s->acc, s->bytes, s->children[i], LOCAL_TAG_BCAST, c);
+  }
+  memcpy(s->recvbuf, s->acc, s->bytes);
+  return rc;
+}
+
+void local_sched_free(struct local_sched *s) {
+  free(s->acc);
+  free(s->tmp);
+  free(s);
+}
+
+int MPI_Allreduce_init(const void *sendbuf, void *recvbuf, int count,
+                       MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                       void *info, MPI_Request *request) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Allreduce_init"));
+  } else if (!size || count < 0) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Allreduce_init"));
+  }
+  struct local_sched *s = calloc(1, sizeof(*s));
+  s->comm    = comm;
+  s->context = c->context;
+  s->memo    = c->memo;
+  s->resets  = local.comm_resets;
+  if (c->memo >= 0) {
+    s->record = *local_comm_memo(c->memo);
+  }
+  s->sendbuf = sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf;
+  s->recvbuf = recvbuf;
+  s->count   = count;
+  s->type    = datatype;
+  s->op      = op;
+  s->bytes   = (size_t) count * size;
+  s->acc     = malloc(s->bytes ? s->bytes : 1);
+  s->tmp     = malloc(s->bytes ? s->bytes : 1);
+  sched_tree(s, c);
+  *request = local_persistent(s);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+static int gather(const void *sendbuf, size_t bytes, void *recvbuf,
+                  int root, struct local_comm *c) {
+  if (c->rank != root) {
+    local_send(sendbuf, bytes, root, LOCAL_TAG_GATHER, c);
+    return MPI_SUCCESS;
+  }
+  for (int r = 0; r < c->size; r++) {
+    char *dst = (char*) recvbuf + (size_t) r * bytes;
+    if (r == root) {
+      if (sendbuf != MPI_IN_PLACE) {
+        memmove(dst, sendbuf, bytes);
+      }
+    } else {
+      local_recv(dst, bytes, r, LOCAL_TAG_GATHER, c, MPI_STATUS_IGNORE);
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               int root, MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Gather"));
+  } else if (root < 0 || root >= c->size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_ROOT, "MPI_Gather"));
+  }
+  size_t bytes = c->rank == root ?
+    (size_t) recvcount * local_type_size(recvtype) :
+    (size_t) sendcount * local_type_size(sendtype);
+  if (sendbuf == MPI_IN_PLACE) {
+    sendbuf = (char*) recvbuf + (size_t) c->rank * bytes;
+  }
+  return LOCAL_EXIT(gather(sendbuf, bytes, recvbuf, root, c));
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Allgather"));
+  }
+  size_t bytes = (size_t) recvcount * local_type_size(recvtype);
+  if (sendbuf == MPI_IN_PLACE) {
+    sendbuf = (char*) recvbuf + (size_t) c->rank * bytes;
+  }
+  gather(sendbuf, bytes, recvbuf, 0, c);
+  bcast(recvbuf, bytes * c->size, 0, c);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+// Pairwise exchange: in round d, send to the rank d above and receive from
+// the rank d below, like the dissemination barrier.
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_COMM, "MPI_Alltoall"));
+  }
+  size_t bytes = (size_t) recvcount * local_type_size(recvtype);
+  char *copy = NULL;
+  if (sendbuf == MPI_IN_PLACE) {
+    copy = malloc(bytes * c->size + 1);
+    memcpy(copy, recvbuf, bytes * c->size);
+    sendbuf = copy;
+  }
+  const char *in = sendbuf;
+  char *out = recvbuf;
+  memmove(out + (size_t) c->rank * bytes, in + (size_t) c->rank * bytes,
+          bytes);
+  for (int dist = 1; dist < c->size; dist++) {
+    int to   = (c->rank + dist) % c->size;
+    int from = (c->rank - dist + c->size) % c->size;
+    local_send(in + (size_t) to * bytes, bytes, to, LOCAL_TAG_ALLTOALL, c);
+    local_recv(out + (size_t) from * bytes, bytes, from, LOCAL_TAG_ALLTOALL,
+               c, MPI_STATUS_IGNORE);
+  }
+  free(copy);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
@@ -0,0 +1,497 @@
+// ===========================================================================
+// Communicators for the local runtime.
+//
+// Every dup and split is recorded in the calling rank's slot, keyed by the
+// communicator it was made from and how many had been made from that one
+// before.  A rollback to MPI_Reinit drops all derived communicators, and the
+// application makes them again in the same order; each call that finds a
+// record every member made before the fault is rebuilt from it without
+// communicating.  Each process checks only its own arguments against its
+// record; one that finds them changed raises a fault, and in that extra
+// recovery every process releases its records, so the communicators are
+// made as usual.  Records live in shared memory, so a replacement finds
+// those of the rank it replaces, and freeing a communicator frees its
+// record for another one.
+//
+// When the job shrinks or grows, MPI_COMM_WORLD is rebuilt from the ranks in
+// it, in the order of their slots, and the records are dropped along with
+// the old world.
+// ===========================================================================
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+// World rank -> world rank, which is both maps of MPI_COMM_WORLD.  Built
+// by the supervisor before it forks, so that no process, and in particular
+// no replacement, spends time proportional to the job size on it.
+static int *identity;
+
+static void comm_set(struct local_comm *c, int context, int rank, int size,
+                     int *world) {
+  c->context = context;
+  c->rank    = rank;
+  c->size    = size;
+  c->world   = world;
+  c->memo    = LOCAL_MEMO_NONE;
+  c->created = 0;
+  c->local   = malloc(local.size * sizeof(int));
+  for (int r = 0; r < local.size; r++) {
+    c->local[r] = -1;
+  }
+  for (int r = 0; r < size; r++) {
+    c->local[world[r]] = r;
+  }
+}
+
+static void comm_clear(struct local_comm *c) {
+  free(c->world);
+  free(c->local);
+  memset(c, 0, sizeof(*c));
+  c->context = -1;
+}
+
+void local_comm_setup(int size) {
+  identity = malloc(size * sizeof(int));
+  for (int r = 0; r < size; r++) {
+    identity[r] = r;
+  }
+}
+
+// Whether rank was in the job after the given number of resizes.  Only the
+// last time it left and came back are kept, which is all that recovery
+// ever asks about.
+static int in_world(int rank, uint32_t resizes) {
+  struct local_slot *slot = &local.shm->slots[rank];
+  uint32_t dropped = slot->dropped, joined = slot->joined;
+  if (joined > dropped) {
+    return resizes < dropped || resizes >= joined;
+  }
+  return !dropped || (resizes < dropped && resizes >= joined);
+}
+
+// Make MPI_COMM_WORLD the ranks in the job after the given number of
+// resizes.
+static void world_build(uint32_t resizes) {
+  struct local_comm *world = &local.comms[MPI_COMM_WORLD];
+  if (world->world != identity) {
+    free(world->world);
+    free(world->local);
+  }
+  world->context = 0;
+  world->memo    = LOCAL_MEMO_WORLD;
+  world->created = 0;
+  local.resizes = resizes;
+  if (!resizes) {
+    world->rank  = local.rank;
+    world->size  = local.size;
+    world->world = identity;
+    world->local = identity;
+    return;
+  }
+
+  world->world = malloc(local.size * sizeof(int));
+  world->local = malloc(local.size * sizeof(int));
+  world->size  = 0;
+  for (int r = 0; r < local.size; r++) {
+    world->local[r] = in_world(r, resizes) ? world->size : -1;
+    if (world->local[r] >= 0) {
+      world->world[world->size++] = r;
+    }
+  }
+  world->rank = world->local[local.rank];
+}
+
+void local_comm_init(void) {
+  for (int i = 0; i < LOCAL_MAX_COMMS; i++) {
+    local.comms[i].context = -1;
+  }
+  local.comms[MPI_COMM_WORLD].world = identity;
+  world_build(__atomic_load_n(&local.shm->resizes, __ATOMIC_SEQ_CST));
+
+  int *self = malloc(sizeof(int));
+  self[0] = local.rank;
+  comm_set(&local.comms[MPI_COMM_SELF], 1, 0, 1, self);
+  local.comms[MPI_COMM_SELF].memo = LOCAL_MEMO_SELF;
+
+  local.next_context = 2;
+}
+
+static MPI_Comm free_handle(void) {
+  for (int i = MPI_COMM_SELF + 1; i < LOCAL_MAX_COMMS; i++) {
+    if (local.comms[i].context < 0) {
+      return i;
+    }
+  }
+  return MPI_COMM_NULL;
+}
+
+// ===========================================================================
+// Creation records
+// ===========================================================================
+static struct local_memo *memos(int rank) {
+  struct local_memo *table = local_at(local.shm->memo_table);
+  return table + (size_t) rank * LOCAL_MAX_MEMOS;
+}
+
+struct local_memo *local_comm_memo(int index) {
+  return &memos(local.rank)[index];
+}
+
+// Whether rank recorded the communicator that m records.  A rank never
+// takes part in two creations with the same context, so this identifies it.
+static int memo_made(int rank, const struct local_memo *m) {
+  struct local_memo *log = memos(rank);
+  uint32_t count = __atomic_load_n(&local.shm->slots[rank].memos,
+                                   __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < count; i++) {
+    if (log[i].context == m->context && log[i].seq == m->seq &&
+        log[i].parent_context == m->parent_context &&
+        log[i].kind == m->kind) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Decide which records of this rank may be reused: those not freed that
+// every member of the parent made, with a parent that may be reused too.  A
+// creation cut short by a fault is recorded by only some members, and then
+// by none.  Records only change outside recovery, so every member of a
+// communicator comes to the same decision, and no messages are needed.
+static void memo_validate(void) {
+  struct local_memo *log = memos(local.rank);
+  uint32_t count = local.shm->slots[local.rank].memos;
+  for (uint32_t i = 0; i < count; i++) {
+    struct local_memo *m = &log[i];
+    int valid = m->context >= 0;
+    if (m->parent == LOCAL_MEMO_WORLD) {
+      struct local_comm *world = &local.comms[MPI_COMM_WORLD];
+      for (int r = 0; valid && r < world->size; r++) {
+        valid = memo_made(world->world[r], m);
+      }
+    } else if (m->parent >= 0) {
+      struct local_memo *p = &log[m->parent];
+      int *members = local_at(p->world);
+      valid = p->valid && p->context == m->parent_context;
+      for (int r = 0; valid && r < p->size; r++) {
+        valid = memo_made(members[r], m);
+      }
+    }
+    m->valid = valid;
+  }
+}
+
+// A record for a new communicator: a fresh one, or one that was freed.
+// Returns -1 if all are in use.
+static int memo_slot(void) {
+  struct local_slot *slot = &local.shm->slots[local.rank];
+  if (slot->memos < LOCAL_MAX_MEMOS) {
+    return slot->memos;
+  }
+  struct local_memo *log = memos(local.rank);
+  for (int i = 0; i < LOCAL_MAX_MEMOS; i++) {
+    if (log[i].context < 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Record a communicator this process made from parent, or NULL for a split
+// that left it out.
+static void memo_record(struct local_comm *parent, int kind, int color,
+                        int key, int context, struct local_comm *c) {
+  struct local_slot *slot = &local.shm->slots[local.rank];
+  int index = memo_slot();
+  if (!local.shm->comm_memo || parent->memo == LOCAL_MEMO_NONE ||
+      index < 0) {
+    return;
+  }
+
+  // A record this one replaces, which was not reused, goes.
+  struct local_memo *log = memos(local.rank);
+  for (uint32_t i = 0; i < slot->memos; i++) {
+    if (log[i].context >= 0 && log[i].parent == parent->memo &&
+        log[i].parent_context == parent->context &&
+        log[i].seq == (uint32_t) parent->created) {
+      log[i].valid = 0;
+      __atomic_store_n(&log[i].context, -1, __ATOMIC_RELEASE);
+    }
+  }
+
+  struct local_memo *m = &log[index];
+  __atomic_store_n(&m->context, -1, __ATOMIC_RELEASE);
+  m->parent         = parent->memo;
+  m->parent_context = parent->context;
+  m->seq            = parent->created;
+  m->kind           = kind;
+  m->color          = color;
+  m->key            = key;
+  m->rank           = c ? c->rank : -1;
+  m->size           = c ? c->size : 0;
+  m->valid          = 0;
+  if (c) {
+    if (!m->world || m->room < c->size) {
+      m->world = local_offset(local_heap_alloc(c->size * sizeof(int)));
+      m->room  = c->size;
+    }
+    memcpy(local_at(m->world), c->world, c->size * sizeof(int));
+    c->memo = index;
+  }
+  __atomic_store_n(&m->context, context, __ATOMIC_RELEASE);
+  if (index == (int) slot->memos) {
+    __atomic_store_n(&slot->memos, slot->memos + 1, __ATOMIC_RELEASE);
+  }
+}
+
+// Release every record of this process, e.g. after a mismatch.
+static void memo_release_all(void) {
+  struct local_memo *log = memos(local.rank);
+  uint32_t count = local.shm->slots[local.rank].memos;
+  for (uint32_t i = 0; i < count; i++) {
+    log[i].valid = 0;
+    __atomic_store_n(&log[i].context, -1, __ATOMIC_RELEASE);
+  }
+}
+
+// This process was called with other arguments than it recorded.  Members
+// that already rebuilt the communicator cannot be told without messages, so
+// the job rolls back to MPI_Reinit once more and every process releases its
+// records there; see local_comm_reset.
+void local_comm_memo_mismatch(void) {
+  __atomic_add_fetch(&local.shm->memo_drops, 1, __ATOMIC_SEQ_CST);
+  MPI_Fault();
+}
+
+// Find the record of the next communicator made from parent, if it may be
+// reused.  Every member of the parent finds one or none, since they decided
+// the same way which to reuse, and each checks only its own arguments: if
+// all of them pass what they recorded, the communicator is the recorded
+// one, with no messages at all.
+static struct local_memo *memo_find(struct local_comm *parent, int kind,
+                                    int color, int key) {
+  if (!local.shm->comm_memo || parent->memo == LOCAL_MEMO_NONE) {
+    return NULL;
+  }
+
+  struct local_memo *log = memos(local.rank);
+  struct local_memo *found = NULL;
+  uint32_t count = local.shm->slots[local.rank].memos;
+  for (uint32_t i = 0; i < count; i++) {
+    if (log[i].valid && log[i].parent == parent->memo &&
+        log[i].parent_context == parent->context &&
+        log[i].seq == (uint32_t) parent->created) {
+      found = &log[i];
+    }
+  }
+  if (found && (found->kind != kind || found->color != color ||
+                found->key != key)) {
+    local_comm_memo_mismatch();
+  }
+  return found;
+}
+
+// Rebuild a communicator from its record.
+static int memo_rebuild(struct local_memo *m, MPI_Comm *newcomm,
+                        const char *fn) {
+  if (m->context >= local.next_context) {
+    local.next_context = m->context + 1;
+  }
+  if (m->rank < 0) {
+    *newcomm = MPI_COMM_NULL;
+    return MPI_SUCCESS;
+  }
+
+  MPI_Comm handle = free_handle();
+  if (handle == MPI_COMM_NULL) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_NO_MEM, fn);
+  }
+  int *world = malloc(m->size * sizeof(int));
+  memcpy(world, local_at(m->world), m->size * sizeof(int));
+  comm_set(&local.comms[handle], m->context, m->rank, m->size, world);
+  local.comms[handle].memo = m - memos(local.rank);
+  *newcomm = handle;
+  return MPI_SUCCESS;
+}
+
+// Drop all derived communicators.  Called when rolling back to MPI_Reinit,
+// after which the application creates them again, from the records where
+// it can.  New contexts stay clear of every recorded one.  If the job
+// was resized, MPI_COMM_WORLD is rebuilt and no record is reused, and if a
+// process found its arguments changed, every record is released.
+void local_comm_reset(void) {
+  for (int i = MPI_COMM_SELF + 1; i < LOCAL_MAX_COMMS; i++) {
+    if (local.comms[i].context >= 0) {
+      comm_clear(&local.comms[i]);
+    }
+  }
+  local.comms[MPI_COMM_WORLD].created = 0;
+  local.comms[MPI_COMM_SELF].created = 0;
+  local.next_context = 2;
+  local.comm_resets++;
+
+  struct local_memo *log = memos(local.rank);
+  uint32_t count = local.shm->slots[local.rank].memos;
+  for (uint32_t i = 0; i < count; i++) {
+    if (log[i].context >= local.next_context) {
+      local.next_context = log[i].context + 1;
+    }
+  }
+  uint32_t drops = __atomic_load_n(&local.shm->memo_drops, __ATOMIC_SEQ_CST);
+  if (drops != local.memo_drops) {
+    memo_release_all();
+    local.memo_drops = drops;
+  }
+  uint32_t resizes = __atomic_load_n(&local.shm->resizes, __ATOMIC_SEQ_CST);
+  if (resizes != local.resizes) {
+    world_build(resizes);
+    __atomic_store_n(&local.shm->slots[local.rank].memos, 0,
+                     __ATOMIC_RELEASE);
+  }
+  memo_validate();
+}
+
+struct local_comm *local_comm_get(MPI_Comm comm) {
+  if (comm < 0 || comm >= LOCAL_MAX_COMMS || local.comms[comm].context < 0) {
+    return NULL;
+  }
+  return &local.comms[comm];
+}
+
+// Agree on a context id that is unused on every process in comm.
+static int new_context(MPI_Comm comm) {
+  int context = local.next_context;
+  MPI_Allreduce(MPI_IN_PLACE, &context, 1, MPI_INT, MPI_MAX, comm);
+  local.next_context = context + 1;
+  return context;
+}
+
+int MPI_Comm_dup(MPI_Comm comm, MPI_Comm *newcomm) {
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return local_error(comm, MPI_ERR_COMM, "MPI_Comm_dup");
+  }
+  struct local_memo *m = memo_find(c, LOCAL_MEMO_DUP, 0, 0);
+  if (m) {
+    c->created++;
+    return memo_rebuild(m, newcomm, "MPI_Comm_dup");
+  }
+
+  int context = new_context(comm);
+  MPI_Comm handle = free_handle();
+  if (handle == MPI_COMM_NULL) {
+    return local_error(comm, MPI_ERR_NO_MEM, "MPI_Comm_dup");
+  }
+
+  int *world = malloc(c->size * sizeof(int));
+  memcpy(world, c->world, c->size * sizeof(int));
+  comm_set(&local.comms[handle], context, c->rank, c->size, world);
+  memo_record(c, LOCAL_MEMO_DUP, 0, 0, context, &local.comms[handle]);
+  c->created++;
+  *newcomm = handle;
+  return MPI_SUCCESS;
+}
+
+struct split_entry {
+  int color;
+  int key;
+  int rank;
+};
+
+static int compare_split(const void *a, const void *b) {
+  const struct split_entry *x = a, *y = b;
+  if (x->key != y->key) {
+    return x->key < y->key ? -1 : 1;
+  }
+  return x->rank - y->rank;
+}
+
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm *newcomm) {
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return local_error(comm, MPI_ERR_COMM, "MPI_Comm_split");
+  }
+  struct local_memo *m = memo_find(c, LOCAL_MEMO_SPLIT, color, key);
+  if (m) {
+    c->created++;
+    return memo_rebuild(m, newcomm, "MPI_Comm_split");
+  }
+
+  int mine[2] = { color, key };
+  int *all = malloc(2 * c->size * sizeof(int));
+  MPI_Allgather(mine, 2, MPI_INT, all, 2, MPI_INT, comm);
+  int context = new_context(comm);
+
+  if (color == MPI_UNDEFINED) {
+    free(all);
+    memo_record(c, LOCAL_MEMO_SPLIT, color, key, context, NULL);
+    c->created++;
+    *newcomm = MPI_COMM_NULL;
+    return MPI_SUCCESS;
+  }
+
+  struct split_entry *members = malloc(c->size * sizeof(*members));
+  int size = 0;
+  for (int r = 0; r < c->size; r++) {
+    if (all[2 * r] == color) {
+      members[size].color = color;
+      members[size].key   = all[2 * r + 1];
+      members[size].rank  = r;
+      size++;
+    }
+  }
+  qsort(members, size, sizeof(*members), compare_split);
+
+  int *world = malloc(size * sizeof(int));
+  int rank = -1;
+  for (int i = 0; i < size; i++) {
+    world[i] = c->world[members[i].rank];
+    if (members[i].rank == c->rank) {
+      rank = i;
+    }
+  }
+  free(members);
+  free(all);
+
+  MPI_Comm handle = free_handle();
+  if (handle == MPI_COMM_NULL) {
+    free(world);
+    return local_error(comm, MPI_ERR_NO_MEM, "MPI_Comm_split");
+  }
+  comm_set(&local.comms[handle], context, rank, size, world);
+  memo_record(c, LOCAL_MEMO_SPLIT, color, key, context, &local.comms[handle]);
+  c->created++;
+  *newcomm = handle;
+  return MPI_SUCCESS;
+}
+
+int MPI_Comm_free(MPI_Comm *comm) {
+  struct local_comm *c = local_comm_get(*comm);
+  if (*comm <= MPI_COMM_SELF || !c) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_COMM, "MPI_Comm_free");
+  }
+  if (c->memo >= 0) {
+    struct local_memo *m = &memos(local.rank)[c->memo];
+    m->valid = 0;
+    __atomic_store_n(&m->context, -1, __ATOMIC_RELEASE);
+  }
+  comm_clear(c);
+  *comm = MPI_COMM_NULL;
+  return MPI_SUCCESS;
+}
+
+int MPI_Reinit_remap(int max, int map[], int *old_size) {
+  struct local_comm *world = &local.comms[MPI_COMM_WORLD];
+  int old = 0;
+  for (int r = 0; r < local.size; r++) {
+    if (in_world(r, local.remap_base)) {
+      if (old < max) {
+        map[old] = world->local[r] >= 0 ? world->local[r] : MPI_UNDEFINED;
+      }
+      old++;
+    }
+  }
+  *old_size = old;
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,743 @@
+// ===========================================================================
+// Process management for the local runtime: the shared mapping, the
+// supervisor that forks and replaces ranks, and MPI environment routines.
+// ===========================================================================
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "local.h"
+
+struct local_proc local;
+
+static size_t shm_bytes;        //!< Size of the shared mapping.
+static double repair;           //!< Seconds until a dropped rank returns.
+
+// ===========================================================================
+// Helpers
+// ===========================================================================
+void local_die(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "mpi-local: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  MPI_Abort(MPI_COMM_WORLD, 1);
+  _exit(1);
+}
+
+static long env_long(const char *name, long dflt) {
+  const char *value = getenv(name);
+  if (!value || !*value) {
+    return dflt;
+  }
+  char *end;
+  long result = strtol(value, &end, 10);
+  if (*end || result < 0) {
+    fprintf(stderr, "mpi-local: bad value for %s: '%s'\n", name, value);
+    exit(1);
+  }
+  return result;
+}
+
+void *local_at(uint64_t offset) {
+  return (char*) local.shm + offset;
+}
+
+uint64_t local_offset(void *ptr) {
+  return (uint64_t) ((char*) ptr - (char*) local.shm);
+}
+
+void *local_heap_alloc(uint64_t bytes) {
+  bytes = (bytes + 63) & ~(uint64_t) 63;
+  uint64_t offset = __atomic_fetch_add(&local.shm->heap_top, bytes,
+                                       __ATOMIC_RELAXED);
+  if (offset + bytes > local.shm->heap_end) {
+    local_die("shared heap exhausted; raise MPI_LOCAL_HEAP_MB");
+  }
+  return local_at(offset);
+}
+
+// ===========================================================================
+// Doorbells.  Every rank sleeps on its own futex word, and anyone who makes
+// something available to a rank rings it.
+// ===========================================================================
+static long futex(uint32_t *addr, int op, uint32_t val,
+                  const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+uint32_t local_doorbell(void) {
+  return __atomic_load_n(&local.shm->slots[local.rank].doorbell,
+                         __ATOMIC_SEQ_CST);
+}
+
+void local_ring(int rank) {
+  struct local_slot *slot = &local.shm->slots[rank];
+  __atomic_add_fetch(&slot->doorbell, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&slot->sleeping, __ATOMIC_SEQ_CST)) {
+    futex(&slot->doorbell, FUTEX_WAKE, INT_MAX, NULL);
+  }
+}
+
+void local_ring_all(void) {
+  for (int r = 0; r < local.shm->size; r++) {
+    local_ring(r);
+  }
+}
+
+// Signal and ring one rank about a fault, unless it is self, or started at
+// or after since and so has no handler yet; it finds out from MPI_Init.
+static void tell(int rank, int self, double since) {
+  struct local_slot *slot = &local.shm->slots[rank];
+  if (rank != self && slot->pid > 0 && slot->spawn_time < since) {
+    kill(slot->pid, SIGUSR1);
+  }
+  local_ring(rank);
+}
+
+// Disseminate a fault detected at since: wake anyone blocked in the
+// runtime, and interrupt anyone computing in asynchronous mode.  Only the
+// leader of each node is told, and passes it on to its node when it starts
+// recovering; a node whose leader cannot take a signal yet is told whole.
+// self is the calling rank, or -1 in the supervisor.
+void local_notify(int self, double since) {
+  struct local_shared *shm = local.shm;
+  struct local_node *nodes = local_at(shm->nodes);
+  for (int n = 0; n < shm->nnodes; n++) {
+    int leader = nodes[n].leader;
+    if (!nodes[n].members || leader == self) {
+      continue;
+    }
+    if (shm->slots[leader].pid > 0 &&
+        shm->slots[leader].spawn_time < since) {
+      tell(leader, self, since);
+      continue;
+    }
+    for (int r = n * shm->ppn; r < (n + 1) * shm->ppn && r < shm->size; r++) {
+      tell(r, self, since);
+    }
+  }
+}
+
+// Pass the current fault on to the rest of this rank's node if it leads it.
+void local_notify_node(void) {
+  struct local_shared *shm = local.shm;
+  struct local_node *node = &((struct local_node *) local_at(shm->nodes))[
+    local.rank / shm->ppn];
+  if (node->leader != local.rank) {
+    return;
+  }
+  int end = (local.rank / shm->ppn + 1) * shm->ppn;
+  for (int r = local.rank + 1; r < end && r < shm->size; r++) {
+    tell(r, local.rank, shm->detect_time);
+  }
+}
+
+void local_sleep(uint32_t seen) {
+  // Time out now and then, so that a missed wakeup only costs latency.
+  static const struct timespec timeout = { 0, 50 * 1000 * 1000 };
+  struct local_slot *slot = &local.shm->slots[local.rank];
+  __atomic_store_n(&slot->sleeping, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&slot->doorbell, __ATOMIC_SEQ_CST) == seen) {
+    futex(&slot->doorbell, FUTEX_WAIT, seen, &timeout);
+  }
+  __atomic_store_n(&slot->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+// ===========================================================================
+// Supervisor
+// ===========================================================================
+
+// Start running as a rank.  Called in a freshly forked child.
+static void local_child(int rank, int replacement) {
+  struct local_shared *shm = local.shm;
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() != shm->supervisor) {
+    _exit(1);
+  }
+
+  local.rank        = rank;
+  local.size        = shm->size;
+  local.epoch       = __atomic_load_n(&shm->fault_epoch, __ATOMIC_SEQ_CST);
+  local.replacement = replacement;
+  local.initialized = 1;
+
+  local_trace_init();
+  local_comm_init();
+  local_p2p_init();
+  local_replay_init();
+  local_tx_init();
+  local_fault_init();
+  local_inject_init();
+}
+
+static void kill_all(void) {
+  struct local_shared *shm = local.shm;
+  for (int r = 0; r < shm->size; r++) {
+    if (shm->slots[r].pid > 0) {
+      kill(shm->slots[r].pid, SIGKILL);
+    }
+  }
+  while (wait(NULL) > 0 || errno == EINTR) {
+  }
+}
+
+static void on_terminate(int sig) {
+  struct local_shared *shm = local.shm;
+  for (int r = 0; r < shm->size; r++) {
+    if (shm->slots[r].pid > 0) {
+      kill(shm->slots[r].pid, SIGKILL);
+    }
+  }
+  _exit(128 + sig);
+}
+
+// Dump every rank's events once all processes are gone.  The process of
+// the rank that was lost is already reaped, so its pid is passed in.
+static void dump_all(int lost, pid_t pid, int reason) {
+  struct local_shared *shm = local.shm;
+  for (int r = 0; r < shm->size; r++) {
+    local_trace_dump(r, r == lost ? pid : shm->slots[r].pid, reason);
+  }
+}
+
+// A rank was lost.  Returns nonzero if the job can recover from it.
+static int recoverable(int lost, long max_faults) {
+  struct local_shared *shm = local.shm;
+  if (shm->faults >= (uint32_t) max_faults) {
+    fprintf(stderr, "mpi-local: giving up after %u replaced processes\n",
+            shm->faults);
+    return 0;
+  } else if (!shm->spares && shm->live == 1) {
+    fprintf(stderr, "mpi-local: lost the last rank\n");
+    return 0;
+  }
+  for (int r = 0; r < shm->size; r++) {
+    uint32_t state = __atomic_load_n(&shm->slots[r].state, __ATOMIC_SEQ_CST);
+    if (state == LOCAL_SLOT_DONE || state == LOCAL_SLOT_FINALIZED) {
+      fprintf(stderr, "mpi-local: rank %d was lost after rank %d left "
+              "MPI_Reinit; cannot recover\n", lost, r);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// When the next dropped rank is due back, or 0 if none is.  Sets *due if
+// one is due now and the job can take it: like timed faults, growing waits
+// until every rank is back in the restart point.
+static double repairs(int *due) {
+  struct local_shared *shm = local.shm;
+  double now = MPI_Wtime();
+  double soonest = 0;
+  for (int r = 0; r < shm->size; r++) {
+    double at = shm->slots[r].repair_time;
+    if (!at) {
+      continue;
+    }
+    if (at <= now) {
+      if (local_all_running()) {
+        *due = 1;
+        return now;
+      }
+      at = now + 1e-3;
+    }
+    if (!soonest || at < soonest) {
+      soonest = at;
+    }
+  }
+  return soonest;
+}
+
+static double timers(int *due) {
+  double next = local_inject_timers();
+  double back = repairs(due);
+  return back && (!next || back < next) ? back : next;
+}
+
+// Wait for a rank to exit.  With timed injection rules or dropped ranks to
+// bring back, SIGCHLD is blocked so that waiting for it can time out when
+// the next one is due.  Returns 0 with *due set when ranks are due back.
+static pid_t wait_rank(int *status, int *due) {
+  double next = timers(due);
+  if (*due) {
+    return 0;
+  } else if (!next) {
+    return waitpid(-1, status, 0);
+  }
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  for (;;) {
+    pid_t pid = waitpid(-1, status, WNOHANG);
+    if (pid) {
+      return pid;
+    }
+    double delay = next - MPI_Wtime();
+    delay = delay > 0 ? delay : 0;
+    struct timespec timeout = {
+      (time_t) delay, (long) ((delay - (time_t) delay) * 1e9)
+    };
+    sigtimedwait(&set, NULL, &timeout);
+    next = timers(due);
+    if (*due) {
+      return 0;
+    }
+  }
+}
+
+// Start a process for rank.  Returns 0 in the new process.
+static pid_t spawn(int rank) {
+  // The process may get as far as MPI_Finalize before fork returns here.
+  __atomic_store_n(&local.shm->slots[rank].state, LOCAL_SLOT_ALIVE,
+                   __ATOMIC_SEQ_CST);
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("mpi-local: fork");
+    kill_all();
+    exit(1);
+  } else if (pid > 0) {
+    local.shm->slots[rank].pid = pid;
+  }
+  return pid;
+}
+
+// Continue without a lost rank: take it out of its node and let the ranks
+// rebuild MPI_COMM_WORLD without it.  Everything the ranks read to recover
+// is updated before the fault epoch is bumped.
+static void drop(int rank) {
+  struct local_shared *shm = local.shm;
+  struct local_node *node = &((struct local_node *) local_at(shm->nodes))[
+    rank / shm->ppn];
+  shm->slots[rank].dropped = shm->resizes + 1;
+  shm->slots[rank].repair_time = repair ? MPI_Wtime() + repair : 0;
+  __atomic_store_n(&shm->slots[rank].state, LOCAL_SLOT_GONE,
+                   __ATOMIC_SEQ_CST);
+  shm->live--;
+  if (--node->members == 0) {
+    shm->live_nodes--;
+  } else if (node->leader == rank) {
+    while (shm->slots[node->leader].state == LOCAL_SLOT_GONE) {
+      node->leader++;
+    }
+  }
+  __atomic_add_fetch(&shm->resizes, 1, __ATOMIC_SEQ_CST);
+  fprintf(stderr, "mpi-local: no spare for rank %d; continuing with %d "
+          "ranks\n", rank, shm->live);
+}
+
+// Bring back every dropped rank that is due, in one resize, as a process
+// that starts like a replacement.  A repaired node comes back whole, with
+// every rank dropped from it.  The ranks take their old places in
+// MPI_COMM_WORLD.  Returns the rank in the new process, and -1 in the
+// supervisor once all have started.
+static int grow(void) {
+  struct local_shared *shm = local.shm;
+  struct local_node *nodes = local_at(shm->nodes);
+  double now = MPI_Wtime();
+  char due[shm->nnodes];
+  memset(due, 0, sizeof(due));
+  for (int r = 0; r < shm->size; r++) {
+    double at = shm->slots[r].repair_time;
+    due[r / shm->ppn] |= at && at <= now;
+  }
+  for (int r = 0; r < shm->size; r++) {
+    struct local_slot *slot = &shm->slots[r];
+    if (!slot->repair_time || !due[r / shm->ppn]) {
+      continue;
+    }
+    struct local_node *node = &nodes[r / shm->ppn];
+    slot->joined = shm->resizes + 1;
+    slot->repair_time = 0;
+    slot->spawn_time = now;
+    __atomic_store_n(&slot->state, LOCAL_SLOT_DEAD, __ATOMIC_SEQ_CST);
+    shm->live++;
+    if (node->members++ == 0) {
+      shm->live_nodes++;
+      node->leader = r;
+    } else if (r < node->leader) {
+      node->leader = r;
+    }
+  }
+  shm->fail_time = shm->detect_time = now;
+  __atomic_add_fetch(&shm->resizes, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&shm->fault_epoch, 1, __ATOMIC_SEQ_CST);
+
+  for (int r = 0; r < shm->size; r++) {
+    struct local_slot *slot = &shm->slots[r];
+    if (slot->joined == shm->resizes) {
+      fprintf(stderr, "mpi-local: rank %d is back; continuing with %d "
+              "ranks\n", r, shm->live);
+      if (spawn(r) == 0) {
+        return r;
+      }
+    }
+  }
+  local_notify(-1, now);
+  return -1;
+}
+
+// Wait for ranks to finish, replacing any that are lost.  Only returns in a
+// replacement process, which then returns from MPI_Init.
+static void local_supervise(void) {
+  struct local_shared *shm = local.shm;
+  long max_faults = env_long("MPI_LOCAL_MAX_FAULTS", 64);
+  int finished = 0;
+  int exit_code = 0;
+
+  signal(SIGINT, on_terminate);
+  signal(SIGTERM, on_terminate);
+  signal(SIGHUP, on_terminate);
+
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+
+  for (;;) {
+    int status, due = 0;
+    pid_t pid = wait_rank(&status, &due);
+    if (due) {
+      int rank = grow();
+      if (rank >= 0) {
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        local_child(rank, 1);
+        return;
+      }
+      continue;
+    } else if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      exit(exit_code);
+    }
+
+    int rank = -1;
+    for (int r = 0; r < shm->size; r++) {
+      if (shm->slots[r].pid == pid) {
+        rank = r;
+        break;
+      }
+    }
+    if (rank < 0) {
+      continue;
+    }
+
+    struct local_slot *slot = &shm->slots[rank];
+    if (__atomic_load_n(&shm->aborting, __ATOMIC_SEQ_CST)) {
+      slot->pid = 0;
+      kill_all();
+      dump_all(rank, pid, LOCAL_DUMP_ABORT);
+      exit(shm->abort_code ? shm->abort_code : 1);
+    }
+
+    uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_SEQ_CST);
+    if (state == LOCAL_SLOT_FINALIZED) {
+      slot->pid = 0;
+      if (WIFEXITED(status) && WEXITSTATUS(status) > exit_code) {
+        exit_code = WEXITSTATUS(status);
+      } else if (WIFSIGNALED(status)) {
+        exit_code = 128 + WTERMSIG(status);
+      }
+      if (++finished == shm->live) {
+        local_work_summary();
+        exit(exit_code);
+      }
+      continue;
+    }
+
+    // The rank was lost before finalizing.
+    slot->pid = 0;
+    slot->running = 0;
+    if (WIFSIGNALED(status)) {
+      fprintf(stderr, "mpi-local: rank %d killed by signal %d\n",
+              rank, WTERMSIG(status));
+    } else {
+      fprintf(stderr, "mpi-local: rank %d exited with status %d before "
+              "MPI_Finalize\n", rank, WEXITSTATUS(status));
+    }
+    if (!recoverable(rank, max_faults)) {
+      kill_all();
+      dump_all(rank, pid, LOCAL_DUMP_ABORT);
+      exit(1);
+    }
+    local_trace_dump(rank, pid, LOCAL_DUMP_LOST);
+
+    double now = MPI_Wtime();
+    shm->detect_time = now;
+    shm->fail_time = shm->kill_time ? shm->kill_time : now;
+    shm->kill_time = 0;
+    slot->spawn_time = now;
+    int spare = shm->spares != 0;
+    if (spare) {
+      shm->spares -= shm->spares > 0;
+      __atomic_store_n(&slot->state, LOCAL_SLOT_DEAD, __ATOMIC_SEQ_CST);
+    } else {
+      drop(rank);
+    }
+    __atomic_add_fetch(&shm->faults, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&shm->fault_epoch, 1, __ATOMIC_SEQ_CST);
+    local_replay_holder_lost(rank);
+
+    if (spare && spawn(rank) == 0) {
+      sigprocmask(SIG_UNBLOCK, &chld, NULL);
+      local_child(rank, 1);
+      return;
+    }
+    local_notify(-1, now);
+  }
+}
+
+// ===========================================================================
+// Environment
+// ===========================================================================
+int MPI_Init(int *argc, char ***argv) {
+  if (local.initialized) {
+    return MPI_ERR_OTHER;
+  }
+
+  long size       = env_long("MPI_LOCAL_NP", 1);
+  long heap_mb    = env_long("MPI_LOCAL_HEAP_MB", 1024);
+  long chan_kb    = env_long("MPI_LOCAL_CHAN_KB", 64);
+  long replay_cap = env_long("MPI_LOCAL_REPLAY_CAP", 65536);
+  long ppn        = env_long("MPI_LOCAL_PPN", 1);
+  long memo       = env_long("MPI_LOCAL_COMM_MEMO", 1);
+  long mem_mb     = env_long("MPI_LOCAL_MEM_CACHE_MB", 1024);
+  long spares     = env_long("MPI_LOCAL_SPARES", -1);
+  repair          = env_long("MPI_LOCAL_REPAIR_MS", 0) / 1e3;
+  if (size < 1 || chan_kb < 4 || ppn < 1) {
+    fprintf(stderr, "mpi-local: need MPI_LOCAL_NP >= 1, MPI_LOCAL_PPN >= 1 "
+            "and MPI_LOCAL_CHAN_KB >= 4\n");
+    exit(1);
+  }
+
+  uint64_t chan_cap = 4096;
+  while (chan_cap < (uint64_t) chan_kb * 1024) {
+    chan_cap *= 2;
+  }
+
+  size_t header = sizeof(struct local_shared) +
+                  size * sizeof(struct local_slot);
+  header = (header + 4095) & ~(size_t) 4095;
+  shm_bytes = header + (size_t) heap_mb * 1024 * 1024;
+
+  void *map = mmap(NULL, shm_bytes, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map == MAP_FAILED) {
+    perror("mpi-local: mmap");
+    exit(1);
+  }
+
+  struct local_shared *shm = map;
+  local.shm       = shm;
+  shm->size       = size;
+  shm->supervisor = getpid();
+  shm->heap_top   = header;
+  shm->heap_end   = shm_bytes;
+  shm->chan_cap   = chan_cap;
+  shm->replay_cap = replay_cap;
+  shm->ppn        = ppn;
+  shm->comm_memo  = memo != 0;
+  shm->mem_cache  = mem_mb > 0 ? (uint64_t) mem_mb * 1024 * 1024 : 0;
+  shm->spares     = spares < 0 ? -1 : spares;
+  shm->live       = size;
+  local_inject_parse();
+
+  uint64_t *table = local_heap_alloc(size * size * sizeof(uint64_t));
+  uint32_t *lists = local_heap_alloc(size * (size + 1) * sizeof(uint32_t));
+  uint64_t *replicas = local_heap_alloc(size * sizeof(uint64_t));
+  shm->chan_table = local_offset(table);
+  shm->inlists    = local_offset(lists);
+  shm->replicas   = local_offset(replicas);
+  for (int r = 0; r < size; r++) {
+    struct local_replica *rep = local_heap_alloc(
+      sizeof(struct local_replica) + replay_cap * sizeof(MPI_Determinant));
+    rep->holder = (r + 1) % size;
+    rep->valid = 1;
+    replicas[r] = local_offset(rep);
+  }
+  shm->memo_table = local_offset(local_heap_alloc(
+    size * LOCAL_MAX_MEMOS * sizeof(struct local_memo)));
+  shm->win_table = local_offset(local_heap_alloc(
+    size * LOCAL_MAX_WINS * sizeof(struct local_winrec)));
+  shm->nnodes = shm->live_nodes = (size + ppn - 1) / ppn;
+  struct local_node *nodes = local_heap_alloc(
+    shm->nnodes * sizeof(struct local_node));
+  for (int n = 0; n < shm->nnodes; n++) {
+    nodes[n].leader  = n * ppn;
+    nodes[n].members = size - n * ppn < ppn ? size - n * ppn : ppn;
+  }
+  shm->nodes = local_offset(nodes);
+  local_trace_setup();
+  local_comm_setup(size);
+
+  fflush(NULL);
+  for (int r = 0; r < size; r++) {
+    shm->slots[r].state = LOCAL_SLOT_ALIVE;
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("mpi-local: fork");
+      kill_all();
+      exit(1);
+    } else if (pid == 0) {
+      local_child(r, 0);
+      return MPI_SUCCESS;
+    }
+    shm->slots[r].pid = pid;
+  }
+
+  local_supervise();
+  return MPI_SUCCESS;
+}
+
+int MPI_Finalize(void) {
+  LOCAL_ENTER();
+  MPI_Barrier(MPI_COMM_WORLD);
+  __atomic_store_n(&local.shm->slots[local.rank].state,
+                   LOCAL_SLOT_FINALIZED, __ATOMIC_SEQ_CST);
+  local.finalized = 1;
+  fflush(NULL);
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+int MPI_Initialized(int *flag) {
+  *flag = local.initialized;
+  return MPI_SUCCESS;
+}
+
+int MPI_Finalized(int *flag) {
+  *flag = local.finalized;
+  return MPI_SUCCESS;
+}
+
+int MPI_Abort(MPI_Comm comm, int errorcode) {
+  struct local_shared *shm = local.shm;
+  if (!shm) {
+    exit(errorcode);
+  }
+  local_trace(MPIX_EVENT_ABORT, errorcode, 0);
+  fflush(NULL);
+  if (!__atomic_exchange_n(&shm->aborting, 1, __ATOMIC_SEQ_CST)) {
+    shm->abort_code = errorcode;
+  }
+  _exit(errorcode ? errorcode : 1);
+}
+
+double MPI_Wtime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double MPI_Wtick(void) {
+  return 1e-9;
+}
+
+int MPI_Comm_rank(MPI_Comm comm, int *rank) {
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return local_error(comm, MPI_ERR_COMM, "MPI_Comm_rank");
+  }
+  *rank = c->rank;
+  return MPI_SUCCESS;
+}
+
+int MPI_Comm_size(MPI_Comm comm, int *size) {
+  struct local_comm *c = local_comm_get(comm);
+  if (!c) {
+    return local_error(comm, MPI_ERR_COMM, "MPI_Comm_size");
+  }
+  *size = c->size;
+  return MPI_SUCCESS;
+}
+
+// ===========================================================================
+// Datatypes and errors
+// ===========================================================================
+size_t local_type_size(MPI_Datatype type) {
+  struct double_int { double value; int index; };
+  static const size_t sizes[LOCAL_NUM_DATATYPES] = {
+    [MPI_CHAR]          = sizeof(char),
+    [MPI_BYTE]          = 1,
+    [MPI_INT]           = sizeof(int),
+    [MPI_UNSIGNED]      = sizeof(unsigned),
+    [MPI_LONG]          = sizeof(long),
+    [MPI_UNSIGNED_LONG] = sizeof(unsigned long),
+    [MPI_LONG_LONG]     = sizeof(long long),
+    [MPI_FLOAT]         = sizeof(float),
+    [MPI_DOUBLE]        = sizeof(double),
+    [MPI_INT64_T]       = sizeof(int64_t),
+    [MPI_UINT64_T]      = sizeof(uint64_t),
+    [MPI_2INT]          = 2 * sizeof(int),
+    [MPI_DOUBLE_INT]    = sizeof(struct double_int),
+  };
+  if (type <= MPI_DATATYPE_NULL || type >= LOCAL_NUM_DATATYPES) {
+    return 0;
+  }
+  return sizes[type];
+}
+
+int MPI_Type_size(MPI_Datatype datatype, int *size) {
+  size_t bytes = local_type_size(datatype);
+  if (!bytes) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_TYPE, "MPI_Type_size");
+  }
+  *size = (int) bytes;
+  return MPI_SUCCESS;
+}
+
+static const char *error_strings[MPI_ERR_LASTCODE] = {
+  [MPI_SUCCESS]      = "success",
+  [MPI_ERR_BUFFER]   = "invalid buffer",
+  [MPI_ERR_COUNT]    = "invalid count",
+  [MPI_ERR_TYPE]     = "invalid datatype",
+  [MPI_ERR_TAG]      = "invalid tag",
+  [MPI_ERR_COMM]     = "invalid communicator",
+  [MPI_ERR_RANK]     = "invalid rank",
+  [MPI_ERR_REQUEST]  = "invalid request",
+  [MPI_ERR_ROOT]     = "invalid root",
+  [MPI_ERR_OP]       = "invalid reduction operation",
+  [MPI_ERR_ARG]      = "invalid argument",
+  [MPI_ERR_TRUNCATE] = "message truncated",
+  [MPI_ERR_NO_MEM]   = "out of memory",
+  [MPI_ERR_OTHER]    = "other error",
+  [MPI_ERR_INTERN]   = "internal error",
+  [MPI_T_ERR_NOT_INITIALIZED] = "MPI_T not initialized",
+  [MPI_T_ERR_INVALID_INDEX]   = "invalid MPI_T variable index",
+  [MPI_T_ERR_INVALID_NAME]    = "invalid MPI_T variable name",
+  [MPI_T_ERR_INVALID_HANDLE]  = "invalid MPI_T handle",
+};
+
+int MPI_Error_string(int errorcode, char *string, int *resultlen) {
+  const char *message = "unknown error";
+  if (errorcode >= 0 && errorcode < MPI_ERR_LASTCODE &&
+      error_strings[errorcode]) {
+    message = error_strings[errorcode];
+  }
+  *resultlen = snprintf(string, MPI_MAX_ERROR_STRING, "%s", message);
+  return MPI_SUCCESS;
+}
+
+// Errors are fatal, as with MPI_ERRORS_ARE_FATAL.
+int local_error(MPI_Comm comm, int code, const char *fn) {
+  char message[MPI_MAX_ERROR_STRING];
+  int len;
+  MPI_Error_string(code, message, &len);
+  fprintf(stderr, "mpi-local: rank %d: %s: %s\n", local.rank, fn, message);
+  MPI_Abort(comm, code);
+  return code;
+}
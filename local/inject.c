@@ -0,0 +1,397 @@
+// ===========================================================================
+// Deterministic fault injection for the local runtime.
+//
+// Rules come from MPI_LOCAL_INJECT (separated by ';') or from the file named
+// by MPI_LOCAL_INJECT_FILE (one per line, '#' starts a comment):
+//
+//   kill     rank=3 call=5000      SIGKILL rank 3 at its 5000th MPI call
+//   fault    rank=0 step=12        MPI_Fault on rank 0 at time step 12
+//   node     rank=5 cleanup        lose rank 5's node when it runs cleanup
+//   kill     rank=any recovery     lose a random rank inside recovery
+//   random   count=4 calls=100000  4 kills at random ranks and calls
+//   kill     rank=any mtbf=2.5     kills with a mean of 2.5s between them
+//
+// Any other key=value trigger names a point reported by the application
+// with MPIX_Inject_point.  rank=any and random schedules are drawn from
+// MPI_LOCAL_INJECT_SEED (or seed=N in the rule), so the same configuration
+// always produces the same schedule.  Each rule fires at most once per job,
+// except mtbf rules.
+//
+// mtbf rules are a Poisson process in wall time, run by the supervisor, so
+// a rank can be lost anywhere, not just in MPI calls.  Wall time makes
+// their schedule nondeterministic.  A failure that comes due while a
+// process is starting, recovering or finishing is held back until every
+// rank is inside the restart point again, since the runtime could not
+// recover from it.
+// ===========================================================================
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+static uint64_t seed;
+
+// splitmix64: small, fast and good enough for schedules.
+static uint64_t next_random(void) {
+  uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Natural log of x in (0, 1], without pulling in libm.
+static double log_unit(double x) {
+  int halvings = 0;
+  while (x < 0.5) {
+    x *= 2;
+    halvings++;
+  }
+  double y = (x - 1) / (x + 1), y2 = y * y, term = y, sum = 0;
+  for (int i = 1; i < 40; i += 2) {
+    sum += term / i;
+    term *= y2;
+  }
+  return 2 * sum - halvings * 0.69314718055994530942;
+}
+
+// Exponentially distributed time with the given mean.
+static double next_interval(double mean) {
+  double u = ((next_random() >> 11) + 1) * 0x1.0p-53;
+  return -mean * log_unit(u);
+}
+
+static void bad_rule(const char *rule, const char *why) {
+  fprintf(stderr, "mpi-local: bad injection rule '%s': %s\n", rule, why);
+  exit(1);
+}
+
+static struct local_rule *add_rule(const char *text) {
+  struct local_shared *shm = local.shm;
+  if (shm->nrules == LOCAL_MAX_RULES) {
+    bad_rule(text, "too many rules");
+  }
+  struct local_rule *rule = &shm->rules[shm->nrules++];
+  memset(rule, 0, sizeof(*rule));
+  rule->rank = -1;
+  rule->when = -1;
+  return rule;
+}
+
+static int parse_action(const char *word) {
+  if (!strcmp(word, "kill"))  return LOCAL_INJECT_KILL;
+  if (!strcmp(word, "fault")) return LOCAL_INJECT_FAULT;
+  if (!strcmp(word, "node"))  return LOCAL_INJECT_NODE;
+  return -1;
+}
+
+static void parse_rule(char *text) {
+  char copy[256];
+  snprintf(copy, sizeof(copy), "%s", text);
+
+  char *save;
+  char *word = strtok_r(text, " \t", &save);
+  if (!word) {
+    return;
+  }
+
+  struct local_shared *shm = local.shm;
+  if (!strcmp(word, "random")) {
+    long count = 1, calls = 0;
+    int action = LOCAL_INJECT_KILL;
+    while ((word = strtok_r(NULL, " \t", &save))) {
+      char *eq = strchr(word, '=');
+      if (!eq) {
+        bad_rule(copy, "expected key=value");
+      }
+      *eq = '\0';
+      if (!strcmp(word, "count")) {
+        count = atol(eq + 1);
+      } else if (!strcmp(word, "calls")) {
+        calls = atol(eq + 1);
+      } else if (!strcmp(word, "seed")) {
+        seed = strtoull(eq + 1, NULL, 10);
+      } else if (!strcmp(word, "action")) {
+        action = parse_action(eq + 1);
+      } else {
+        bad_rule(copy, "unknown key");
+      }
+    }
+    if (calls <= 0 || action < 0) {
+      bad_rule(copy, "need calls=N and a valid action");
+    }
+    for (long i = 0; i < count; i++) {
+      struct local_rule *rule = add_rule(copy);
+      rule->action = action;
+      rule->rank   = next_random() % shm->size;
+      rule->when   = LOCAL_WHEN_CALL;
+      rule->value  = 1 + next_random() % calls;
+    }
+    return;
+  }
+
+  struct local_rule *rule = add_rule(copy);
+  rule->action = parse_action(word);
+  if (rule->action < 0) {
+    bad_rule(copy, "unknown action");
+  }
+
+  int any = 1;
+  while ((word = strtok_r(NULL, " \t", &save))) {
+    char *eq = strchr(word, '=');
+    if (!eq) {
+      if (!strcmp(word, "cleanup")) {
+        rule->when = LOCAL_WHEN_CLEANUP;
+      } else if (!strcmp(word, "recovery")) {
+        rule->when = LOCAL_WHEN_RECOVERY;
+      } else {
+        bad_rule(copy, "unknown trigger");
+      }
+      continue;
+    }
+
+    *eq = '\0';
+    const char *value = eq + 1;
+    if (!strcmp(word, "rank")) {
+      any = !strcmp(value, "any");
+      rule->rank = any ? -1 : atoi(value);
+    } else if (!strcmp(word, "seed")) {
+      seed = strtoull(value, NULL, 10);
+    } else if (!strcmp(word, "call")) {
+      rule->when  = LOCAL_WHEN_CALL;
+      rule->value = atol(value);
+    } else if (!strcmp(word, "mtbf")) {
+      rule->when = LOCAL_WHEN_MTBF;
+      rule->mtbf = atof(value);
+    } else {
+      rule->when  = LOCAL_WHEN_POINT;
+      rule->value = atol(value);
+      snprintf(rule->point, sizeof(rule->point), "%s", word);
+    }
+  }
+  if (rule->when < 0) {
+    bad_rule(copy, "no trigger");
+  }
+  if (rule->when == LOCAL_WHEN_MTBF) {
+    if (rule->mtbf <= 0 || rule->action == LOCAL_INJECT_FAULT) {
+      bad_rule(copy, "mtbf needs a positive time and kill or node");
+    }
+    if (rule->rank >= shm->size) {
+      bad_rule(copy, "rank out of range");
+    }
+    return;
+  }
+  if (any) {
+    rule->rank = next_random() % shm->size;
+  } else if (rule->rank < 0 || rule->rank >= shm->size) {
+    bad_rule(copy, "rank out of range");
+  }
+}
+
+// Parse rules into the shared mapping.  Called once, before forking ranks.
+void local_inject_parse(void) {
+  const char *env_seed = getenv("MPI_LOCAL_INJECT_SEED");
+  seed = env_seed ? strtoull(env_seed, NULL, 10) : 1;
+
+  const char *rules = getenv("MPI_LOCAL_INJECT");
+  if (rules) {
+    char *copy = strdup(rules), *save;
+    for (char *r = strtok_r(copy, ";", &save); r;
+         r = strtok_r(NULL, ";", &save)) {
+      parse_rule(r);
+    }
+    free(copy);
+  }
+
+  const char *path = getenv("MPI_LOCAL_INJECT_FILE");
+  if (path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+      perror(path);
+      exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      line[strcspn(line, "#\r\n")] = '\0';
+      parse_rule(line);
+    }
+    fclose(file);
+  }
+}
+
+// Find the next call number this process needs to check.
+static void update_call_trigger(void) {
+  struct local_shared *shm = local.shm;
+  local.inject_call = UINT64_MAX;
+  for (int i = 0; i < shm->nrules; i++) {
+    struct local_rule *rule = &shm->rules[i];
+    if (rule->rank == local.rank && rule->when == LOCAL_WHEN_CALL &&
+        !__atomic_load_n(&rule->fired, __ATOMIC_ACQUIRE) &&
+        (uint64_t) rule->value < local.inject_call) {
+      local.inject_call = rule->value;
+    }
+  }
+}
+
+void local_inject_init(void) {
+  local.calls = 0;
+  update_call_trigger();
+}
+
+static const char *action_names[] = { "kill", "fault", "node" };
+
+static void fire(struct local_rule *rule, const char *where) {
+  if (__atomic_exchange_n(&rule->fired, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  struct local_shared *shm = local.shm;
+
+  // MPI_Fault outside MPI_Reinit aborts the job, which a fault from a rule
+  // never should: the rule is used up without effect.
+  if (rule->action == LOCAL_INJECT_FAULT && !local.depth) {
+    fprintf(stderr, "mpi-local: inject: skipping fault rank %d at %s: not "
+            "in MPI_Reinit\n", local.rank, where);
+    return;
+  }
+  fprintf(stderr, "mpi-local: inject: %s rank %d at %s\n",
+          action_names[rule->action], local.rank, where);
+  local_trace(MPIX_EVENT_INJECT, rule->action, rule - shm->rules);
+
+  switch (rule->action) {
+    case LOCAL_INJECT_KILL:
+      shm->kill_time = MPI_Wtime();
+      raise(SIGKILL);
+      break;
+    case LOCAL_INJECT_FAULT:
+      update_call_trigger();
+      MPI_Fault();
+      break;
+    case LOCAL_INJECT_NODE: {
+      int first = local.rank / shm->ppn * shm->ppn;
+      shm->kill_time = MPI_Wtime();
+      for (int r = first; r < first + shm->ppn && r < shm->size; r++) {
+        if (r != local.rank && shm->slots[r].pid > 0) {
+          kill(shm->slots[r].pid, SIGKILL);
+        }
+      }
+      raise(SIGKILL);
+      break;
+    }
+  }
+}
+
+void local_inject_call(void) {
+  struct local_shared *shm = local.shm;
+  for (int i = 0; i < shm->nrules; i++) {
+    struct local_rule *rule = &shm->rules[i];
+    if (rule->rank == local.rank && rule->when == LOCAL_WHEN_CALL &&
+        (uint64_t) rule->value == local.calls) {
+      char where[64];
+      snprintf(where, sizeof(where), "call %lu", (unsigned long) local.calls);
+      fire(rule, where);
+    }
+  }
+  update_call_trigger();
+}
+
+void local_inject_event(int when) {
+  struct local_shared *shm = local.shm;
+  for (int i = 0; i < shm->nrules; i++) {
+    struct local_rule *rule = &shm->rules[i];
+    if (rule->rank == local.rank && rule->when == when && !rule->fired) {
+      fire(rule, when == LOCAL_WHEN_CLEANUP ? "cleanup" : "recovery");
+    }
+  }
+}
+
+int MPIX_Inject_point(const char *name, long value) {
+  struct local_shared *shm = local.shm;
+  for (int i = 0; i < shm->nrules; i++) {
+    struct local_rule *rule = &shm->rules[i];
+    if (rule->rank == local.rank && rule->when == LOCAL_WHEN_POINT &&
+        rule->value == value && !rule->fired &&
+        !strcmp(rule->point, name)) {
+      char where[64];
+      snprintf(where, sizeof(where), "%s %ld", name, value);
+      fire(rule, where);
+    }
+  }
+  return MPI_SUCCESS;
+}
+
+// ===========================================================================
+// Timed rules, run by the supervisor
+// ===========================================================================
+
+// Ranks can only be lost while every one of them is inside the restart
+// point: not starting up, not recovering and not on the way out.  Ranks
+// the job shrank without do not count.
+int local_all_running(void) {
+  struct local_shared *shm = local.shm;
+  for (int r = 0; r < shm->size; r++) {
+    struct local_slot *slot = &shm->slots[r];
+    uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_SEQ_CST);
+    if (state == LOCAL_SLOT_GONE) {
+      continue;
+    }
+    if (state != LOCAL_SLOT_ALIVE ||
+        !__atomic_load_n(&slot->running, __ATOMIC_SEQ_CST)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void fire_timed(struct local_rule *rule, double now) {
+  struct local_shared *shm = local.shm;
+  int victim = rule->rank;
+  while (victim < 0 || (rule->rank < 0 &&
+                        shm->slots[victim].state == LOCAL_SLOT_GONE)) {
+    victim = next_random() % shm->size;
+  }
+  int first = victim, last = victim;
+  if (rule->action == LOCAL_INJECT_NODE) {
+    first = victim / shm->ppn * shm->ppn;
+    last = first + shm->ppn - 1 < shm->size - 1 ? first + shm->ppn - 1
+                                                : shm->size - 1;
+  }
+  fprintf(stderr, "mpi-local: inject: %s rank %d at mtbf %gs\n",
+          action_names[rule->action], victim, rule->mtbf);
+  shm->kill_time = now;
+  for (int r = first; r <= last; r++) {
+    pid_t pid = shm->slots[r].pid;
+    if (pid > 0) {
+      kill(pid, SIGKILL);
+    }
+  }
+}
+
+// Fire every timed rule that is due.  Returns the time the next one is due,
+// or 0 if there are none.
+double local_inject_timers(void) {
+  struct local_shared *shm = local.shm;
+  double now = MPI_Wtime();
+  double soonest = 0;
+  for (int i = 0; i < shm->nrules; i++) {
+    struct local_rule *rule = &shm->rules[i];
+    if (rule->when != LOCAL_WHEN_MTBF) {
+      continue;
+    }
+    if (!rule->next) {
+      rule->next = now + next_interval(rule->mtbf);
+    } else if (rule->next <= now) {
+      if (local_all_running()) {
+        fire_timed(rule, now);
+        rule->next = now + next_interval(rule->mtbf);
+      } else {
+        rule->next = now + 1e-3;
+      }
+    }
+    if (!soonest || rule->next < soonest) {
+      soonest = rule->next;
+    }
+  }
+  return soonest;
+}
@@ -0,0 +1,455 @@
+// ===========================================================================
+// Internal interface of the local runtime.
+//
+// Every rank is a process forked from a supervisor inside MPI_Init.  Ranks
+// share one anonymous shared mapping, created before the first fork, that
+// holds a slot per rank, the point-to-point channels between ranks, the
+// replicated determinant logs and the event rings.  Everything else is
+// private to each process.
+// ===========================================================================
+#ifndef MPI_LOCAL_LOCAL_H
+#define MPI_LOCAL_LOCAL_H
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "mpi.h"
+#include "mpi-resilience.h"
+#include "trace.h"
+
+#define LOCAL_MAX_SCOPES   32   //!< Max nesting of restart points.
+#define LOCAL_MAX_COMMS    256  //!< Max live communicators per process.
+#define LOCAL_MAX_RULES    64   //!< Max fault injection rules.
+#define LOCAL_MAX_MEMOS    64   //!< Records of live communicators per rank.
+#define LOCAL_MAX_WINS     64   //!< Max windows per process.
+
+//! Parents of communicator records that are not records themselves.
+enum {
+  LOCAL_MEMO_WORLD = -1,
+  LOCAL_MEMO_SELF  = -2,
+  LOCAL_MEMO_NONE  = -3,        //!< Not recorded; nothing made from it is.
+};
+
+//! How a recorded communicator was made.
+enum {
+  LOCAL_MEMO_DUP,
+  LOCAL_MEMO_SPLIT,
+};
+
+//! Internal tags for collectives.  User tags are never negative.
+enum {
+  LOCAL_TAG_BARRIER  = -100,
+  LOCAL_TAG_BCAST    = -101,
+  LOCAL_TAG_REDUCE   = -102,
+  LOCAL_TAG_GATHER   = -103,
+  LOCAL_TAG_ALLTOALL = -104,
+};
+
+//! Recovery barrier phases.
+enum {
+  LOCAL_PHASE_AGREE,    //!< Everyone has stopped and published its scopes.
+  LOCAL_PHASE_READY,    //!< Everyone has reset its communication state.
+  LOCAL_NUM_PHASES
+};
+
+//! States of a rank slot.
+enum {
+  LOCAL_SLOT_EMPTY,     //!< Not started yet.
+  LOCAL_SLOT_ALIVE,     //!< Running.
+  LOCAL_SLOT_DEAD,      //!< Lost; a replacement is being started.
+  LOCAL_SLOT_GONE,      //!< Lost with no spare left; the job shrank.
+  LOCAL_SLOT_DONE,      //!< Returned from MPI_Reinit; can't restart.
+  LOCAL_SLOT_FINALIZED, //!< Past MPI_Finalize.
+};
+
+//! Fault injection actions.
+enum {
+  LOCAL_INJECT_KILL,    //!< SIGKILL the rank.
+  LOCAL_INJECT_FAULT,   //!< Call MPI_Fault on the rank.
+  LOCAL_INJECT_NODE,    //!< SIGKILL every rank on the rank's node.
+};
+
+//! Points where fault injection rules can fire.
+enum {
+  LOCAL_WHEN_CALL,      //!< Nth MPI call of a process.
+  LOCAL_WHEN_POINT,     //!< Named point reported with MPIX_Inject_point.
+  LOCAL_WHEN_CLEANUP,   //!< About to run cleanup handlers.
+  LOCAL_WHEN_RECOVERY,  //!< Inside the recovery protocol.
+  LOCAL_WHEN_MTBF,      //!< Poisson process in wall time, by the supervisor.
+};
+
+// ===========================================================================
+// Shared state
+// ===========================================================================
+
+//! A fault injection rule.  Each rule fires at most once per job, except
+//! LOCAL_WHEN_MTBF rules, which fire until the job ends.
+struct local_rule {
+  int      action;              //!< LOCAL_INJECT_*
+  int      rank;                //!< -1 for a new random rank every time.
+  int      when;                //!< LOCAL_WHEN_*
+  long     value;               //!< Call number or point value.
+  char     point[32];           //!< Point name for LOCAL_WHEN_POINT.
+  uint32_t fired;
+  double   mtbf;                //!< Mean seconds between LOCAL_WHEN_MTBF.
+  double   next;                //!< Next LOCAL_WHEN_MTBF firing, or 0.
+};
+
+//! Work a rank did and lost, kept in the slot so that it outlives the
+//! rank's processes.  Steps are as reported with MPIX_Work_step.
+struct local_work {
+  double   from_time;           //!< Start of work that a fault would lose,
+  int64_t  from_step;           //!< or 0 while no work is at risk.
+  double   step_time;           //!< When the current step started.
+  int64_t  step;                //!< Current step.
+  int64_t  high;                //!< Highest step started.
+  uint32_t started;             //!< A step was reported.
+  uint32_t redoing;             //!< The current step was done before.
+  uint64_t faults;              //!< Faults that destroyed work.
+  double   lost_time;
+  uint64_t lost_steps;
+  double   redo_time;
+  uint64_t redo_steps;
+};
+
+//! Per-rank state visible to every process.
+struct local_slot {
+  pid_t    pid;
+  uint32_t state;                           //!< LOCAL_SLOT_*
+  uint32_t doorbell;                        //!< Futex word; bumped on news.
+  uint32_t sleeping;                        //!< Nonzero while in futex wait.
+  uint32_t scope_depth;                     //!< Published during recovery.
+  uint32_t running;                         //!< Inside the restart point.
+  uint32_t memos;                           //!< Communicators recorded.
+  uint32_t wins;                            //!< Windows recorded.
+  uint32_t dropped;                         //!< Resize that dropped the
+                                            //!< rank, or 0,
+  uint32_t joined;                          //!< and that brought it back.
+  double   spawn_time;                      //!< When a replacement started.
+  double   repair_time;                     //!< When a dropped rank returns.
+  struct local_work work;
+  uint64_t scope_key[LOCAL_MAX_SCOPES];     //!< Serial of each scope; 0 if
+                                            //!< the scope was invalidated.
+} __attribute__((aligned(64)));
+
+//! How one rank made a communicator, so that it can make it again after a
+//! rollback without communicating.
+struct local_memo {
+  int32_t  parent;              //!< Record of the parent, or LOCAL_MEMO_*.
+  int32_t  parent_context;
+  uint32_t seq;                 //!< Communicators made from the parent before.
+  int32_t  kind;                //!< LOCAL_MEMO_DUP or LOCAL_MEMO_SPLIT.
+  int32_t  color;
+  int32_t  key;
+  int32_t  context;
+  int32_t  rank;                //!< In the new communicator, or -1 if none.
+  int32_t  size;
+  uint32_t valid;               //!< Made by every member of the parent.
+  uint64_t world;               //!< Offset of size world ranks.
+  int32_t  room;                //!< Ranks that fit at world.
+};
+
+//! Where one rank's part of a window lives, so that other ranks can reach
+//! it and the window can be made again after a rollback without
+//! communicating.
+struct local_winrec {
+  int32_t  comm;                //!< Record of the window's communicator.
+  int32_t  context;             //!< Its context, which names the window.
+  int32_t  disp_unit;
+  uint32_t valid;               //!< Made by every member.
+  uint64_t size;
+  uint64_t base;                //!< Offset of the memory.
+};
+
+//! Recovery state of one simulated node of MPI_LOCAL_PPN ranks.  Its ranks
+//! meet here, and only its leader, the lowest of them, meets the other
+//! leaders and passes the outcome back.
+struct local_node {
+  uint64_t barrier[LOCAL_NUM_PHASES];   //!< (epoch << 32) | arrivals
+  uint64_t release[LOCAL_NUM_PHASES];   //!< Epoch the leader let go.
+  int32_t  leader;                      //!< Lowest rank still in the job.
+  int32_t  members;                     //!< Ranks still in the job.
+  int32_t  target;                      //!< Scope agreed in LOCAL_PHASE_AGREE.
+  uint32_t scope_depth;                 //!< Least depth on the node.
+  uint64_t scope_key[LOCAL_MAX_SCOPES]; //!< Key of each scope, 0 unless
+                                        //!< every rank on the node has it.
+} __attribute__((aligned(64)));
+
+//! Replica of one rank's determinant log, held on behalf of its partner.
+struct local_replica {
+  int             holder;       //!< Rank holding the replica.
+  uint32_t        valid;        //!< Cleared if the holder is lost.
+  uint32_t        count;        //!< Number of determinants.
+  uint32_t        overflow;     //!< Log overflowed since the last mark.
+  MPI_Determinant log[];
+};
+
+//! Single-producer, single-consumer byte ring from one rank to another.
+struct local_chan {
+  uint64_t head;                //!< Bytes published by the producer.
+  char     pad0[56];
+  uint64_t tail;                //!< Bytes consumed by the consumer.
+  char     pad1[56];
+  uint64_t cap;                 //!< Capacity, a power of two.
+  char     data[] __attribute__((aligned(64)));
+};
+
+//! Event ring of one rank.  Only the rank's process writes it, and only it
+//! or the supervisor, once the process is gone, dumps it.
+struct local_trace {
+  uint64_t           head;      //!< Events recorded.
+  uint64_t           dumped;    //!< Events dumped.
+  uint64_t           mask;      //!< Entries - 1.
+  char               pad[40];
+  struct local_event events[];  //!< trace_cap entries.
+};
+
+//! Header of one fragment in a channel.
+struct local_frag {
+  uint32_t epoch;               //!< Fault epoch the message was sent in.
+  int32_t  tag;
+  int32_t  context;             //!< Communicator context id.
+  uint32_t len;                 //!< Payload bytes in this fragment.
+  uint64_t total;               //!< Payload bytes in the whole message.
+  uint64_t offset;              //!< Offset of this fragment in the message.
+};
+
+//! Header of the shared mapping.
+struct local_shared {
+  int      size;                //!< Ranks in MPI_COMM_WORLD.
+  pid_t    supervisor;
+  uint32_t fault_epoch;         //!< Bumped once per fault.
+  uint32_t faults;              //!< Processes replaced so far.
+  uint32_t aborting;
+  int      abort_code;
+  double   kill_time;           //!< Set by fault injection before killing.
+  double   fail_time;           //!< When the latest fault happened,
+  double   detect_time;         //!< and when the runtime noticed it.
+  uint64_t barrier[LOCAL_NUM_PHASES];  //!< (epoch << 32) | node arrivals
+  uint64_t heap_top;            //!< Bump allocator for the heap.
+  uint64_t heap_end;
+  uint64_t chan_cap;            //!< Capacity of new channels.
+  uint32_t replay_cap;          //!< Determinants per replica.
+  uint64_t chan_table;          //!< Offset of size*size channel offsets.
+  uint64_t inlists;             //!< Offset of per-rank incoming lists.
+  uint64_t replicas;            //!< Offset of per-rank replicas.
+  uint64_t memo_table;          //!< Offset of per-rank creation records.
+  uint64_t win_table;           //!< Offset of per-rank window records.
+  int      comm_memo;           //!< Whether to reuse the records.
+  uint64_t mem_cache;           //!< Bytes MPI_Free_mem keeps for reuse.
+  uint64_t traces;              //!< Offset of per-rank event rings.
+  uint64_t trace_cap;           //!< Events per ring, a power of two.
+  uint64_t trace_ticks;         //!< Tick count at startup,
+  double   trace_time;          //!< and MPI_Wtime at the same moment.
+  int      ppn;                 //!< Ranks per simulated node.
+  int      nnodes;
+  uint64_t nodes;               //!< Offset of per-node recovery state.
+  int      live;                //!< Ranks still in the job,
+  int      live_nodes;          //!< and nodes with any of them.
+  int      spares;              //!< Replacements left; -1 for no limit.
+  uint32_t resizes;             //!< Times the job shrank or grew.
+  uint32_t ran_resizes;         //!< Resizes as of the last entry to the
+                                //!< restart point.
+  uint32_t memo_drops;          //!< Times a rank found its arguments
+                                //!< differ from its creation records.
+  int      nrules;
+  struct local_rule rules[LOCAL_MAX_RULES];
+  struct local_slot slots[];
+};
+
+// ===========================================================================
+// Private state
+// ===========================================================================
+
+//! One restart point: MPI_Reinit at level 0, then nested scopes.
+struct local_scope {
+  sigjmp_buf        env;
+  MPI_Scope_point   scope_point;
+  void             *state;
+  int               handler_base;   //!< Cleanup handlers below this stay.
+  int               tx_base;        //!< Transactions below this stay open.
+  uint64_t          serial;
+  int               valid;
+  long              replay_seq;     //!< Receive sequence at entry, or -1.
+};
+
+//! A communicator.  context < 0 means the slot is free.
+struct local_comm {
+  int  context;
+  int  rank;
+  int  size;
+  int *world;                   //!< Comm rank -> world rank.
+  int *local;                   //!< World rank -> comm rank, or -1.
+  int  memo;                    //!< Own record, or LOCAL_MEMO_*.
+  int  created;                 //!< Communicators made from this one.
+};
+
+struct local_proc {
+  int                   rank;
+  int                   size;
+  struct local_shared  *shm;
+  uint32_t              epoch;          //!< Last fault epoch recovered from.
+  int                   initialized;
+  int                   finalized;
+  int                   replacement;    //!< Started to replace a lost rank.
+  int                   started;        //!< Restart point entered once.
+  volatile int          in_mpi;         //!< Inside a runtime call.
+  int                   first_call;     //!< Time the next call for recovery.
+  uint64_t              calls;          //!< MPI calls made by this process.
+  uint64_t              inject_call;    //!< Next call with a rule to check.
+  MPI_Fault_mode        mode;
+  struct local_trace   *trace;          //!< This rank's event ring.
+
+  struct local_scope    scopes[LOCAL_MAX_SCOPES];
+  int                   depth;          //!< Active restart points.
+  uint64_t              scope_serial;
+  int                   reinit_argc;
+  char                **reinit_argv;
+  MPI_Restart_point     restart_point;
+
+  struct local_comm     comms[LOCAL_MAX_COMMS];
+  int                   next_context;
+  uint32_t              comm_resets;    //!< Times derived ones were dropped.
+  uint32_t              resizes;        //!< Resizes MPI_COMM_WORLD reflects.
+  uint32_t              remap_base;     //!< Resizes the application saw.
+  uint32_t              memo_drops;     //!< Mismatches records reflect.
+};
+
+extern struct local_proc local;
+
+// ===========================================================================
+// Internal routines
+// ===========================================================================
+
+// init.c
+void  *local_heap_alloc(uint64_t bytes);
+void  *local_at(uint64_t offset);
+uint64_t local_offset(void *ptr);
+void   local_ring(int rank);
+void   local_ring_all(void);
+void   local_notify(int self, double since);
+void   local_notify_node(void);
+void   local_sleep(uint32_t seen);
+uint32_t local_doorbell(void);
+void   local_die(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+size_t local_type_size(MPI_Datatype type);
+int    local_error(MPI_Comm comm, int code, const char *fn);
+
+//! Mark entry to and exit from a runtime call.  Faults are only acted on
+//! at well-defined points inside runtime calls while in_mpi is set.
+//! Outermost entries count as MPI calls for fault injection, and the first
+//! one to return after a restart ends the recovery's timing.
+#define LOCAL_ENTER()                                                     \
+  do {                                                                    \
+    if (!local.in_mpi++ && ++local.calls >= local.inject_call) {          \
+      local_inject_call();                                                \
+    }                                                                     \
+  } while (0)
+#define LOCAL_EXIT(rc)                                                    \
+  (--local.in_mpi || !local.first_call ? (void) 0                         \
+                                       : local_timing_first_call(),       \
+   (rc))
+
+//! Fast, monotonic tick counter for event timestamps.
+static inline uint64_t local_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+//! Record an event in this rank's ring.  The increment need not be atomic:
+//! the only writer that can interrupt another is the fault signal handler,
+//! and once it records anything it never returns to the interrupted code.
+static inline void local_trace(int type, int64_t a, int64_t b) {
+  struct local_trace *t = local.trace;
+  if (!t) {
+    return;
+  }
+  uint64_t i = t->head;
+  t->head = i + 1;
+  struct local_event *e = &t->events[i & t->mask];
+  e->ticks = local_ticks();
+  e->type  = type;
+  e->epoch = local.epoch;
+  e->a     = a;
+  e->b     = b;
+}
+
+// comm.c
+void   local_comm_setup(int size);
+void   local_comm_init(void);
+void   local_comm_reset(void);
+struct local_comm *local_comm_get(MPI_Comm comm);
+struct local_memo *local_comm_memo(int index);
+void   local_comm_memo_mismatch(void);
+
+// win.c
+void   local_win_reset(void);
+
+// coll.c
+struct local_sched;
+int    local_sched_run(struct local_sched *s);
+void   local_sched_free(struct local_sched *s);
+
+// p2p.c
+struct local_request *local_persistent(struct local_sched *sched);
+void   local_p2p_init(void);
+void   local_p2p_reset(void);
+unsigned long local_p2p_reclaimed(void);
+int    local_progress(void);
+int    local_send(const void *buf, size_t bytes, int dest, int tag,
+                  struct local_comm *c);
+int    local_recv(void *buf, size_t bytes, int source, int tag,
+                  struct local_comm *c, MPI_Status *status);
+
+// reinit.c
+int    local_fault_pending(void);
+void   local_check_fault(void);
+void   local_recover(void) __attribute__((noreturn));
+void   local_fault_init(void);
+
+// inject.c
+void   local_inject_parse(void);
+void   local_inject_init(void);
+void   local_inject_call(void);
+void   local_inject_event(int when);
+double local_inject_timers(void);
+int    local_all_running(void);
+
+// trace.c
+void   local_trace_setup(void);
+void   local_trace_init(void);
+void   local_trace_dump(int rank, pid_t pid, int reason);
+
+// replay.c
+void   local_replay_init(void);
+void   local_replay_recover(int lost, long seq);
+void   local_replay_holder_lost(int holder);
+long   local_replay_next_seq(void);
+long   local_replay_peek_seq(void);
+int    local_replay_pin(long seq, int *source, int *tag);
+void   local_replay_record(long seq, int source, int tag);
+
+// tx.c
+void   local_tx_init(void);
+int    local_tx_depth(void);
+void   local_tx_rollback(int base);
+
+// timing.c
+void   local_timing_begin(int start_state);
+void   local_timing_lap(int phase);
+void   local_timing_end(uint32_t epoch, int target);
+void   local_timing_reentered(void);
+void   local_timing_first_call(void);
+unsigned long local_timing_count(void);
+double local_timing_total(int phase);
+void   local_work_summary(void);
+
+#endif // MPI_LOCAL_LOCAL_H
@@ -0,0 +1,97 @@
+// ===========================================================================
+// Memory allocation for the local runtime.
+//
+// MPI_Alloc_mem stands in for memory registered with a network: each region
+// is a mapping of its own, and MPI_Free_mem keeps it, with its pages, in a
+// cache that outlives rollbacks.  An application that frees its buffers in a
+// cleanup handler and allocates them again after MPI_Reinit gets resident
+// pages back instead of faulting in new ones, the way a registration cache
+// saves pinning buffers again.  MPI_LOCAL_MEM_CACHE_MB bounds the cache.
+// ===========================================================================
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "local.h"
+
+struct region {
+  char     *base;
+  size_t    size;
+  int       free;
+  uint64_t  freed;                    //!< When it was last freed.
+};
+
+static struct region *regions;
+static int            nregions, regions_cap;
+static size_t         cached;         //!< Bytes in free regions.
+static uint64_t       frees;          //!< Calls to MPI_Free_mem so far.
+
+// The smallest free region that holds bytes without wasting more than half.
+static struct region *reuse(size_t bytes) {
+  struct region *best = NULL;
+  for (int i = 0; i < nregions; i++) {
+    struct region *r = &regions[i];
+    if (r->free && r->size >= bytes && r->size / 2 <= bytes &&
+        (!best || r->size < best->size)) {
+      best = r;
+    }
+  }
+  return best;
+}
+
+// Unmap free regions, those freed longest ago first, until the cache fits
+// its bound.  Buffers freed just before a rollback are the ones to keep.
+static void trim(void) {
+  while (cached > local.shm->mem_cache) {
+    struct region *oldest = NULL;
+    for (int i = 0; i < nregions; i++) {
+      struct region *r = &regions[i];
+      if (r->free && (!oldest || r->freed < oldest->freed)) {
+        oldest = r;
+      }
+    }
+    munmap(oldest->base, oldest->size);
+    cached -= oldest->size;
+    *oldest = regions[--nregions];
+  }
+}
+
+int MPI_Alloc_mem(MPI_Aint size, void *info, void *baseptr) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t bytes = ((size ? size : 1) + page - 1) & ~(page - 1);
+
+  struct region *r = reuse(bytes);
+  if (r) {
+    r->free = 0;
+    cached -= r->size;
+    *(void**) baseptr = r->base;
+    return MPI_SUCCESS;
+  }
+
+  void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_NO_MEM, "MPI_Alloc_mem");
+  }
+  if (nregions == regions_cap) {
+    regions_cap = regions_cap ? 2 * regions_cap : 16;
+    regions = realloc(regions, regions_cap * sizeof(*regions));
+  }
+  regions[nregions++] = (struct region) { base, bytes, 0, 0 };
+  *(void**) baseptr = base;
+  return MPI_SUCCESS;
+}
+
+int MPI_Free_mem(void *base) {
+  for (int i = 0; i < nregions; i++) {
+    struct region *r = &regions[i];
+    if (r->base == base && !r->free) {
+      r->free  = 1;
+      r->freed = ++frees;
+      cached += r->size;
+      trim();
+      return MPI_SUCCESS;
+    }
+  }
+  return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Free_mem");
+}
@@ -0,0 +1,395 @@
+// ===========================================================================
+// mpi.h for the local runtime
+//
+// A self-contained stand-in for MPI that runs every rank as a forked process
+// on one host.  It implements the subset of MPI used by example.c and the
+// proxy applications, plus everything in mpi-resilience.h.  See
+// local/README.md for how to run programs with it.
+// ===========================================================================
+#ifndef MPI_LOCAL_MPI_H
+#define MPI_LOCAL_MPI_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ===========================================================================
+// Handles and constants
+// ===========================================================================
+typedef int  MPI_Comm;
+typedef int  MPI_Datatype;
+typedef int  MPI_Op;
+typedef int  MPI_Win;
+typedef long MPI_Aint;
+typedef struct local_request *MPI_Request;
+
+typedef struct {
+  int    MPI_SOURCE;
+  int    MPI_TAG;
+  int    MPI_ERROR;
+  size_t bytes;         //!< Internal: size of the received message.
+} MPI_Status;
+
+#define MPI_COMM_NULL      (-1)
+#define MPI_COMM_WORLD     0
+#define MPI_COMM_SELF      1
+
+#define MPI_WIN_NULL       (-1)
+
+#define MPI_REQUEST_NULL   ((MPI_Request) 0)
+#define MPI_STATUS_IGNORE  ((MPI_Status *) 0)
+#define MPI_STATUSES_IGNORE ((MPI_Status *) 0)
+#define MPI_IN_PLACE       ((void *) 1)
+#define MPI_INFO_NULL      ((void *) 0)
+
+#define MPI_ANY_SOURCE     (-1)
+#define MPI_ANY_TAG        (-1)
+#define MPI_PROC_NULL      (-2)
+#define MPI_UNDEFINED      (-32766)
+#define MPI_TAG_UB_VALUE   0x3fffffff
+
+#define MPI_MAX_ERROR_STRING 256
+
+//! Predefined datatypes.
+enum {
+  MPI_DATATYPE_NULL = 0,
+  MPI_CHAR,
+  MPI_BYTE,
+  MPI_INT,
+  MPI_UNSIGNED,
+  MPI_LONG,
+  MPI_UNSIGNED_LONG,
+  MPI_LONG_LONG,
+  MPI_FLOAT,
+  MPI_DOUBLE,
+  MPI_INT64_T,
+  MPI_UINT64_T,
+  MPI_2INT,             //!< struct { int value; int index; }
+  MPI_DOUBLE_INT,       //!< struct { double value; int index; }
+  LOCAL_NUM_DATATYPES
+};
+
+//! Predefined reduction operations.
+enum {
+  MPI_OP_NULL = 0,
+  MPI_MAX,
+  MPI_MIN,
+  MPI_SUM,
+  MPI_PROD,
+  MPI_LAND,
+  MPI_LOR,
+  MPI_BAND,
+  MPI_BOR,
+  MPI_MAXLOC,
+  MPI_MINLOC,
+  LOCAL_NUM_OPS
+};
+
+//! Error classes.
+enum {
+  MPI_SUCCESS = 0,
+  MPI_ERR_BUFFER,
+  MPI_ERR_COUNT,
+  MPI_ERR_TYPE,
+  MPI_ERR_TAG,
+  MPI_ERR_COMM,
+  MPI_ERR_RANK,
+  MPI_ERR_REQUEST,
+  MPI_ERR_ROOT,
+  MPI_ERR_OP,
+  MPI_ERR_ARG,
+  MPI_ERR_TRUNCATE,
+  MPI_ERR_NO_MEM,
+  MPI_ERR_OTHER,
+  MPI_ERR_INTERN,
+  MPI_T_ERR_NOT_INITIALIZED,
+  MPI_T_ERR_INVALID_INDEX,
+  MPI_T_ERR_INVALID_NAME,
+  MPI_T_ERR_INVALID_HANDLE,
+  MPI_ERR_LASTCODE
+};
+
+
+// ===========================================================================
+// Environment
+// ===========================================================================
+int MPI_Init(int *argc, char ***argv);
+int MPI_Finalize(void);
+int MPI_Initialized(int *flag);
+int MPI_Finalized(int *flag);
+int MPI_Abort(MPI_Comm comm, int errorcode);
+double MPI_Wtime(void);
+double MPI_Wtick(void);
+int MPI_Error_string(int errorcode, char *string, int *resultlen);
+int MPI_Alloc_mem(MPI_Aint size, void *info, void *baseptr);
+int MPI_Free_mem(void *base);
+int MPI_Type_size(MPI_Datatype datatype, int *size);
+
+// ===========================================================================
+// Communicators
+// ===========================================================================
+int MPI_Comm_rank(MPI_Comm comm, int *rank);
+int MPI_Comm_size(MPI_Comm comm, int *size);
+int MPI_Comm_dup(MPI_Comm comm, MPI_Comm *newcomm);
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm *newcomm);
+int MPI_Comm_free(MPI_Comm *comm);
+
+// ===========================================================================
+// Point-to-point
+// ===========================================================================
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+             int tag, MPI_Comm comm);
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source,
+             int tag, MPI_Comm comm, MPI_Status *status);
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request *request);
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request *request);
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int source, int recvtag, MPI_Comm comm, MPI_Status *status);
+int MPI_Wait(MPI_Request *request, MPI_Status *status);
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]);
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status);
+int MPI_Start(MPI_Request *request);
+int MPI_Request_free(MPI_Request *request);
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status);
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag,
+               MPI_Status *status);
+int MPI_Get_count(const MPI_Status *status, MPI_Datatype datatype,
+                  int *count);
+
+// ===========================================================================
+// Collectives
+// ===========================================================================
+int MPI_Barrier(MPI_Comm comm);
+int MPI_Bcast(void *buf, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm);
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+               MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm);
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               int root, MPI_Comm comm);
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm);
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm);
+int MPI_Allreduce_init(const void *sendbuf, void *recvbuf, int count,
+                       MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                       void *info, MPI_Request *request);
+
+// ===========================================================================
+// One-sided communication
+//
+// Only windows from MPI_Win_allocate, with fence synchronization.  Window
+// memory is in the shared mapping, and the assert argument of MPI_Win_fence
+// is ignored.
+// ===========================================================================
+int MPI_Win_allocate(MPI_Aint size, int disp_unit, void *info, MPI_Comm comm,
+                     void *baseptr, MPI_Win *win);
+int MPI_Win_free(MPI_Win *win);
+int MPI_Win_fence(int assert, MPI_Win win);
+int MPI_Put(const void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win);
+int MPI_Get(void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win);
+
+// ===========================================================================
+// Tool information interface
+//
+// Only performance variables are supported.  All of them are continuous,
+// read-only and not bound to any object, so handles can be read as soon as
+// they are allocated.
+// ===========================================================================
+typedef struct local_pvar_session *MPI_T_pvar_session;
+typedef struct local_pvar_handle  *MPI_T_pvar_handle;
+typedef int MPI_T_enum;
+
+#define MPI_T_ENUM_NULL          ((MPI_T_enum) 0)
+#define MPI_T_PVAR_SESSION_NULL  ((MPI_T_pvar_session) 0)
+#define MPI_T_PVAR_HANDLE_NULL   ((MPI_T_pvar_handle) 0)
+
+enum {
+  MPI_THREAD_SINGLE,
+  MPI_THREAD_FUNNELED,
+  MPI_THREAD_SERIALIZED,
+  MPI_THREAD_MULTIPLE
+};
+
+enum {
+  MPI_T_VERBOSITY_USER_BASIC,
+  MPI_T_VERBOSITY_USER_DETAIL,
+  MPI_T_VERBOSITY_USER_ALL,
+  MPI_T_VERBOSITY_TUNER_BASIC,
+  MPI_T_VERBOSITY_TUNER_DETAIL,
+  MPI_T_VERBOSITY_TUNER_ALL,
+  MPI_T_VERBOSITY_MPIDEV_BASIC,
+  MPI_T_VERBOSITY_MPIDEV_DETAIL,
+  MPI_T_VERBOSITY_MPIDEV_ALL
+};
+
+enum {
+  MPI_T_BIND_NO_OBJECT,
+  MPI_T_BIND_MPI_COMM
+};
+
+enum {
+  MPI_T_PVAR_CLASS_STATE,
+  MPI_T_PVAR_CLASS_LEVEL,
+  MPI_T_PVAR_CLASS_SIZE,
+  MPI_T_PVAR_CLASS_PERCENTAGE,
+  MPI_T_PVAR_CLASS_HIGHWATERMARK,
+  MPI_T_PVAR_CLASS_LOWWATERMARK,
+  MPI_T_PVAR_CLASS_COUNTER,
+  MPI_T_PVAR_CLASS_AGGREGATE,
+  MPI_T_PVAR_CLASS_TIMER,
+  MPI_T_PVAR_CLASS_GENERIC
+};
+
+int MPI_T_init_thread(int required, int *provided);
+int MPI_T_finalize(void);
+int MPI_T_pvar_get_num(int *num_pvar);
+int MPI_T_pvar_get_info(int pvar_index, char *name, int *name_len,
+                        int *verbosity, int *var_class,
+                        MPI_Datatype *datatype, MPI_T_enum *enumtype,
+                        char *desc, int *desc_len, int *bind, int *readonly,
+                        int *continuous, int *atomic);
+int MPI_T_pvar_get_index(const char *name, int var_class, int *pvar_index);
+int MPI_T_pvar_session_create(MPI_T_pvar_session *session);
+int MPI_T_pvar_session_free(MPI_T_pvar_session *session);
+int MPI_T_pvar_handle_alloc(MPI_T_pvar_session session, int pvar_index,
+                            void *obj_handle, MPI_T_pvar_handle *handle,
+                            int *count);
+int MPI_T_pvar_handle_free(MPI_T_pvar_session session,
+                           MPI_T_pvar_handle *handle);
+int MPI_T_pvar_start(MPI_T_pvar_session session, MPI_T_pvar_handle handle);
+int MPI_T_pvar_stop(MPI_T_pvar_session session, MPI_T_pvar_handle handle);
+int MPI_T_pvar_read(MPI_T_pvar_session session, MPI_T_pvar_handle handle,
+                    void *buf);
+
+// ===========================================================================
+// Extensions of the local runtime
+// ===========================================================================
+
+//! Defined when building against the local runtime, for code that uses the
+//! extensions below but should also build with other MPIs.
+#define MPIX_LOCAL 1
+
+/*!
+ * Report that the application reached a named point, e.g. ("step", 12) at
+ * the start of time step 12.  Fault injection rules with a matching trigger
+ * (step=12) fire here.  See local/inject.c for the rule syntax.
+ */
+int MPIX_Inject_point(const char *name, long value);
+
+//! Phases of a recovery, in the order they happen on each process.
+enum {
+  MPIX_RECOVERY_DETECT,       //!< Fault happened -> runtime noticed it.
+  MPIX_RECOVERY_DISSEMINATE,  //!< Runtime noticed -> this process noticed,
+                              //!< or a replacement was spawned.
+  MPIX_RECOVERY_CLEANUP,      //!< Transaction rollback and cleanup handlers.
+  MPIX_RECOVERY_REINIT,       //!< Resetting runtime state and jumping back to
+                              //!< the restart point; for a replacement, also
+                              //!< process startup up to MPI_Reinit.
+  MPIX_RECOVERY_AGREE,        //!< Waiting in the recovery barriers.
+  MPIX_RECOVERY_CHECKPOINT,   //!< Restart point entered -> checkpoint loaded.
+  MPIX_RECOVERY_FIRST_CALL,   //!< Checkpoint loaded -> first MPI call done.
+  MPIX_RECOVERY_NUM_PHASES
+};
+
+//! Timings of one recovery on one process.  Timestamps come from
+//! MPI_Wtime, which uses the same clock on every rank.
+typedef struct {
+  unsigned epoch;             //!< Fault epoch recovered from.
+  int      start_state;       //!< MPI_Start_state the process restarted in.
+  int      target;            //!< Scope level restarted at; 0 is MPI_Reinit.
+  double   fault_time;        //!< When the fault happened.
+  double   phase[MPIX_RECOVERY_NUM_PHASES];  //!< Seconds in each phase.
+} MPIX_Recovery_record;
+
+/*!
+ * Report that the application finished loading its checkpoint after a
+ * restart.  Ends the checkpoint phase of the current recovery record.  If
+ * this is never called, the checkpoint phase is zero and the first MPI
+ * call is timed from the restart point instead.
+ */
+int MPIX_Checkpoint_loaded(void);
+
+/*!
+ * Report that the application is starting a step of its main loop.  With
+ * MPIX_Work_committed, this lets the runtime count the work each fault
+ * destroyed: the time and steps from the last commit to the fault, the
+ * interrupted step included.  Steps started again after a rollback, below
+ * the highest step reached, are counted as redone.  Totals are the lost_work_* and redo_work_* MPI_T
+ * performance variables, and a job that lost work prints a summary at
+ * the end.
+ *
+ * @param[in] step  Step about to start.
+ */
+int MPIX_Work_step(long step);
+
+/*!
+ * Report that a checkpoint was committed.  Work before it is no longer
+ * at risk.  Checkpointing libraries call this on a successful store.
+ *
+ * @param[in] step  Step the checkpoint resumes at.
+ */
+int MPIX_Work_committed(long step);
+
+/*!
+ * Copy up to max of the most recent recovery records of this process into
+ * records, oldest first, and set count to the number copied.  The last
+ * record may still be filling in if the process has not made an MPI call
+ * since its restart.  Gather them to aggregate across ranks.
+ */
+int MPIX_Recovery_records(int max, MPIX_Recovery_record records[],
+                          int *count);
+
+//! Events recorded in each rank's trace ring.  Values a and b of each event
+//! are listed after it.
+enum {
+  MPIX_EVENT_FAULT_RAISED,      //!< MPI_Fault called.  Epoch, 0.
+  MPIX_EVENT_FAULT_FOUND,       //!< A check found a fault.  Epoch, 0.
+  MPIX_EVENT_MODE,              //!< Fault mode set.  Mode, 0.
+  MPIX_EVENT_HANDLER_PUSH,      //!< Cleanup handler pushed.  Handlers, 0.
+  MPIX_EVENT_HANDLER_POP,       //!< Cleanup handler popped.  Handlers, 0.
+  MPIX_EVENT_RECOVERY_BEGIN,    //!< Recovery started.  Epoch, start state.
+  MPIX_EVENT_RECOVERY_PHASE,    //!< Phase ended.  MPIX_RECOVERY_*, usecs.
+  MPIX_EVENT_RECOVERY_END,      //!< Recovery done.  Epoch, target level.
+  MPIX_EVENT_TX_ROLLBACK,       //!< Transactions undone.  Count, 0.
+  MPIX_EVENT_RESTART,           //!< Restart point entered.  State, level.
+  MPIX_EVENT_CHECKPOINT_STORED, //!< Checkpoint committed.  Step, bytes.
+  MPIX_EVENT_CHECKPOINT_LOADED, //!< Checkpoint restored.  Step or -1, bytes.
+  MPIX_EVENT_INJECT,            //!< Injection rule fired.  Action, rule.
+  MPIX_EVENT_ABORT,             //!< MPI_Abort called.  Error code, 0.
+  MPIX_EVENT_BARRIER,           //!< Left a recovery barrier.  Barrier,
+                                //!< ticks at arrival.
+  MPIX_EVENT_USER = 64          //!< First code for application events.
+};
+
+/*!
+ * Record an event in this rank's trace ring, e.g. a checkpoint commit by a
+ * checkpointing library.  Costs a few nanoseconds and never blocks.  See
+ * the local runtime's README for when rings are written to files.
+ *
+ * @param[in] event  MPIX_EVENT_* code, or MPIX_EVENT_USER and up.
+ * @param[in] a, b   Values recorded with the event.
+ */
+int MPIX_Trace_event(int event, long a, long b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MPI_LOCAL_MPI_H
@@ -0,0 +1,226 @@
+// ===========================================================================
+// Tool information interface for the local runtime.
+//
+// Performance variables are described by a static table.  They are all
+// continuous and read-only, so sessions and handles carry no state beyond
+// the variable a handle refers to.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+struct local_pvar_session {
+  int unused;
+};
+
+struct local_pvar_handle {
+  int index;
+};
+
+struct pvar {
+  const char   *name;
+  const char   *desc;
+  int           var_class;
+  MPI_Datatype  datatype;
+  int           phase;          //!< MPIX_RECOVERY_* for a phase timer,
+                                //!< NUM_PHASES for their sum, -1 for count,
+                                //!< a WORK_* counter or REQUESTS_RECLAIMED.
+};
+
+//! Counters of this rank kept outside the recovery records.
+enum {
+  WORK_LOST_TIME = MPIX_RECOVERY_NUM_PHASES + 1,
+  WORK_LOST_STEPS,
+  WORK_REDO_TIME,
+  WORK_REDO_STEPS,
+  REQUESTS_RECLAIMED,
+};
+
+static const struct pvar pvars[] = {
+  { "recovery_count", "Recoveries this process took part in",
+    MPI_T_PVAR_CLASS_COUNTER, MPI_UNSIGNED_LONG, -1 },
+  { "recovery_time", "Seconds spent in all phases of recovery",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_NUM_PHASES },
+  { "recovery_detect_time", "Seconds from faults to the runtime noticing",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_DETECT },
+  { "recovery_disseminate_time",
+    "Seconds from the runtime noticing faults to this process noticing",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_DISSEMINATE },
+  { "recovery_cleanup_time",
+    "Seconds spent rolling back transactions and in cleanup handlers",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_CLEANUP },
+  { "recovery_reinit_time",
+    "Seconds spent resetting state and re-entering restart points",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_REINIT },
+  { "recovery_agree_time", "Seconds spent waiting in recovery barriers",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_AGREE },
+  { "recovery_checkpoint_time",
+    "Seconds from re-entering a restart point to loading the checkpoint",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_CHECKPOINT },
+  { "recovery_first_call_time",
+    "Seconds from loading the checkpoint to completing the next MPI call",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, MPIX_RECOVERY_FIRST_CALL },
+  { "lost_work_time",
+    "Seconds of work since the last checkpoint commit destroyed by faults",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, WORK_LOST_TIME },
+  { "lost_work_steps",
+    "Steps since the last checkpoint commit destroyed by faults",
+    MPI_T_PVAR_CLASS_COUNTER, MPI_UNSIGNED_LONG, WORK_LOST_STEPS },
+  { "redo_work_time", "Seconds spent redoing steps after rollbacks",
+    MPI_T_PVAR_CLASS_TIMER, MPI_DOUBLE, WORK_REDO_TIME },
+  { "redo_work_steps", "Steps redone after rollbacks",
+    MPI_T_PVAR_CLASS_COUNTER, MPI_UNSIGNED_LONG, WORK_REDO_STEPS },
+  { "requests_reclaimed",
+    "Requests left outstanding by rollbacks and freed by the runtime",
+    MPI_T_PVAR_CLASS_COUNTER, MPI_UNSIGNED_LONG, REQUESTS_RECLAIMED },
+};
+
+#define NUM_PVARS ((int) (sizeof(pvars) / sizeof(pvars[0])))
+
+static int initialized;     //!< Outstanding MPI_T_init_thread calls.
+
+static void copy_string(char *dst, int *len, const char *src) {
+  if (!len) {
+    return;
+  }
+  if (dst && *len > 0) {
+    snprintf(dst, *len, "%s", src);
+  }
+  *len = (int) strlen(src) + 1;
+}
+
+int MPI_T_init_thread(int required, int *provided) {
+  initialized++;
+  *provided = MPI_THREAD_SINGLE;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_finalize(void) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  }
+  initialized--;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_get_num(int *num_pvar) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  }
+  *num_pvar = NUM_PVARS;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_get_info(int pvar_index, char *name, int *name_len,
+                        int *verbosity, int *var_class,
+                        MPI_Datatype *datatype, MPI_T_enum *enumtype,
+                        char *desc, int *desc_len, int *bind, int *readonly,
+                        int *continuous, int *atomic) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  } else if (pvar_index < 0 || pvar_index >= NUM_PVARS) {
+    return MPI_T_ERR_INVALID_INDEX;
+  }
+  const struct pvar *v = &pvars[pvar_index];
+  copy_string(name, name_len, v->name);
+  copy_string(desc, desc_len, v->desc);
+  *verbosity  = MPI_T_VERBOSITY_USER_BASIC;
+  *var_class  = v->var_class;
+  *datatype   = v->datatype;
+  *enumtype   = MPI_T_ENUM_NULL;
+  *bind       = MPI_T_BIND_NO_OBJECT;
+  *readonly   = 1;
+  *continuous = 1;
+  *atomic     = 0;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_get_index(const char *name, int var_class, int *pvar_index) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  }
+  for (int i = 0; i < NUM_PVARS; i++) {
+    if (pvars[i].var_class == var_class && !strcmp(pvars[i].name, name)) {
+      *pvar_index = i;
+      return MPI_SUCCESS;
+    }
+  }
+  return MPI_T_ERR_INVALID_NAME;
+}
+
+int MPI_T_pvar_session_create(MPI_T_pvar_session *session) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  }
+  *session = calloc(1, sizeof(**session));
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_session_free(MPI_T_pvar_session *session) {
+  free(*session);
+  *session = MPI_T_PVAR_SESSION_NULL;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_handle_alloc(MPI_T_pvar_session session, int pvar_index,
+                            void *obj_handle, MPI_T_pvar_handle *handle,
+                            int *count) {
+  if (!initialized) {
+    return MPI_T_ERR_NOT_INITIALIZED;
+  } else if (pvar_index < 0 || pvar_index >= NUM_PVARS) {
+    return MPI_T_ERR_INVALID_INDEX;
+  }
+  *handle = malloc(sizeof(**handle));
+  (*handle)->index = pvar_index;
+  *count = 1;
+  return MPI_SUCCESS;
+}
+
+int MPI_T_pvar_handle_free(MPI_T_pvar_session session,
+                           MPI_T_pvar_handle *handle) {
+  free(*handle);
+  *handle = MPI_T_PVAR_HANDLE_NULL;
+  return MPI_SUCCESS;
+}
+
+// Continuous variables are always started.
+int MPI_T_pvar_start(MPI_T_pvar_session session, MPI_T_pvar_handle handle) {
+  return handle ? MPI_SUCCESS : MPI_T_ERR_INVALID_HANDLE;
+}
+
+int MPI_T_pvar_stop(MPI_T_pvar_session session, MPI_T_pvar_handle handle) {
+  return handle ? MPI_SUCCESS : MPI_T_ERR_INVALID_HANDLE;
+}
+
+int MPI_T_pvar_read(MPI_T_pvar_session session, MPI_T_pvar_handle handle,
+                    void *buf) {
+  if (!handle) {
+    return MPI_T_ERR_INVALID_HANDLE;
+  }
+  const struct pvar *v = &pvars[handle->index];
+  const struct local_work *w = &local.shm->slots[local.rank].work;
+  if (v->phase == REQUESTS_RECLAIMED) {
+    *(unsigned long *) buf = local_p2p_reclaimed();
+  } else if (v->phase == WORK_LOST_TIME) {
+    *(double *) buf = w->lost_time;
+  } else if (v->phase == WORK_LOST_STEPS) {
+    *(unsigned long *) buf = w->lost_steps;
+  } else if (v->phase == WORK_REDO_TIME) {
+    *(double *) buf = w->redo_time;
+  } else if (v->phase == WORK_REDO_STEPS) {
+    *(unsigned long *) buf = w->redo_steps;
+  } else if (v->phase < 0) {
+    *(unsigned long *) buf = local_timing_count();
+  } else if (v->phase == MPIX_RECOVERY_NUM_PHASES) {
+    double total = 0;
+    for (int p = 0; p < MPIX_RECOVERY_NUM_PHASES; p++) {
+      total += local_timing_total(p);
+    }
+    *(double *) buf = total;
+  } else {
+    *(double *) buf = local_timing_total(v->phase);
+  }
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,869 @@
+// ===========================================================================
+// Point-to-point messaging for the local runtime.
+//
+// Each ordered pair of ranks that communicates gets a single-producer,
+// single-consumer ring in shared memory, created by the sender on first use.
+// Messages are split into fragments that are published whole, so a sender
+// that dies or rolls back never leaves a torn fragment behind.  All matching
+// happens on the receiver, which drains its incoming rings into posted
+// receives or a private queue of unexpected messages.
+// ===========================================================================
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+enum {
+  LOCAL_REQ_SEND,
+  LOCAL_REQ_RECV,
+  LOCAL_REQ_COLL,       //!< Persistent collective.
+};
+
+struct local_request {
+  int                   kind;
+  int                   done;
+  int                   started;    //!< Send: first fragment pushed.
+  int                   context;
+  int                   peer;       //!< World rank, or MPI_ANY_SOURCE.
+  int                   tag;
+  struct local_comm    *comm;
+  char                 *buf;
+  size_t                bytes;      //!< Send size, or receive capacity.
+  size_t                offset;     //!< Bytes sent or received so far.
+  size_t                total;      //!< Receive: size of matched message.
+  long                  seq;        //!< Replay sequence, or -1.
+  int                   index;      //!< Position in the live table.
+  struct local_sched   *sched;      //!< Persistent collective's schedule.
+  int                   freed;      //!< Freed while active: free when done.
+  MPI_Status            status;
+  struct local_request *next;
+};
+
+//! A message that arrived before a matching receive was posted.
+struct local_unexp {
+  int                 source;       //!< World rank.
+  int                 context;
+  int                 tag;
+  size_t              total;
+  size_t              received;
+  char               *data;
+  struct local_unexp *next;
+};
+
+//! Where the rest of a partly received message from one source goes.
+struct local_inflight {
+  struct local_request *req;
+  struct local_unexp   *unexp;
+};
+
+static struct local_request  *sendq, *sendq_tail;
+static struct local_request  *posted, *posted_tail;
+static struct local_unexp    *unexp, *unexp_tail;
+static struct local_inflight *inflight;     //!< By source world rank.
+static struct local_chan    **out;          //!< By destination world rank.
+static struct local_chan    **in;           //!< By source world rank.
+static int                   *in_src;       //!< Sources with a channel to us.
+static int                    nin;
+static uint32_t              *blocked;      //!< Per-destination pass marks.
+static uint32_t               pass;
+static struct local_request **live;         //!< Every request not completed.
+static int                    nlive, live_cap;
+static unsigned long          reclaimed;    //!< Requests freed by resets.
+static struct local_request  *running;      //!< Persistent one in MPI_Start.
+
+#define ROUND8(n) (((n) + 7) & ~(size_t) 7)
+
+void local_p2p_init(void) {
+  int size = local.size;
+  inflight = calloc(size, sizeof(*inflight));
+  out      = calloc(size, sizeof(*out));
+  in       = calloc(size, sizeof(*in));
+  in_src   = calloc(size, sizeof(*in_src));
+  blocked  = calloc(size, sizeof(*blocked));
+  nin = 0;
+  nlive = 0;
+  sendq = sendq_tail = NULL;
+  posted = posted_tail = NULL;
+  unexp = unexp_tail = NULL;
+}
+
+// ===========================================================================
+// Channels
+// ===========================================================================
+static uint32_t *inlist(int rank) {
+  uint32_t *lists = local_at(local.shm->inlists);
+  return lists + (size_t) rank * (local.size + 1);
+}
+
+static struct local_chan *chan_out(int dest) {
+  if (out[dest]) {
+    return out[dest];
+  }
+
+  uint64_t *table = local_at(local.shm->chan_table);
+  uint64_t *entry = &table[(size_t) local.rank * local.size + dest];
+  uint64_t offset = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+  if (!offset) {
+    uint64_t cap = local.shm->chan_cap;
+    struct local_chan *chan = local_heap_alloc(sizeof(*chan) + cap);
+    chan->cap = cap;
+    offset = local_offset(chan);
+    __atomic_store_n(entry, offset, __ATOMIC_RELEASE);
+
+    // Tell the destination it has a new source to drain.
+    uint32_t *list = inlist(dest);
+    uint32_t index = __atomic_fetch_add(&list[0], 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&list[1 + index], local.rank + 1, __ATOMIC_RELEASE);
+  }
+  out[dest] = local_at(offset);
+  return out[dest];
+}
+
+// Pick up channels that other ranks have created to us since last time.
+static void refresh_in(void) {
+  uint32_t *list = inlist(local.rank);
+  uint32_t count = __atomic_load_n(&list[0], __ATOMIC_ACQUIRE);
+  uint64_t *table = local_at(local.shm->chan_table);
+  while ((uint32_t) nin < count) {
+    uint32_t entry = __atomic_load_n(&list[1 + nin], __ATOMIC_ACQUIRE);
+    if (!entry) {
+      break;      // Announced but not written yet.
+    }
+    int src = entry - 1;
+    uint64_t offset = __atomic_load_n(
+      &table[(size_t) src * local.size + local.rank], __ATOMIC_ACQUIRE);
+    in[src] = local_at(offset);
+    in_src[nin++] = src;
+  }
+}
+
+static void chan_copy_in(struct local_chan *c, uint64_t pos,
+                         const void *src, size_t len) {
+  size_t at = pos & (c->cap - 1);
+  size_t first = len < c->cap - at ? len : c->cap - at;
+  memcpy(c->data + at, src, first);
+  memcpy(c->data, (const char*) src + first, len - first);
+}
+
+static void chan_copy_out(struct local_chan *c, uint64_t pos,
+                          void *dst, size_t len) {
+  size_t at = pos & (c->cap - 1);
+  size_t first = len < c->cap - at ? len : c->cap - at;
+  memcpy(dst, c->data + at, first);
+  memcpy((char*) dst + first, c->data, len - first);
+}
+
+// ===========================================================================
+// Sending
+// ===========================================================================
+
+// Push as much of a send as fits.  Returns nonzero if anything was pushed.
+static int send_progress(struct local_request *r) {
+  struct local_chan *c = chan_out(r->peer);
+  uint64_t head = c->head;
+  uint64_t tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+  size_t max = c->cap / 2 - sizeof(struct local_frag);
+  int pushed = 0;
+
+  while (!r->started || r->offset < r->bytes) {
+    size_t len = r->bytes - r->offset;
+    if (len > max) {
+      len = max;
+    }
+
+    size_t space = c->cap - (head - tail);
+    if (space < sizeof(struct local_frag) + ROUND8(len)) {
+      // Send a partial fragment if a useful amount fits.
+      size_t fits = space > sizeof(struct local_frag) ?
+        (space - sizeof(struct local_frag)) & ~(size_t) 7 : 0;
+      if (!fits || fits < 4096) {
+        break;
+      }
+      len = fits;
+    }
+
+    struct local_frag frag = {
+      .epoch   = local.epoch,
+      .tag     = r->tag,
+      .context = r->context,
+      .len     = (uint32_t) len,
+      .total   = r->bytes,
+      .offset  = r->offset,
+    };
+    chan_copy_in(c, head, &frag, sizeof(frag));
+    chan_copy_in(c, head + sizeof(frag), r->buf + r->offset, len);
+    head += sizeof(frag) + ROUND8(len);
+    __atomic_store_n(&c->head, head, __ATOMIC_RELEASE);
+
+    r->offset += len;
+    r->started = 1;
+    pushed = 1;
+  }
+
+  if (pushed) {
+    local_ring(r->peer);
+  }
+  if (r->offset == r->bytes && r->started) {
+    r->done = 1;
+  }
+  return pushed;
+}
+
+// ===========================================================================
+// Receiving
+// ===========================================================================
+static int matches(struct local_request *r, int source, int context,
+                   int tag) {
+  return r->context == context &&
+         (r->peer == MPI_ANY_SOURCE || r->peer == source) &&
+         (r->tag == MPI_ANY_TAG ? tag >= 0 : r->tag == tag);
+}
+
+static void recv_matched(struct local_request *r, int source, int tag,
+                         size_t total) {
+  r->total = total;
+  r->status.MPI_SOURCE = r->comm->local[source];
+  r->status.MPI_TAG    = tag;
+  r->status.MPI_ERROR  = total > r->bytes ? MPI_ERR_TRUNCATE : MPI_SUCCESS;
+  r->status.bytes      = total > r->bytes ? r->bytes : total;
+  if (r->seq >= 0) {
+    local_replay_record(r->seq, r->status.MPI_SOURCE, tag);
+  }
+}
+
+static void recv_deliver(struct local_request *r, size_t offset,
+                         const void *data, size_t len) {
+  if (offset < r->bytes) {
+    size_t n = len < r->bytes - offset ? len : r->bytes - offset;
+    memcpy(r->buf + offset, data, n);
+  }
+  r->offset = offset + len;
+  if (r->offset == r->total) {
+    r->done = 1;
+  }
+}
+
+static struct local_request *take_posted(int source, int context, int tag) {
+  struct local_request *prev = NULL;
+  for (struct local_request *r = posted; r; prev = r, r = r->next) {
+    if (matches(r, source, context, tag)) {
+      if (prev) {
+        prev->next = r->next;
+      } else {
+        posted = r->next;
+      }
+      if (posted_tail == r) {
+        posted_tail = prev;
+      }
+      r->next = NULL;
+      return r;
+    }
+  }
+  return NULL;
+}
+
+// Read one fragment from a source.  Payload is copied straight from the ring
+// into its destination.
+static void recv_fragment(int src, struct local_chan *c, uint64_t pos,
+                          struct local_frag *frag) {
+  struct local_inflight *fl = &inflight[src];
+  uint64_t payload = pos + sizeof(*frag);
+
+  if (frag->offset == 0) {
+    fl->req = take_posted(src, frag->context, frag->tag);
+    fl->unexp = NULL;
+    if (fl->req) {
+      recv_matched(fl->req, src, frag->tag, frag->total);
+    } else {
+      struct local_unexp *u = calloc(1, sizeof(*u));
+      u->source  = src;
+      u->context = frag->context;
+      u->tag     = frag->tag;
+      u->total   = frag->total;
+      u->data    = malloc(frag->total ? frag->total : 1);
+      if (unexp_tail) {
+        unexp_tail->next = u;
+      } else {
+        unexp = u;
+      }
+      unexp_tail = u;
+      fl->unexp = u;
+    }
+  }
+
+  if (fl->req) {
+    struct local_request *r = fl->req;
+    if (frag->offset < r->bytes) {
+      size_t n = frag->len;
+      if (n > r->bytes - frag->offset) {
+        n = r->bytes - frag->offset;
+      }
+      chan_copy_out(c, payload, r->buf + frag->offset, n);
+    }
+    r->offset = frag->offset + frag->len;
+    if (r->offset == r->total) {
+      r->done = 1;
+      fl->req = NULL;
+    }
+  } else if (fl->unexp) {
+    struct local_unexp *u = fl->unexp;
+    chan_copy_out(c, payload, u->data + frag->offset, frag->len);
+    u->received = frag->offset + frag->len;
+    if (u->received == u->total) {
+      fl->unexp = NULL;
+    }
+  }
+}
+
+// Drain everything available from one source.
+static int drain(int src) {
+  struct local_chan *c = in[src];
+  uint64_t tail = c->tail;
+  uint64_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+  if (tail == head) {
+    return 0;
+  }
+
+  while (tail != head) {
+    struct local_frag frag;
+    chan_copy_out(c, tail, &frag, sizeof(frag));
+    // Fragments sent before the last recovery are dropped here.
+    if (frag.epoch == local.epoch) {
+      recv_fragment(src, c, tail, &frag);
+    }
+    tail += sizeof(frag) + ROUND8(frag.len);
+  }
+  __atomic_store_n(&c->tail, tail, __ATOMIC_RELEASE);
+  local_ring(src);
+  return 1;
+}
+
+int local_progress(void) {
+  int progressed = 0;
+
+  pass++;
+  for (struct local_request *r = sendq, *prev = NULL; r; ) {
+    struct local_request *next = r->next;
+    if (blocked[r->peer] != pass) {
+      progressed |= send_progress(r);
+    }
+    if (r->done) {
+      if (prev) {
+        prev->next = next;
+      } else {
+        sendq = next;
+      }
+      if (sendq_tail == r) {
+        sendq_tail = prev;
+      }
+      r->next = NULL;
+    } else {
+      // Later sends to the same rank must wait their turn.
+      blocked[r->peer] = pass;
+      prev = r;
+    }
+    r = next;
+  }
+
+  refresh_in();
+  for (int i = 0; i < nin; i++) {
+    progressed |= drain(in_src[i]);
+  }
+  return progressed;
+}
+
+// A persistent collective is no longer active.
+static void finish(struct local_request *r) {
+  r->done = 1;
+  if (running == r) {
+    running = NULL;
+  }
+  if (r->freed) {
+    local_sched_free(r->sched);
+    free(r);
+  }
+}
+
+// Throw away this process's communication state.  Called during recovery,
+// once every process has stopped sending.  Outstanding requests are freed:
+// the application lost its handles to them when it rolled back, and their
+// buffers are its own again.
+//
+// The channels themselves survive: they live in the shared mapping, so a
+// replacement process picks up the rings of the rank it replaces from the
+// channel table on first use, and survivors keep theirs as they are.
+// Fragments still in the rings carry the epoch they were sent in and are
+// dropped when drained, so nothing here walks the channels and the cost
+// depends on the requests outstanding, not on the number of ranks.  The
+// in-flight table needs no clearing either: every message of the new epoch
+// starts with a fragment at offset 0, which resets its source's entry.
+void local_p2p_reset(void) {
+  // Queued sends, posted receives, receives partly matched and requests
+  // the application never waited for are all in the live table, so one
+  // pass frees them whatever state they were in.
+  for (int i = 0; i < nlive; i++) {
+    free(live[i]);
+  }
+  reclaimed += nlive;
+  nlive = 0;
+  sendq = sendq_tail = NULL;
+  posted = posted_tail = NULL;
+
+  while (unexp) {
+    struct local_unexp *u = unexp;
+    unexp = u->next;
+    free(u->data);
+    free(u);
+  }
+  unexp_tail = NULL;
+
+  // A persistent collective cut short by the rollback is no longer active,
+  // and one the application freed meanwhile goes now.
+  if (running) {
+    finish(running);
+  }
+}
+
+unsigned long local_p2p_reclaimed(void) {
+  return reclaimed;
+}
+
+// ===========================================================================
+// Requests
+// ===========================================================================
+static struct local_request *new_request(int kind, struct local_comm *c,
+                                         void *buf, size_t bytes, int tag) {
+  struct local_request *r = calloc(1, sizeof(*r));
+  r->kind    = kind;
+  r->comm    = c;
+  r->context = c->context;
+  r->buf     = buf;
+  r->bytes   = bytes;
+  r->tag     = tag;
+  r->seq     = -1;
+
+  if (nlive == live_cap) {
+    live_cap = live_cap ? 2 * live_cap : 64;
+    live = realloc(live, live_cap * sizeof(*live));
+  }
+  r->index = nlive;
+  live[nlive++] = r;
+  return r;
+}
+
+static struct local_request *post_send(const void *buf, size_t bytes,
+                                       int dest, int tag,
+                                       struct local_comm *c) {
+  struct local_request *r = new_request(LOCAL_REQ_SEND, c, (void*) buf,
+                                        bytes, tag);
+  if (dest == MPI_PROC_NULL) {
+    r->done = 1;
+    return r;
+  }
+  r->peer = c->world[dest];
+
+  // Try to push right away if nothing is queued ahead of us.
+  int queued = 0;
+  for (struct local_request *q = sendq; q; q = q->next) {
+    if (q->peer == r->peer) {
+      queued = 1;
+      break;
+    }
+  }
+  if (!queued) {
+    send_progress(r);
+  }
+  if (!r->done) {
+    if (sendq_tail) {
+      sendq_tail->next = r;
+    } else {
+      sendq = r;
+    }
+    sendq_tail = r;
+  }
+  return r;
+}
+
+static struct local_request *post_recv(void *buf, size_t bytes, int source,
+                                       int tag, struct local_comm *c) {
+  struct local_request *r = new_request(LOCAL_REQ_RECV, c, buf, bytes, tag);
+  if (source == MPI_PROC_NULL) {
+    r->status.MPI_SOURCE = MPI_PROC_NULL;
+    r->status.MPI_TAG    = MPI_ANY_TAG;
+    r->done = 1;
+    return r;
+  }
+
+  // Wildcard receives are nondeterministic: log or replay how they match.
+  if (source == MPI_ANY_SOURCE || tag == MPI_ANY_TAG) {
+    r->seq = local_replay_next_seq();
+    local_replay_pin(r->seq, &source, &tag);
+    r->tag = tag;
+  }
+  r->peer = source == MPI_ANY_SOURCE ? MPI_ANY_SOURCE : c->world[source];
+
+  local_progress();
+
+  struct local_unexp *prev = NULL;
+  for (struct local_unexp *u = unexp; u; prev = u, u = u->next) {
+    if (!matches(r, u->source, u->context, u->tag)) {
+      continue;
+    }
+    if (prev) {
+      prev->next = u->next;
+    } else {
+      unexp = u->next;
+    }
+    if (unexp_tail == u) {
+      unexp_tail = prev;
+    }
+
+    recv_matched(r, u->source, u->tag, u->total);
+    recv_deliver(r, 0, u->data, u->received);
+    if (!r->done) {
+      inflight[u->source].req = r;      // Rest is still arriving.
+      inflight[u->source].unexp = NULL;
+    }
+    free(u->data);
+    free(u);
+    return r;
+  }
+
+  if (posted_tail) {
+    posted_tail->next = r;
+  } else {
+    posted = r;
+  }
+  posted_tail = r;
+  return r;
+}
+
+static void wait_done(struct local_request *r) {
+  while (!r->done) {
+    uint32_t seen = local_doorbell();
+    local_check_fault();
+    if (!local_progress() && !r->done) {
+      local_sleep(seen);
+    }
+  }
+}
+
+static void complete(struct local_request **request, MPI_Status *status) {
+  struct local_request *r = *request;
+  if (status != MPI_STATUS_IGNORE) {
+    if (r->kind == LOCAL_REQ_RECV) {
+      *status = r->status;
+    } else {
+      status->MPI_ERROR = MPI_SUCCESS;
+    }
+  }
+  if (r->sched) {
+    return;       // Persistent: stays until MPI_Request_free.
+  }
+  struct local_request *last = live[--nlive];
+  live[r->index] = last;
+  last->index = r->index;
+  free(r);
+  *request = MPI_REQUEST_NULL;
+}
+
+// A persistent collective.  It is not in the live table: the application
+// keeps its handle across rollbacks, and so does the runtime.
+struct local_request *local_persistent(struct local_sched *sched) {
+  struct local_request *r = calloc(1, sizeof(*r));
+  r->kind  = LOCAL_REQ_COLL;
+  r->done  = 1;
+  r->index = -1;
+  r->sched = sched;
+  return r;
+}
+
+static int check_args(struct local_comm *c, int peer, int tag, int any_ok,
+                      const char *fn) {
+  if (!c) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_COMM, fn);
+  }
+  if (peer != MPI_PROC_NULL && !(any_ok && peer == MPI_ANY_SOURCE) &&
+      (peer < 0 || peer >= c->size)) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_RANK, fn);
+  }
+  if (tag < 0 && !(any_ok && tag == MPI_ANY_TAG)) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_TAG, fn);
+  }
+  return MPI_SUCCESS;
+}
+
+// ===========================================================================
+// Blocking helpers used by collectives.  Tags may be internal (negative).
+// ===========================================================================
+int local_send(const void *buf, size_t bytes, int dest, int tag,
+               struct local_comm *c) {
+  struct local_request *r = post_send(buf, bytes, dest, tag, c);
+  wait_done(r);
+  complete(&r, MPI_STATUS_IGNORE);
+  return MPI_SUCCESS;
+}
+
+int local_recv(void *buf, size_t bytes, int source, int tag,
+               struct local_comm *c, MPI_Status *status) {
+  MPI_Status st;
+  struct local_request *r = post_recv(buf, bytes, source, tag, c);
+  wait_done(r);
+  complete(&r, &st);
+  if (status != MPI_STATUS_IGNORE) {
+    *status = st;
+  }
+  return st.MPI_ERROR;
+}
+
+// ===========================================================================
+// MPI point-to-point
+// ===========================================================================
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+             int tag, MPI_Comm comm) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Send"));
+  }
+  int rc = check_args(c, dest, tag, 0, "MPI_Send");
+  if (rc == MPI_SUCCESS) {
+    rc = local_send(buf, (size_t) count * size, dest, tag, c);
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source,
+             int tag, MPI_Comm comm, MPI_Status *status) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Recv"));
+  }
+  int rc = check_args(c, source, tag, 1, "MPI_Recv");
+  if (rc == MPI_SUCCESS) {
+    rc = local_recv(buf, (size_t) count * size, source, tag, c, status);
+    if (rc != MPI_SUCCESS) {
+      local_error(comm, rc, "MPI_Recv");
+    }
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request *request) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Isend"));
+  }
+  int rc = check_args(c, dest, tag, 0, "MPI_Isend");
+  if (rc == MPI_SUCCESS) {
+    *request = post_send(buf, (size_t) count * size, dest, tag, c);
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request *request) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  size_t size = local_type_size(datatype);
+  if (!size) {
+    return LOCAL_EXIT(local_error(comm, MPI_ERR_TYPE, "MPI_Irecv"));
+  }
+  int rc = check_args(c, source, tag, 1, "MPI_Irecv");
+  if (rc == MPI_SUCCESS) {
+    *request = post_recv(buf, (size_t) count * size, source, tag, c);
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int source, int recvtag, MPI_Comm comm, MPI_Status *status) {
+  LOCAL_ENTER();
+  MPI_Request requests[2];
+  MPI_Status statuses[2];
+  MPI_Irecv(recvbuf, recvcount, recvtype, source, recvtag, comm,
+            &requests[0]);
+  MPI_Isend(sendbuf, sendcount, sendtype, dest, sendtag, comm, &requests[1]);
+  int rc = MPI_Waitall(2, requests, statuses);
+  if (status != MPI_STATUS_IGNORE) {
+    *status = statuses[0];
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+  LOCAL_ENTER();
+  local_check_fault();
+  if (*request == MPI_REQUEST_NULL) {
+    return LOCAL_EXIT(MPI_SUCCESS);
+  }
+  wait_done(*request);
+  int rc = (*request)->kind == LOCAL_REQ_RECV ?
+    (*request)->status.MPI_ERROR : MPI_SUCCESS;
+  complete(request, status);
+  if (rc != MPI_SUCCESS) {
+    local_error(MPI_COMM_WORLD, rc, "MPI_Wait");
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+  LOCAL_ENTER();
+  for (int i = 0; i < count; i++) {
+    MPI_Wait(&requests[i], statuses == MPI_STATUSES_IGNORE ?
+             MPI_STATUS_IGNORE : &statuses[i]);
+  }
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status) {
+  LOCAL_ENTER();
+  local_check_fault();
+  if (*request == MPI_REQUEST_NULL) {
+    *flag = 1;
+    return LOCAL_EXIT(MPI_SUCCESS);
+  }
+  local_progress();
+  *flag = (*request)->done;
+  if (*flag) {
+    complete(request, status);
+  }
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+// Persistent collectives run to completion in MPI_Start.
+int MPI_Start(MPI_Request *request) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_request *r = *request;
+  if (!r || !r->sched) {
+    return LOCAL_EXIT(local_error(MPI_COMM_WORLD, MPI_ERR_REQUEST,
+                                  "MPI_Start"));
+  }
+  r->done = 0;
+  running = r;
+  int rc = local_sched_run(r->sched);
+  finish(r);
+  if (rc != MPI_SUCCESS) {
+    local_error(MPI_COMM_WORLD, rc, "MPI_Start");
+  }
+  return LOCAL_EXIT(rc);
+}
+
+// Freeing an active persistent collective, which a cleanup handler can do
+// while MPI_Start was interrupted, frees it once it is no longer active.
+int MPI_Request_free(MPI_Request *request) {
+  struct local_request *r = *request;
+  if (!r || (!r->done && !r->sched)) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_REQUEST, "MPI_Request_free");
+  }
+  if (r->sched) {
+    r->freed = 1;
+    if (r->done) {
+      finish(r);
+    }
+    *request = MPI_REQUEST_NULL;
+  } else {
+    complete(request, MPI_STATUS_IGNORE);
+  }
+  return MPI_SUCCESS;
+}
+
+// Find an unexpected message matching a probe, without receiving it.
+static struct local_unexp *probe(struct local_comm *c, int source, int tag) {
+  struct local_request r = {
+    .context = c->context,
+    .peer    = source == MPI_ANY_SOURCE ? MPI_ANY_SOURCE : c->world[source],
+    .tag     = tag,
+  };
+  local_progress();
+  for (struct local_unexp *u = unexp; u; u = u->next) {
+    if (matches(&r, u->source, u->context, u->tag)) {
+      return u;
+    }
+  }
+  return NULL;
+}
+
+static int iprobe(struct local_comm *c, int source, int tag, int *flag,
+                  MPI_Status *status) {
+  // A probe is logged and replayed like a receive, but only takes a
+  // sequence number when it finds something.
+  long seq = -1;
+  if (source == MPI_ANY_SOURCE || tag == MPI_ANY_TAG) {
+    seq = local_replay_peek_seq();
+    local_replay_pin(seq, &source, &tag);
+  }
+
+  struct local_unexp *u = probe(c, source, tag);
+  *flag = u != NULL;
+  if (!u) {
+    return MPI_SUCCESS;
+  }
+  if (seq >= 0) {
+    local_replay_next_seq();
+    local_replay_record(seq, c->local[u->source], u->tag);
+  }
+  if (status != MPI_STATUS_IGNORE) {
+    status->MPI_SOURCE = c->local[u->source];
+    status->MPI_TAG    = u->tag;
+    status->MPI_ERROR  = MPI_SUCCESS;
+    status->bytes      = u->total;
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag,
+               MPI_Status *status) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  int rc = check_args(c, source, tag, 1, "MPI_Iprobe");
+  if (rc == MPI_SUCCESS) {
+    rc = iprobe(c, source, tag, flag, status);
+  }
+  return LOCAL_EXIT(rc);
+}
+
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_comm *c = local_comm_get(comm);
+  int rc = check_args(c, source, tag, 1, "MPI_Probe");
+  if (rc != MPI_SUCCESS) {
+    return LOCAL_EXIT(rc);
+  }
+  for (;;) {
+    uint32_t seen = local_doorbell();
+    int flag;
+    iprobe(c, source, tag, &flag, status);
+    if (flag) {
+      break;
+    }
+    local_sleep(seen);
+    local_check_fault();
+  }
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+int MPI_Get_count(const MPI_Status *status, MPI_Datatype datatype,
+                  int *count) {
+  size_t size = local_type_size(datatype);
+  if (!size) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_TYPE, "MPI_Get_count");
+  }
+  *count = status->bytes % size ? MPI_UNDEFINED : (int) (status->bytes / size);
+  return MPI_SUCCESS;
+}
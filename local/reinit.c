@@ -0,0 +1,531 @@
+// ===========================================================================
+// Resilience for the local runtime: MPI_Reinit, restart scopes, cleanup
+// handlers, fault notification and the recovery protocol.
+//
+// Recovery runs on every process at the point where it notices a fault:
+//
+// 1. All processes stop, publish their restart scopes and meet in the AGREE
+//    barrier.  Replacement processes join from MPI_Reinit.
+// 2. Each process computes the innermost scope every process can restart
+//    at, rolls back transactions, runs cleanup handlers and discards its
+//    communication state.
+// 3. All processes meet in the READY barrier and jump to the chosen scope.
+//
+// Both barriers are two-level, over simulated nodes of MPI_LOCAL_PPN ranks,
+// and the scope is agreed within each node before it is agreed between
+// nodes.  If another fault arrives part way through, recovery starts over.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "local.h"
+
+static MPI_Cleanup_handler *handlers;
+static void               **handler_states;
+static int                  nhandlers;
+static int                  handler_cap;
+static int                  ran_kept;   //!< Kept handlers ran this recovery.
+
+// ===========================================================================
+// Cleanup handlers
+// ===========================================================================
+int MPI_Cleanup_handler_push(const MPI_Cleanup_handler handler, void *state) {
+  if (nhandlers == handler_cap) {
+    handler_cap = handler_cap ? 2 * handler_cap : 16;
+    handlers = realloc(handlers, handler_cap * sizeof(*handlers));
+    handler_states = realloc(handler_states,
+                             handler_cap * sizeof(*handler_states));
+  }
+  handlers[nhandlers] = handler;
+  handler_states[nhandlers] = state;
+  nhandlers++;
+  local_trace(MPIX_EVENT_HANDLER_PUSH, nhandlers, 0);
+  return MPI_SUCCESS;
+}
+
+int MPI_Cleanup_handler_pop(MPI_Cleanup_handler *handler, void **state) {
+  if (!nhandlers) {
+    *handler = MPI_CLEANUP_HANDLER_NULL;
+    *state = NULL;
+    return MPI_SUCCESS;
+  }
+  nhandlers--;
+  *handler = handlers[nhandlers];
+  *state = handler_states[nhandlers];
+  local_trace(MPIX_EVENT_HANDLER_POP, nhandlers, 0);
+  return MPI_SUCCESS;
+}
+
+// Run handlers in LIFO order for a rollback to the given level.  Rolling
+// back to MPI_Reinit runs every handler but keeps those pushed before
+// MPI_Reinit registered; rolling back to a scope only runs its own.  Kept
+// handlers run at most once per recovery, even if recovery starts over.
+static void run_handlers(int target, MPI_Start_state start_state) {
+  int base = local.scopes[target].handler_base;
+  int last = target == 0 && !ran_kept ? 0 : base;
+  if (target == 0) {
+    ran_kept = 1;
+  }
+  local_inject_event(LOCAL_WHEN_CLEANUP);
+  for (int i = nhandlers - 1; i >= last; i--) {
+    MPI_Cleanup_handler handler = handlers[i];
+    void *state = handler_states[i];
+    if (i >= base) {
+      nhandlers = i;
+    }
+    if (handler(start_state, state) != MPI_CLEANUP_SUCCESS) {
+      fprintf(stderr, "mpi-local: rank %d: cleanup handler failed\n",
+              local.rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+}
+
+// ===========================================================================
+// Fault modes
+// ===========================================================================
+static void apply_mode(void) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigprocmask(local.mode == MPI_ASYNCHRONOUS_FAULTS ? SIG_UNBLOCK : SIG_BLOCK,
+              &set, NULL);
+}
+
+// Delivered by whoever disseminates a fault.  In asynchronous mode this
+// interrupts the application and starts recovery right here.
+static void on_fault_signal(int sig) {
+  if (local.in_mpi || !local.depth || !local_fault_pending()) {
+    return;
+  }
+  local_recover();
+}
+
+void local_fault_init(void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_fault_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+
+  local.mode = MPI_SYNCHRONOUS_FAULTS;
+  apply_mode();
+}
+
+int MPI_Get_fault_mode(MPI_Fault_mode *mode) {
+  *mode = local.mode;
+  return MPI_SUCCESS;
+}
+
+int MPI_Set_fault_mode(MPI_Fault_mode mode) {
+  if (mode != MPI_SYNCHRONOUS_FAULTS && mode != MPI_ASYNCHRONOUS_FAULTS) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Set_fault_mode");
+  }
+  local.mode = mode;
+  apply_mode();
+  local_trace(MPIX_EVENT_MODE, mode, 0);
+  return MPI_SUCCESS;
+}
+
+// ===========================================================================
+// Detection
+// ===========================================================================
+int local_fault_pending(void) {
+  return __atomic_load_n(&local.shm->fault_epoch, __ATOMIC_ACQUIRE) !=
+         local.epoch;
+}
+
+void local_check_fault(void) {
+  if (!local_fault_pending()) {
+    return;
+  }
+  local_trace(MPIX_EVENT_FAULT_FOUND, local.shm->fault_epoch, 0);
+  if (!local.depth) {
+    local_die("rank %d: fault outside of MPI_Reinit; cannot recover",
+              local.rank);
+  }
+  local_recover();
+}
+
+int MPI_Fault_probe(void) {
+  if (++local.calls >= local.inject_call) {
+    local_inject_call();
+  }
+  if (local_fault_pending()) {
+    local_check_fault();
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Fault(void) {
+  struct local_shared *shm = local.shm;
+  if (!local.depth) {
+    local_die("rank %d: MPI_Fault outside of MPI_Reinit", local.rank);
+  }
+
+  // If a newer fault is already pending, just join its recovery.
+  uint32_t expected = local.epoch;
+  if (__atomic_compare_exchange_n(&shm->fault_epoch, &expected,
+                                  expected + 1, 0, __ATOMIC_SEQ_CST,
+                                  __ATOMIC_SEQ_CST)) {
+    double now = MPI_Wtime();
+    shm->fail_time = shm->detect_time = now;
+    local_trace(MPIX_EVENT_FAULT_RAISED, expected + 1, 0);
+    local_notify(local.rank, now);
+  }
+  local_recover();
+}
+
+// ===========================================================================
+// Recovery
+// ===========================================================================
+
+// Recovery is two-level.  The ranks of a node meet in the node's shared
+// state; the leader of each node then meets the other leaders and releases
+// its node, so only one rank per node touches the job-wide state and the
+// outcome goes back to the rest through their own node.
+
+static struct local_node *node_of(int rank) {
+  struct local_node *nodes = local_at(local.shm->nodes);
+  return &nodes[rank / local.shm->ppn];
+}
+
+// Count an arrival at word for this epoch out of count.  Returns -1 if a
+// later epoch has begun, 1 if this was the last arrival, and 0 otherwise.
+static int arrive(uint64_t *word, uint32_t epoch, uint32_t count) {
+  uint64_t cur = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+  for (;;) {
+    uint32_t e = cur >> 32;
+    if (e > epoch) {
+      return -1;
+    }
+    uint64_t next = e < epoch ? ((uint64_t) epoch << 32) | 1 : cur + 1;
+    if (__atomic_compare_exchange_n(word, &cur, next, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+      return next == (((uint64_t) epoch << 32) | count);
+    }
+  }
+}
+
+// Wait until word holds value.  Returns nonzero if another fault arrived
+// in the meantime.
+static int await(uint64_t *word, uint64_t value, uint32_t epoch) {
+  for (;;) {
+    uint32_t seen = local_doorbell();
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == value) {
+      return 0;
+    }
+    if (__atomic_load_n(&local.shm->fault_epoch, __ATOMIC_SEQ_CST) != epoch) {
+      return 1;
+    }
+    local_sleep(seen);
+  }
+}
+
+// One past the last rank of the node that rank is on.
+static int node_end(int rank) {
+  struct local_shared *shm = local.shm;
+  int end = (rank / shm->ppn + 1) * shm->ppn;
+  return end < shm->size ? end : shm->size;
+}
+
+// The scopes of the leader's node: the least depth, and the key of each
+// level if every rank on the node has the same one.
+static void summarize_node(struct local_node *node, int leader) {
+  struct local_shared *shm = local.shm;
+  int end = node_end(leader);
+  uint32_t depth = LOCAL_MAX_SCOPES;
+  for (int r = leader; r < end; r++) {
+    if (shm->slots[r].state != LOCAL_SLOT_GONE &&
+        shm->slots[r].scope_depth < depth) {
+      depth = shm->slots[r].scope_depth;
+    }
+  }
+  for (uint32_t level = 0; level < depth; level++) {
+    uint64_t key = shm->slots[leader].scope_key[level];
+    for (int r = leader + 1; key && r < end; r++) {
+      if (shm->slots[r].state != LOCAL_SLOT_GONE &&
+          shm->slots[r].scope_key[level] != key) {
+        key = 0;
+      }
+    }
+    node->scope_key[level] = key;
+  }
+  node->scope_depth = depth;
+}
+
+// Every rank can only restart where all ranks agree.  Returns the innermost
+// level that is active, identical and valid on every process, from the
+// summaries of every node.
+static int agree_scope(void) {
+  struct local_shared *shm = local.shm;
+  struct local_node *nodes = local_at(shm->nodes);
+  struct local_node *first = NULL;
+  uint32_t depth = LOCAL_MAX_SCOPES;
+  for (int n = 0; n < shm->nnodes; n++) {
+    if (nodes[n].members && nodes[n].scope_depth < depth) {
+      depth = nodes[n].scope_depth;
+    }
+    if (nodes[n].members && !first) {
+      first = &nodes[n];
+    }
+  }
+
+  int target = 0;
+  for (uint32_t level = 1; level < depth; level++) {
+    uint64_t key = first->scope_key[level];
+    int same = key != 0;
+    for (int n = 0; same && n < shm->nnodes; n++) {
+      same = !nodes[n].members || nodes[n].scope_key[level] == key;
+    }
+    if (!same) {
+      break;
+    }
+    target = level;
+  }
+  return target;
+}
+
+// Wait for every rank to reach a recovery phase for this epoch.  Returns
+// nonzero if another fault arrived in the meantime.  After the AGREE phase,
+// the node holds the agreed scope.  Every rank leaves at about the same
+// moment, so the trace records arrival and departure for tools to align
+// the ranks' clocks.
+static int recovery_barrier(int phase, uint32_t epoch) {
+  struct local_shared *shm = local.shm;
+  uint64_t arrived = local_ticks();
+  struct local_node *node = node_of(local.rank);
+  int leader = node->leader;
+  int members = node->members;
+
+  int last = arrive(&node->barrier[phase], epoch, members);
+  if (last < 0) {
+    return 1;
+  }
+  if (local.rank != leader) {
+    if (last) {
+      local_ring(leader);
+    }
+    if (await(&node->release[phase], epoch, epoch)) {
+      return 1;
+    }
+    local_trace(MPIX_EVENT_BARRIER, phase, (int64_t) arrived);
+    return 0;
+  }
+
+  uint64_t full = ((uint64_t) epoch << 32) | (uint32_t) members;
+  if (await(&node->barrier[phase], full, epoch)) {
+    return 1;
+  }
+  if (phase == LOCAL_PHASE_AGREE) {
+    summarize_node(node, leader);
+  }
+  int live_nodes = shm->live_nodes;
+  last = arrive(&shm->barrier[phase], epoch, live_nodes);
+  if (last < 0) {
+    return 1;
+  }
+  if (last) {
+    struct local_node *nodes = local_at(shm->nodes);
+    for (int n = 0; n < shm->nnodes; n++) {
+      if (nodes[n].members) {
+        local_ring(nodes[n].leader);
+      }
+    }
+  }
+  full = ((uint64_t) epoch << 32) | (uint32_t) live_nodes;
+  if (await(&shm->barrier[phase], full, epoch)) {
+    return 1;
+  }
+  if (phase == LOCAL_PHASE_AGREE) {
+    node->target = agree_scope();
+  }
+  __atomic_store_n(&node->release[phase], epoch, __ATOMIC_SEQ_CST);
+  for (int r = leader + 1; r < node_end(leader); r++) {
+    local_ring(r);
+  }
+  local_trace(MPIX_EVENT_BARRIER, phase, (int64_t) arrived);
+  return 0;
+}
+
+// A process that has not rebuilt MPI_COMM_WORLD since the job was resized,
+// or has communicator records to release, can only restart at MPI_Reinit.
+static void publish_scopes(void) {
+  struct local_slot *me = &local.shm->slots[local.rank];
+  for (int level = 0; level < local.depth; level++) {
+    struct local_scope *s = &local.scopes[level];
+    me->scope_key[level] = s->valid ? s->serial + 1 : 0;
+  }
+  int resized = __atomic_load_n(&local.shm->resizes, __ATOMIC_SEQ_CST) !=
+                local.resizes ||
+                __atomic_load_n(&local.shm->memo_drops, __ATOMIC_SEQ_CST) !=
+                local.memo_drops;
+  __atomic_store_n(&me->scope_depth, resized ? 1 : local.depth,
+                   __ATOMIC_SEQ_CST);
+}
+
+static void check_restartable(void) {
+  struct local_shared *shm = local.shm;
+  for (int r = 0; r < shm->size; r++) {
+    uint32_t state = __atomic_load_n(&shm->slots[r].state, __ATOMIC_SEQ_CST);
+    if (state == LOCAL_SLOT_DONE || state == LOCAL_SLOT_FINALIZED) {
+      local_die("rank %d: fault after rank %d left MPI_Reinit; "
+                "cannot recover", local.rank, r);
+    }
+  }
+}
+
+void local_recover(void) {
+  struct local_shared *shm = local.shm;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+  local.in_mpi = 0;
+
+  MPI_Start_state start_state =
+    local.started     ? MPI_START_RESTARTED :
+    local.replacement ? MPI_START_ADDED : MPI_START_NEW;
+  local_trace(MPIX_EVENT_RECOVERY_BEGIN, shm->fault_epoch, start_state);
+  local_timing_begin(start_state);
+
+  int target = 0;
+  uint32_t resizes = local.resizes;
+  for (;;) {
+    uint32_t epoch = __atomic_load_n(&shm->fault_epoch, __ATOMIC_SEQ_CST);
+    local.epoch = epoch;
+    local.remap_base = __atomic_load_n(&shm->ran_resizes, __ATOMIC_SEQ_CST);
+    local_notify_node();
+    check_restartable();
+
+    publish_scopes();
+    int again = recovery_barrier(LOCAL_PHASE_AGREE, epoch);
+    local_timing_lap(MPIX_RECOVERY_AGREE);
+    if (again) {
+      continue;
+    }
+    target = node_of(local.rank)->target;
+    local_inject_event(LOCAL_WHEN_RECOVERY);
+
+    // Unwind everything above the target, newest first.  A process that
+    // has not entered its restart point yet has nothing to unwind.
+    if (start_state == MPI_START_RESTARTED) {
+      local_tx_rollback(local.scopes[target].tx_base);
+      run_handlers(target, start_state);
+    }
+    local_timing_lap(MPIX_RECOVERY_CLEANUP);
+    local.depth = target + 1;
+    if (target == 0) {
+      local_comm_reset();
+      local_win_reset();
+      local.scope_serial = 0;
+    } else {
+      local.scope_serial = local.scopes[target].serial;
+    }
+    local_p2p_reset();
+    local_timing_lap(MPIX_RECOVERY_REINIT);
+
+    again = recovery_barrier(LOCAL_PHASE_READY, epoch);
+    local_timing_lap(MPIX_RECOVERY_AGREE);
+    if (!again) {
+      break;
+    }
+  }
+
+  local_timing_end(local.epoch, target);
+  local_trace(MPIX_EVENT_RECOVERY_END, local.epoch, target);
+  local_trace_dump(local.rank, getpid(), LOCAL_DUMP_FAULT);
+  // Determinants name sources by their old ranks after a resize.
+  local_replay_recover(start_state == MPI_START_ADDED,
+                       local.resizes == resizes ?
+                       local.scopes[target].replay_seq : -1);
+  local.replacement = 0;
+  ran_kept = 0;
+  apply_mode();
+  siglongjmp(local.scopes[target].env, start_state + 1);
+}
+
+// ===========================================================================
+// Restart points
+// ===========================================================================
+int MPI_Reinit(int argc, char **argv, const MPI_Restart_point restart_point) {
+  if (local.depth) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_OTHER, "MPI_Reinit");
+  }
+  local.reinit_argc   = argc;
+  local.reinit_argv   = argv;
+  local.restart_point = restart_point;
+
+  struct local_scope *s = &local.scopes[0];
+  s->handler_base = nhandlers;
+  s->tx_base      = local_tx_depth();
+  s->serial       = 0;
+  s->valid        = 1;
+  s->replay_seq   = 0;
+  local.depth = 1;
+
+  MPI_Start_state start_state = MPI_START_NEW;
+  int jumped = sigsetjmp(s->env, 0);
+  if (jumped) {
+    start_state = (MPI_Start_state) (jumped - 1);
+    local_timing_reentered();
+    local_trace(MPIX_EVENT_RESTART, start_state, 0);
+  } else if (local.replacement || local_fault_pending()) {
+    local_recover();
+  }
+
+  struct local_slot *me = &local.shm->slots[local.rank];
+  __atomic_store_n(&local.shm->ran_resizes, local.resizes, __ATOMIC_SEQ_CST);
+  local.started = 1;
+  __atomic_store_n(&me->running, 1, __ATOMIC_SEQ_CST);
+  local.restart_point(local.reinit_argc, local.reinit_argv, start_state);
+  __atomic_store_n(&me->running, 0, __ATOMIC_SEQ_CST);
+
+  // Leave together, so that a fault anywhere before this still rolls back
+  // every process.
+  MPI_Barrier(MPI_COMM_WORLD);
+  local.depth = 0;
+  __atomic_store_n(&me->state, LOCAL_SLOT_DONE, __ATOMIC_SEQ_CST);
+  return MPI_SUCCESS;
+}
+
+int MPI_Restart_scope(const MPI_Scope_point scope_point, void *state) {
+  if (!local.depth) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_OTHER, "MPI_Restart_scope");
+  } else if (local.depth == LOCAL_MAX_SCOPES) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_NO_MEM, "MPI_Restart_scope");
+  }
+
+  int level = local.depth;
+  struct local_scope *s = &local.scopes[level];
+  s->scope_point  = scope_point;
+  s->state        = state;
+  s->handler_base = nhandlers;
+  s->tx_base      = local_tx_depth();
+  s->serial       = ++local.scope_serial;
+  s->valid        = 1;
+  s->replay_seq   = local_replay_peek_seq();
+  local.depth = level + 1;
+
+  MPI_Start_state start_state = MPI_START_NEW;
+  int jumped = sigsetjmp(s->env, 0);
+  if (jumped) {
+    start_state = (MPI_Start_state) (jumped - 1);
+    local_timing_reentered();
+    local_trace(MPIX_EVENT_RESTART, start_state, level);
+  }
+  s->scope_point(s->state, start_state);
+
+  local.depth = level;
+  return MPI_SUCCESS;
+}
+
+int MPI_Restart_scope_invalidate(void) {
+  if (local.depth > 1) {
+    local.scopes[local.depth - 1].valid = 0;
+  }
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,179 @@
+// ===========================================================================
+// Determinant logging and replay for the local runtime.
+//
+// Each wildcard receive or successful wildcard probe takes a sequence number
+// when it is posted.  When it matches, (source, tag, seq) is appended to the
+// process's log and written through to its replica in shared memory, which
+// stands for the copy held by the partner.  The replica is dropped if the
+// partner is lost, and rebuilt from the local log at the next recovery.
+// ===========================================================================
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+static MPI_Determinant *log_;
+static uint32_t         count;      //!< Determinants since the last mark.
+static uint32_t         cap;
+static int              overflow;   //!< Too many to replay this interval.
+static long             next_seq;   //!< Next receive sequence number.
+static long             replay_end; //!< Sequence numbers below this replay.
+static int32_t         *replay_index; //!< seq -> log index, or -1.
+static int              partner;
+
+static struct local_replica *replica(int rank) {
+  uint64_t *replicas = local_at(local.shm->replicas);
+  return local_at(replicas[rank]);
+}
+
+void local_replay_init(void) {
+  cap = local.shm->replay_cap;
+  log_ = malloc((cap ? cap : 1) * sizeof(MPI_Determinant));
+  count = 0;
+  overflow = 0;
+  next_seq = 0;
+  replay_end = 0;
+  replay_index = NULL;
+  partner = (local.rank + 1) % local.size;
+}
+
+// Called by the supervisor when a rank is lost.
+void local_replay_holder_lost(int holder) {
+  for (int r = 0; r < local.shm->size; r++) {
+    struct local_replica *rep = replica(r);
+    if (rep->holder == holder) {
+      __atomic_store_n(&rep->valid, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+}
+
+static void write_replica(void) {
+  struct local_replica *rep = replica(local.rank);
+  rep->holder = partner;
+  memcpy(rep->log, log_, count * sizeof(MPI_Determinant));
+  rep->overflow = overflow;
+  __atomic_store_n(&rep->count, count, __ATOMIC_RELEASE);
+  __atomic_store_n(&rep->valid, 1, __ATOMIC_RELEASE);
+}
+
+// Set up replay after a rollback that restarts receives at sequence seq.
+// A lost process first fetches its log from the replica.
+void local_replay_recover(int lost, long seq) {
+  if (lost) {
+    struct local_replica *rep = replica(local.rank);
+    if (__atomic_load_n(&rep->valid, __ATOMIC_ACQUIRE)) {
+      count = __atomic_load_n(&rep->count, __ATOMIC_ACQUIRE);
+      memcpy(log_, rep->log, count * sizeof(MPI_Determinant));
+      overflow = rep->overflow;
+    } else {
+      count = 0;
+      overflow = 1;
+    }
+  }
+
+  free(replay_index);
+  replay_index = NULL;
+  replay_end = 0;
+  if (seq < 0 || overflow) {
+    // The log can't reproduce this interval; stop logging until the next
+    // mark rather than record determinants that can never be used.
+    count = 0;
+    overflow = 1;
+    next_seq = 0;
+  } else {
+    next_seq = seq;
+    for (uint32_t i = 0; i < count; i++) {
+      if ((long) log_[i].seq + 1 > replay_end) {
+        replay_end = log_[i].seq + 1;
+      }
+    }
+    if (replay_end > next_seq) {
+      replay_index = malloc(replay_end * sizeof(int32_t));
+      memset(replay_index, 0xff, replay_end * sizeof(int32_t));
+      for (uint32_t i = 0; i < count; i++) {
+        replay_index[log_[i].seq] = i;
+      }
+    } else {
+      replay_end = 0;
+    }
+  }
+  write_replica();
+}
+
+long local_replay_next_seq(void) {
+  return next_seq++;
+}
+
+long local_replay_peek_seq(void) {
+  return next_seq;
+}
+
+// Force a wildcard receive to match as it did before the fault.
+int local_replay_pin(long seq, int *source, int *tag) {
+  if (seq >= replay_end || replay_index[seq] < 0) {
+    return 0;
+  }
+  MPI_Determinant *d = &log_[replay_index[seq]];
+  *source = d->source;
+  *tag = d->tag;
+  return 1;
+}
+
+void local_replay_record(long seq, int source, int tag) {
+  if (seq < replay_end && replay_index[seq] >= 0) {
+    return;       // Replayed; already in the log.
+  }
+  if (overflow) {
+    return;
+  }
+  struct local_replica *rep = replica(local.rank);
+  if (count == cap) {
+    overflow = 1;
+    rep->overflow = 1;
+    return;
+  }
+
+  MPI_Determinant d = { source, tag, (unsigned) seq };
+  log_[count] = d;
+  rep->log[count] = d;
+  count++;
+  __atomic_store_n(&rep->count, count, __ATOMIC_RELEASE);
+}
+
+// ===========================================================================
+// MPI interface
+// ===========================================================================
+int MPI_Replay_mark(void) {
+  int rc = overflow ? MPI_ERR_TRUNCATE : MPI_SUCCESS;
+  count = 0;
+  overflow = 0;
+  next_seq = 0;
+  replay_end = 0;
+  free(replay_index);
+  replay_index = NULL;
+
+  struct local_replica *rep = replica(local.rank);
+  rep->overflow = 0;
+  __atomic_store_n(&rep->count, 0, __ATOMIC_RELEASE);
+
+  // Scopes entered before the mark can no longer be replayed from their
+  // entry point.
+  for (int level = 1; level < local.depth; level++) {
+    local.scopes[level].replay_seq = -1;
+  }
+  return rc;
+}
+
+int MPI_Replay_set_partner(int rank) {
+  if (rank < 0 || rank >= local.size) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_RANK, "MPI_Replay_set_partner");
+  }
+  partner = rank;
+  write_replica();
+  return MPI_SUCCESS;
+}
+
+int MPI_Replay_active(int *flag) {
+  *flag = next_seq < replay_end;
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,220 @@
+// ===========================================================================
+// Recovery timing for the local runtime.
+//
+// Each recovery fills in one record per process.  Whoever causes or notices
+// a fault stamps the shared state with when it happened and when the
+// runtime noticed; from there each process charges the time between
+// successive points of the recovery protocol to the phase it was in.  The
+// last two phases end after the restart point is entered, so the current
+// record stays open until the first MPI call that follows.
+//
+// Lost work is counted per rank in the shared slots, from the steps and
+// checkpoint commits the application reports, so that the work of a killed
+// process is charged by its replacement.
+// ===========================================================================
+#include <stdio.h>
+#include <string.h>
+
+#include "local.h"
+
+#define LOCAL_MAX_RECORDS 256   //!< Recovery records kept per process.
+
+static MPIX_Recovery_record records[LOCAL_MAX_RECORDS];
+static unsigned long        nrecords;   //!< Recoveries so far.
+static double               totals[MPIX_RECOVERY_NUM_PHASES];
+static int                  recovering; //!< Between notice and re-entry.
+static int                  loaded;     //!< Checkpoint loaded since re-entry.
+static double               last;       //!< End of the last charged phase.
+static double               reentered;  //!< Restart point entered at.
+
+static MPIX_Recovery_record *current(void) {
+  return &records[(nrecords - 1) % LOCAL_MAX_RECORDS];
+}
+
+static void lose_work(double fault_time);
+
+static void charge(int phase, double seconds) {
+  if (seconds < 0) {
+    seconds = 0;
+  }
+  current()->phase[phase] += seconds;
+  totals[phase] += seconds;
+  local_trace(MPIX_EVENT_RECOVERY_PHASE, phase, (int64_t) (seconds * 1e6));
+}
+
+void local_timing_begin(int start_state) {
+  struct local_shared *shm = local.shm;
+  double now = MPI_Wtime();
+  if (recovering) {
+    // Recovery started over; keep charging the same record.
+    last = now;
+    return;
+  }
+  recovering = 1;
+  loaded = 0;
+  local.first_call = 0;
+  nrecords++;
+
+  MPIX_Recovery_record *rec = current();
+  memset(rec, 0, sizeof(*rec));
+  rec->start_state = start_state;
+  rec->fault_time = shm->fail_time;
+  lose_work(rec->fault_time);
+  double detect = shm->detect_time;
+  charge(MPIX_RECOVERY_DETECT, detect - rec->fault_time);
+
+  if (start_state == MPI_START_ADDED) {
+    double spawn = shm->slots[local.rank].spawn_time;
+    charge(MPIX_RECOVERY_DISSEMINATE, spawn - detect);
+    charge(MPIX_RECOVERY_REINIT, now - spawn);
+  } else {
+    charge(MPIX_RECOVERY_DISSEMINATE, now - detect);
+  }
+  last = now;
+}
+
+void local_timing_lap(int phase) {
+  double now = MPI_Wtime();
+  charge(phase, now - last);
+  last = now;
+}
+
+void local_timing_end(uint32_t epoch, int target) {
+  MPIX_Recovery_record *rec = current();
+  rec->epoch = epoch;
+  rec->target = target;
+}
+
+void local_timing_reentered(void) {
+  if (!recovering) {
+    return;
+  }
+  local_timing_lap(MPIX_RECOVERY_REINIT);
+  reentered = last;
+  recovering = 0;
+  local.first_call = 1;
+}
+
+void local_timing_first_call(void) {
+  local_timing_lap(MPIX_RECOVERY_FIRST_CALL);
+  local.first_call = 0;
+}
+
+int MPIX_Checkpoint_loaded(void) {
+  if (!nrecords || recovering || loaded) {
+    return MPI_SUCCESS;
+  }
+  // MPI calls made while loading the checkpoint are part of loading it.
+  MPIX_Recovery_record *rec = current();
+  totals[MPIX_RECOVERY_FIRST_CALL] -= rec->phase[MPIX_RECOVERY_FIRST_CALL];
+  rec->phase[MPIX_RECOVERY_FIRST_CALL] = 0;
+  last = reentered;
+  local_timing_lap(MPIX_RECOVERY_CHECKPOINT);
+  local_trace(MPIX_EVENT_CHECKPOINT_LOADED, -1, 0);
+  loaded = 1;
+  local.first_call = 1;
+  return MPI_SUCCESS;
+}
+
+int MPIX_Recovery_records(int max, MPIX_Recovery_record out[], int *count) {
+  unsigned long kept = nrecords < LOCAL_MAX_RECORDS ? nrecords
+                                                    : LOCAL_MAX_RECORDS;
+  unsigned long n = (unsigned long) max < kept ? (unsigned long) max : kept;
+  for (unsigned long i = 0; i < n; i++) {
+    out[i] = records[(nrecords - n + i) % LOCAL_MAX_RECORDS];
+  }
+  *count = (int) n;
+  return MPI_SUCCESS;
+}
+
+unsigned long local_timing_count(void) {
+  return nrecords;
+}
+
+double local_timing_total(int phase) {
+  return totals[phase];
+}
+
+// ===========================================================================
+// Lost work
+// ===========================================================================
+static struct local_work *work(void) {
+  return &local.shm->slots[local.rank].work;
+}
+
+// Charge the work since the last commit or rollback to a fault.  Until the
+// application reports a step again, the rank is recovering and has nothing
+// more to lose.  A rank that reported a step at or after the commit's is
+// inside it, and the part it did counts as one step; one that committed at
+// the end of a step and did not start the next has only whole steps.
+static void lose_work(double fault_time) {
+  struct local_work *w = work();
+  if (!w->from_time) {
+    return;
+  }
+  if (fault_time > w->from_time) {
+    w->lost_time += fault_time - w->from_time;
+  }
+  if (w->started && w->step >= w->from_step) {
+    w->lost_steps += w->step - w->from_step + 1;
+  }
+  w->faults++;
+  w->from_time = 0;
+  w->redoing = 0;
+}
+
+int MPIX_Work_step(long step) {
+  struct local_work *w = work();
+  double now = MPI_Wtime();
+  if (w->redoing) {
+    w->redo_time += now - w->step_time;
+  }
+  if (!w->from_time || step < w->step) {
+    w->from_time = now;
+    w->from_step = step;
+  }
+  w->redoing = w->started && step < w->high;
+  w->redo_steps += w->redoing;
+  w->high = !w->started || step > w->high ? step : w->high;
+  w->step = step;
+  w->step_time = now;
+  w->started = 1;
+  return MPI_SUCCESS;
+}
+
+int MPIX_Work_committed(long step) {
+  struct local_work *w = work();
+  w->from_time = MPI_Wtime();
+  w->from_step = step;
+  return MPI_SUCCESS;
+}
+
+// Print the totals over all ranks on stderr, if any work was lost.  Times
+// and steps are summed over ranks; recoveries is the most any rank took
+// part in.  Called by the supervisor once every rank has finished.
+void local_work_summary(void) {
+  struct local_shared *shm = local.shm;
+  struct local_work total = { 0 };
+  int worst = 0;
+  for (int r = 0; r < shm->size; r++) {
+    struct local_work *w = &shm->slots[r].work;
+    total.faults     = w->faults > total.faults ? w->faults : total.faults;
+    total.lost_time  += w->lost_time;
+    total.lost_steps += w->lost_steps;
+    total.redo_time  += w->redo_time;
+    total.redo_steps += w->redo_steps;
+    if (w->lost_time > shm->slots[worst].work.lost_time) {
+      worst = r;
+    }
+  }
+  if (!total.faults) {
+    return;
+  }
+  fprintf(stderr, "mpi-local: lost work: recoveries=%llu lost_time=%.3f "
+          "lost_steps=%llu worst_rank=%d worst_time=%.3f redo_time=%.3f "
+          "redo_steps=%llu\n",
+          (unsigned long long) total.faults, total.lost_time,
+          (unsigned long long) total.lost_steps, worst,
+          shm->slots[worst].work.lost_time, total.redo_time,
+          (unsigned long long) total.redo_steps);
+}
@@ -0,0 +1,119 @@
+// ===========================================================================
+// Event tracing for the local runtime.
+//
+// Recording an event is a few stores into the rank's ring; nothing is
+// written out until a fault or an abort, when the events since the last
+// dump are appended to a file per rank (see trace.h).  Rings live in the
+// shared mapping, so the supervisor can still dump the ring of a process
+// that was killed, which is the one a postmortem needs most.
+// ===========================================================================
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "local.h"
+
+// Allocate a ring per rank.  Called once by the supervisor, before forking.
+// MPI_LOCAL_TRACE_EVENTS=0 turns recording off.
+void local_trace_setup(void) {
+  struct local_shared *shm = local.shm;
+  const char *env = getenv("MPI_LOCAL_TRACE_EVENTS");
+  long want = env && *env ? atol(env) : 4096;
+  if (want <= 0) {
+    return;
+  }
+  uint64_t cap = 16;
+  while (cap < (uint64_t) want) {
+    cap *= 2;
+  }
+  shm->trace_cap   = cap;
+  shm->trace_ticks = local_ticks();
+  shm->trace_time  = MPI_Wtime();
+
+  uint64_t *rings = local_heap_alloc(shm->size * sizeof(uint64_t));
+  for (int r = 0; r < shm->size; r++) {
+    struct local_trace *t = local_heap_alloc(
+      sizeof(struct local_trace) + cap * sizeof(struct local_event));
+    t->mask = cap - 1;
+    rings[r] = local_offset(t);
+  }
+  shm->traces = local_offset(rings);
+}
+
+static struct local_trace *ring(int rank) {
+  if (!local.shm->traces) {
+    return NULL;
+  }
+  uint64_t *rings = local_at(local.shm->traces);
+  return local_at(rings[rank]);
+}
+
+void local_trace_init(void) {
+  local.trace = ring(local.rank);
+}
+
+// Append the events of a rank recorded since its last dump to its file.
+// Only call this from the rank's own process, or once the process (pid) is
+// gone.
+void local_trace_dump(int rank, pid_t pid, int reason) {
+  struct local_shared *shm = local.shm;
+  const char *dir = getenv("MPI_LOCAL_TRACE_DIR");
+  struct local_trace *t = ring(rank);
+  if (!t || !dir || !*dir) {
+    return;
+  }
+  uint64_t head = t->head;
+  uint64_t from = t->dumped;
+  uint64_t dropped = 0;
+  if (head - from > shm->trace_cap) {
+    dropped = head - from - shm->trace_cap;
+    from = head - shm->trace_cap;
+  }
+  t->dumped = head;
+
+  struct local_trace_header h = {
+    .magic   = LOCAL_TRACE_MAGIC,
+    .reason  = reason,
+    .rank    = rank,
+    .pid     = pid,
+    .count   = head - from,
+    .dropped = dropped,
+    .ticks   = local_ticks(),
+    .time    = MPI_Wtime(),
+  };
+  double elapsed = h.time - shm->trace_time;
+  h.ticks_per_sec = elapsed > 0 ? (h.ticks - shm->trace_ticks) / elapsed
+                                : 1e9;
+
+  // Oldest first: the ring may wrap once.
+  uint64_t mask = shm->trace_cap - 1;
+  uint64_t first = from & mask;
+  uint64_t n1 = h.count < shm->trace_cap - first ? h.count
+                                                 : shm->trace_cap - first;
+  struct iovec iov[3] = {
+    { &h, sizeof(h) },
+    { &t->events[first], n1 * sizeof(struct local_event) },
+    { t->events, (h.count - n1) * sizeof(struct local_event) },
+  };
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/trace.%d", dir, rank);
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    perror(path);
+    return;
+  }
+  if (writev(fd, iov, 3) < 0) {
+    perror(path);
+  }
+  close(fd);
+}
+
+int MPIX_Trace_event(int event, long a, long b) {
+  local_trace(event, a, b);
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,51 @@
+// ===========================================================================
+// Format of the event traces written by the local runtime.
+//
+// Each rank records events in a ring in the shared mapping.  When a fault
+// or an abort happens, the events recorded since the last dump are appended
+// to <MPI_LOCAL_TRACE_DIR>/trace.<rank> as one block: a header, then count
+// records, oldest first.  Blocks of a rank's file may come from different
+// processes, since replacements keep their rank.
+//
+// Timestamps are raw ticks of the fastest clock available, to keep
+// recording cheap.  The header pairs the tick count at the dump with
+// MPI_Wtime, so a record's time is
+//
+//   header.time - (header.ticks - record.ticks) / header.ticks_per_sec
+// ===========================================================================
+#ifndef MPI_LOCAL_TRACE_H
+#define MPI_LOCAL_TRACE_H
+
+#include <stdint.h>
+
+#define LOCAL_TRACE_MAGIC 0x6c747263   //!< "ltrc"
+
+//! Why a block was dumped.
+enum {
+  LOCAL_DUMP_FAULT,     //!< The rank entered recovery.
+  LOCAL_DUMP_LOST,      //!< The rank's process was lost.
+  LOCAL_DUMP_ABORT,     //!< The job aborted.
+};
+
+//! One event, as recorded.
+struct local_event {
+  uint64_t ticks;
+  uint32_t type;        //!< MPIX_EVENT_*
+  uint32_t epoch;       //!< Last fault epoch the process recovered from.
+  int64_t  a, b;
+};
+
+//! Head of one dumped block.
+struct local_trace_header {
+  uint32_t magic;
+  uint32_t reason;      //!< LOCAL_DUMP_*
+  int32_t  rank;
+  int32_t  pid;         //!< Process that recorded the events.
+  uint64_t count;       //!< Records that follow.
+  uint64_t dropped;     //!< Records overwritten before they were dumped.
+  uint64_t ticks;       //!< Tick count at the dump,
+  double   time;        //!< and MPI_Wtime at the same moment.
+  double   ticks_per_sec;
+};
+
+#endif // MPI_LOCAL_TRACE_H
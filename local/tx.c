@@ -0,0 +1,199 @@
+// ===========================================================================
+// Transactional regions for the local runtime.
+//
+// The undo log is an append-only arena of entries, each holding the old
+// contents of one range.  Nested transactions just remember where the log
+// ended when they began.  The arena is built from mmap'd chunks so that the
+// SIGSEGV handler used for page-protection capture can append to it.
+// ===========================================================================
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "local.h"
+
+#define LOCAL_MAX_TX        64      //!< Max nesting of transactions.
+#define LOCAL_MAX_TX_RANGES 64      //!< Max ranges registered at once.
+#define LOCAL_TX_CHUNK      (1 << 20)
+
+struct tx_entry {
+  struct tx_entry *prev;
+  char            *addr;
+  size_t           len;
+  char             data[] __attribute__((aligned(16)));
+};
+
+struct tx_chunk {
+  struct tx_chunk *prev;
+  size_t           size;
+  size_t           used;
+  char             data[] __attribute__((aligned(16)));
+};
+
+struct tx_range {
+  char  *base;
+  size_t size;
+};
+
+static struct tx_chunk *chunk;
+static struct tx_entry *last;
+static struct tx_entry *marks[LOCAL_MAX_TX];
+static int              depth;
+static struct tx_range  ranges[LOCAL_MAX_TX_RANGES];
+static int              nranges;
+static size_t           page_size;
+
+// Append an entry saving [addr, addr + len).  Safe in a signal handler.
+static void log_range(void *addr, size_t len) {
+  size_t need = (sizeof(struct tx_entry) + len + 15) & ~(size_t) 15;
+  if (!chunk || chunk->size - chunk->used < need) {
+    size_t size = need + sizeof(struct tx_chunk) > LOCAL_TX_CHUNK ?
+      need + sizeof(struct tx_chunk) : LOCAL_TX_CHUNK;
+    struct tx_chunk *c = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) {
+      static const char msg[] = "mpi-local: out of memory for undo log\n";
+      write(2, msg, sizeof(msg) - 1);
+      _exit(1);
+    }
+    c->prev = chunk;
+    c->size = size - sizeof(struct tx_chunk);
+    c->used = 0;
+    chunk = c;
+  }
+
+  struct tx_entry *e = (struct tx_entry*) (chunk->data + chunk->used);
+  chunk->used += need;
+  e->prev = last;
+  e->addr = addr;
+  e->len  = len;
+  memcpy(e->data, addr, len);
+  last = e;
+}
+
+static void free_log(void) {
+  while (chunk) {
+    struct tx_chunk *prev = chunk->prev;
+    munmap(chunk, chunk->size + sizeof(struct tx_chunk));
+    chunk = prev;
+  }
+  last = NULL;
+}
+
+static void protect(int prot) {
+  for (int i = 0; i < nranges; i++) {
+    mprotect(ranges[i].base, ranges[i].size, prot);
+  }
+}
+
+// First write to a protected page in a transaction: log it and let the
+// write go through.  Anything else is a real segfault.
+static void on_segv(int sig, siginfo_t *info, void *context) {
+  char *addr = info->si_addr;
+  if (depth) {
+    for (int i = 0; i < nranges; i++) {
+      if (addr >= ranges[i].base && addr < ranges[i].base + ranges[i].size) {
+        char *page = (char*) ((uintptr_t) addr & ~(uintptr_t) (page_size - 1));
+        mprotect(page, page_size, PROT_READ | PROT_WRITE);
+        log_range(page, page_size);
+        return;
+      }
+    }
+  }
+  signal(SIGSEGV, SIG_DFL);
+}
+
+void local_tx_init(void) {
+  page_size = sysconf(_SC_PAGESIZE);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_segv;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, NULL);
+}
+
+int local_tx_depth(void) {
+  return depth;
+}
+
+// Roll back every transaction begun at nesting level base or deeper.
+void local_tx_rollback(int base) {
+  if (depth <= base) {
+    return;
+  }
+  local_trace(MPIX_EVENT_TX_ROLLBACK, depth - base, 0);
+  protect(PROT_READ | PROT_WRITE);
+  struct tx_entry *stop = marks[base];
+  while (last != stop) {
+    memcpy(last->addr, last->data, last->len);
+    last = last->prev;
+  }
+  depth = base;
+  if (depth) {
+    protect(PROT_READ);
+  } else {
+    free_log();
+  }
+}
+
+int MPI_Tx_begin(void) {
+  if (depth == LOCAL_MAX_TX) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_NO_MEM, "MPI_Tx_begin");
+  }
+  marks[depth++] = last;
+
+  // Protect everything again, so that pages written before this point are
+  // logged afresh for the new transaction.
+  protect(PROT_READ);
+  return MPI_SUCCESS;
+}
+
+int MPI_Tx_commit(void) {
+  if (!depth) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_OTHER, "MPI_Tx_commit");
+  }
+  if (--depth == 0) {
+    protect(PROT_READ | PROT_WRITE);
+    free_log();
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Tx_log(void *base, MPI_Aint size) {
+  if (depth && size > 0) {
+    log_range(base, size);
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Tx_register(void *base, MPI_Aint size) {
+  if (((uintptr_t) base | (uintptr_t) size) & (page_size - 1) || size <= 0) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Tx_register");
+  } else if (nranges == LOCAL_MAX_TX_RANGES) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_NO_MEM, "MPI_Tx_register");
+  }
+  ranges[nranges].base = base;
+  ranges[nranges].size = size;
+  nranges++;
+  if (depth) {
+    mprotect(base, size, PROT_READ);
+  }
+  return MPI_SUCCESS;
+}
+
+int MPI_Tx_unregister(void *base) {
+  if (depth) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_OTHER, "MPI_Tx_unregister");
+  }
+  for (int i = 0; i < nranges; i++) {
+    if (ranges[i].base == base) {
+      ranges[i] = ranges[--nranges];
+      return MPI_SUCCESS;
+    }
+  }
+  return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Tx_unregister");
+}
@@ -0,0 +1,284 @@
+// ===========================================================================
+// One-sided communication for the local runtime.
+//
+// A window is a duplicate of its communicator plus one piece of the shared
+// heap per member.  Each rank records where its piece is in its slot, named
+// by the context of the duplicate, and puts and gets copy straight to or
+// from the target's piece.  A rollback to MPI_Reinit drops windows along
+// with derived communicators, but the memory and the records stay: when the
+// application allocates the window again, the duplicate is rebuilt from its
+// record, and so is the window, on survivors and replacements alike, with
+// no communication and the contents as they were.
+// ===========================================================================
+#include <stdlib.h>
+#include <string.h>
+
+#include "local.h"
+
+struct local_win {
+  MPI_Comm              comm;       //!< Duplicate; MPI_COMM_NULL if free.
+  int                   record;
+  int                   context;
+  int                   disp_unit;
+  struct local_winrec **targets;    //!< By comm rank, found on first use.
+};
+
+static struct local_win wins[LOCAL_MAX_WINS];
+static int              live[LOCAL_MAX_WINS];  //!< Records of open windows.
+static int              initialized;
+static uint32_t         resizes;      //!< Resizes the records were made in.
+
+static struct local_winrec *records(int rank) {
+  struct local_winrec *table = local_at(local.shm->win_table);
+  return table + (size_t) rank * LOCAL_MAX_WINS;
+}
+
+static void init(void) {
+  for (int i = 0; i < LOCAL_MAX_WINS; i++) {
+    wins[i].comm = MPI_COMM_NULL;
+  }
+  resizes = local.resizes;
+  initialized = 1;
+}
+
+static struct local_win *win_get(MPI_Win win) {
+  if (!initialized || win < 0 || win >= LOCAL_MAX_WINS ||
+      wins[win].comm == MPI_COMM_NULL) {
+    return NULL;
+  }
+  return &wins[win];
+}
+
+// The record of rank with the given context, or NULL.
+static struct local_winrec *find(int rank, int context) {
+  struct local_winrec *table = records(rank);
+  uint32_t count = __atomic_load_n(&local.shm->slots[rank].wins,
+                                   __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < count; i++) {
+    if (__atomic_load_n(&table[i].context, __ATOMIC_ACQUIRE) == context) {
+      return &table[i];
+    }
+  }
+  return NULL;
+}
+
+// A record slot for a new window: a fresh one, or one whose window is
+// closed, preferring those that could not be reused anyway.
+static int new_record(void) {
+  struct local_slot *slot = &local.shm->slots[local.rank];
+  if (slot->wins < LOCAL_MAX_WINS) {
+    return slot->wins;
+  }
+  int pick = -1;
+  for (int i = 0; i < LOCAL_MAX_WINS; i++) {
+    if (!live[i] && (pick < 0 || !records(local.rank)[i].valid)) {
+      pick = i;
+    }
+  }
+  return pick;
+}
+
+// Drop all windows.  Called when rolling back to MPI_Reinit, after the
+// communicators, and decides which records may be reused the same way:
+// those every member of a reusable communicator made, unless the job was
+// resized or the communicator's record was released since.  New contexts
+// stay clear of the recorded ones, which still name windows to other
+// ranks.
+void local_win_reset(void) {
+  if (!initialized) {
+    init();
+  }
+  for (int i = 0; i < LOCAL_MAX_WINS; i++) {
+    free(wins[i].targets);
+    wins[i].targets = NULL;
+    wins[i].comm = MPI_COMM_NULL;
+    live[i] = 0;
+  }
+
+  struct local_winrec *table = records(local.rank);
+  uint32_t count = local.shm->slots[local.rank].wins;
+  for (uint32_t i = 0; i < count; i++) {
+    struct local_winrec *w = &table[i];
+    if (resizes != local.resizes) {
+      w->comm = -1;
+    }
+    int valid = w->comm >= 0 && local_comm_memo(w->comm)->valid &&
+                local_comm_memo(w->comm)->context == w->context;
+    if (valid) {
+      struct local_memo *m = local_comm_memo(w->comm);
+      int *members = local_at(m->world);
+      for (int r = 0; valid && r < m->size; r++) {
+        valid = find(members[r], w->context) != NULL;
+      }
+    }
+    w->valid = valid;
+    if (w->context >= local.next_context) {
+      local.next_context = w->context + 1;
+    }
+  }
+  resizes = local.resizes;
+}
+
+int MPI_Win_allocate(MPI_Aint size, int disp_unit, void *info, MPI_Comm comm,
+                     void *baseptr, MPI_Win *win) {
+  if (!initialized) {
+    init();
+  }
+  if (size < 0 || disp_unit <= 0) {
+    return local_error(comm, MPI_ERR_ARG, "MPI_Win_allocate");
+  }
+  MPI_Win handle = MPI_WIN_NULL;
+  for (int i = 0; i < LOCAL_MAX_WINS && handle == MPI_WIN_NULL; i++) {
+    if (wins[i].comm == MPI_COMM_NULL) {
+      handle = i;
+    }
+  }
+  if (handle == MPI_WIN_NULL) {
+    return local_error(comm, MPI_ERR_NO_MEM, "MPI_Win_allocate");
+  }
+
+  MPI_Comm dup;
+  int rc = MPI_Comm_dup(comm, &dup);
+  if (rc != MPI_SUCCESS) {
+    return rc;
+  }
+  struct local_comm *c = local_comm_get(dup);
+
+  // The duplicate came from a record: so did the window, everywhere.
+  struct local_winrec *table = records(local.rank);
+  uint32_t count = local.shm->slots[local.rank].wins;
+  int index = -1;
+  for (uint32_t i = 0; c->memo >= 0 && i < count; i++) {
+    if (table[i].valid && table[i].comm == c->memo && !live[i]) {
+      index = i;
+    }
+  }
+  // Other arguments than recorded are handled like those of a communicator:
+  // the records go in one more rollback.
+  if (index >= 0 && (table[index].size != (uint64_t) size ||
+                     table[index].disp_unit != disp_unit)) {
+    local_comm_memo_mismatch();
+  }
+  if (index < 0) {
+    index = new_record();
+    if (index < 0) {
+      MPI_Comm_free(&dup);
+      return local_error(comm, MPI_ERR_NO_MEM, "MPI_Win_allocate");
+    }
+
+    // Keep the memory of a closed window if it is big enough.
+    struct local_winrec *w = &table[index];
+    int reuse = index < (int) count && w->size >= (uint64_t) size;
+    __atomic_store_n(&w->context, -1, __ATOMIC_RELEASE);
+    if (!reuse) {
+      w->base = local_offset(local_heap_alloc(size ? size : 1));
+    }
+    w->comm      = c->memo;
+    w->disp_unit = disp_unit;
+    w->size      = size;
+    w->valid     = 0;
+    __atomic_store_n(&w->context, c->context, __ATOMIC_RELEASE);
+    if (index == (int) count) {
+      __atomic_store_n(&local.shm->slots[local.rank].wins, count + 1,
+                       __ATOMIC_RELEASE);
+    }
+    MPI_Barrier(dup);   // Every piece is recorded before anyone uses it.
+  }
+
+  live[index] = 1;
+  wins[handle].comm      = dup;
+  wins[handle].record    = index;
+  wins[handle].context   = c->context;
+  wins[handle].disp_unit = disp_unit;
+  wins[handle].targets   = calloc(c->size, sizeof(struct local_winrec *));
+  *(void**) baseptr = local_at(table[index].base);
+  *win = handle;
+  return MPI_SUCCESS;
+}
+
+int MPI_Win_free(MPI_Win *win) {
+  struct local_win *w = win_get(*win);
+  if (!w) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Win_free");
+  }
+  MPI_Barrier(w->comm);
+  MPI_Comm_free(&w->comm);
+  live[w->record] = 0;
+  free(w->targets);
+  w->targets = NULL;
+  *win = MPI_WIN_NULL;
+  return MPI_SUCCESS;
+}
+
+int MPI_Win_fence(int assert, MPI_Win win) {
+  struct local_win *w = win_get(win);
+  if (!w) {
+    return local_error(MPI_COMM_WORLD, MPI_ERR_ARG, "MPI_Win_fence");
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return MPI_Barrier(w->comm);
+}
+
+// Address of bytes at target_disp in target's piece, or NULL.
+static char *target_addr(struct local_win *w, int target, MPI_Aint disp,
+                         size_t bytes) {
+  struct local_comm *c = local_comm_get(w->comm);
+  if (target < 0 || target >= c->size || disp < 0) {
+    return NULL;
+  }
+  if (!w->targets[target]) {
+    w->targets[target] = find(c->world[target], w->context);
+  }
+  struct local_winrec *rec = w->targets[target];
+  size_t offset = (size_t) disp * w->disp_unit;
+  if (!rec || offset > rec->size || bytes > rec->size - offset) {
+    return NULL;
+  }
+  return (char*) local_at(rec->base) + offset;
+}
+
+static int rma(const char *fn, int put, void *origin, int origin_count,
+               MPI_Datatype origin_type, int target, MPI_Aint target_disp,
+               int target_count, MPI_Datatype target_type, MPI_Win win) {
+  LOCAL_ENTER();
+  local_check_fault();
+  struct local_win *w = win_get(win);
+  if (!w) {
+    return LOCAL_EXIT(local_error(MPI_COMM_WORLD, MPI_ERR_ARG, fn));
+  }
+  size_t bytes = (size_t) origin_count * local_type_size(origin_type);
+  if (!local_type_size(origin_type) || origin_count < 0 ||
+      bytes != (size_t) target_count * local_type_size(target_type)) {
+    return LOCAL_EXIT(local_error(w->comm, MPI_ERR_TYPE, fn));
+  }
+  if (target == MPI_PROC_NULL) {
+    return LOCAL_EXIT(MPI_SUCCESS);
+  }
+  char *addr = target_addr(w, target, target_disp, bytes);
+  if (!addr) {
+    return LOCAL_EXIT(local_error(w->comm, MPI_ERR_ARG, fn));
+  }
+  if (put) {
+    memcpy(addr, origin, bytes);
+  } else {
+    memcpy(origin, addr, bytes);
+  }
+  return LOCAL_EXIT(MPI_SUCCESS);
+}
+
+int MPI_Put(const void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win) {
+  return rma("MPI_Put", 1, (void*) origin_addr, origin_count,
+             origin_datatype, target_rank, target_disp, target_count,
+             target_datatype, win);
+}
+
+int MPI_Get(void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win) {
+  return rma("MPI_Get", 0, origin_addr, origin_count, origin_datatype,
+             target_rank, target_disp, target_count, target_datatype, win);
+}
@@ -32,12 +32,21 @@ typedef enum {
  *
  * Some guarantees on rank order:
  *
- * 1. If the size of MPI_COMM_WORLD is the SAME or larger than it was before a
- *    fault, then ranks of restarted processes will be the same as before the
+ * 1. If the size of MPI_COMM_WORLD is the SAME as it was before a fault,
+ *    then ranks of restarted processes will be the same as before the
  *    fault, and added processes' ranks will be the same as those that failed.
  *
  * 2. If the size of MPI_COMM_WORLD is smaller than it was before a fault,
- *    then there are no guarantees on rank order.
+ *    then the processes that are left keep their order: a process's new rank
+ *    is the number of processes left that had lower ranks before the fault.
+ *    MPI_Reinit_remap gives the new rank of every old one.
+ *
+ * 3. If the size of MPI_COMM_WORLD is larger than it was before, because
+ *    capacity came back after the job shrank, the processes that were there
+ *    still keep their order, and added processes take the places their
+ *    ranks had before the job shrank.  MPI_Reinit_remap gives the new rank
+ *    of every old one; the ranks it does not give belong to the added
+ *    processes, which start with MPI_START_ADDED and hold no data yet.
  *
  */
 typedef void (*MPI_Restart_point)(int argc, char **argv,
@@ -57,6 +66,148 @@ typedef void (*MPI_Restart_point)(int argc, char **argv,
 int MPI_Reinit(int argc, char **argv,
                const MPI_Restart_point restart_point);
 
+/*!
+ * Where the ranks of MPI_COMM_WORLD went.  After a restart at a different
+ * size, map[r] is the rank now of the process that had rank r when the
+ * restart point was last entered, or MPI_UNDEFINED if that process was lost
+ * and not replaced.  Otherwise the map is the identity.  Applications use it
+ * as a plan to rebalance: to hand the data of lost ranks to the ones that
+ * are left, or to move data onto the ranks that were added.
+ *
+ * @param[in]  max       Number of entries map can hold; 0 to only get
+ *                       old_size.
+ * @param[out] map       New rank of each old rank, for the first max.
+ * @param[out] old_size  Size of MPI_COMM_WORLD before the fault.
+ */
+int MPI_Reinit_remap(int max, int map[], int *old_size);
+
+
+// ===========================================================================
+// Nested restart scopes
+// ===========================================================================
+
+/*!
+ * Function pointer type for the body of a restart scope.  An MPI_Scope_point
+ * is called by MPI_Restart_scope to enter the scope, and called again each
+ * time a fault is handled by rolling back to this scope.
+ *
+ * @param[inout] state        User state passed to MPI_Restart_scope.
+ * @param[in]    start_state  MPI_START_NEW on first entry, and
+ *                            MPI_START_RESTARTED on re-entry after a fault.
+ */
+typedef void (*MPI_Scope_point)(void *state, MPI_Start_state start_state);
+
+/*!
+ * MPI_Restart_scope runs scope_point as a nested restart point inside the
+ * restart point passed to MPI_Reinit, e.g. around one solver phase of a time
+ * step.  Scopes can be nested to any depth, and like MPI_Reinit they give the
+ * implementation a valid spot on the stack to unwind to.
+ *
+ * When a fault occurs, it is handled at the innermost scope that is still
+ * consistent, instead of always at MPI_Reinit.  A scope is consistent if:
+ *
+ * 1. Every process in MPI_COMM_WORLD is inside the same dynamic instance of
+ *    the scope.  Scopes are therefore entered collectively, in the same
+ *    order, by all processes in MPI_COMM_WORLD.
+ *
+ * 2. No process has called MPI_Restart_scope_invalidate() for it.
+ *
+ * 3. No process was lost.  A process added to replace a failed one has no
+ *    scopes, so a fault that loses a process always rolls back to MPI_Reinit.
+ *
+ * Rolling back to a scope runs the cleanup handlers pushed inside that scope
+ * in LIFO order, and leaves handlers pushed before it on the stack.  The
+ * scope point is then re-entered with MPI_START_RESTARTED, and it is up to
+ * the application to restore whatever state the scope modified.  Receives
+ * inside the re-entered scope replay the determinants logged since the scope
+ * was entered (see MPI_Replay_mark).
+ *
+ * MPI_Restart_scope returns when scope_point returns normally.
+ *
+ * @param[in]    scope_point  Entry point for the scope.
+ * @param[inout] state        Passed through to scope_point.
+ */
+int MPI_Restart_scope(const MPI_Scope_point scope_point, void *state);
+
+/*!
+ * Mark the innermost active restart scope on this process as inconsistent,
+ * e.g. once it has overwritten the inputs it would need to run again.
+ * Faults after this call are handled by the next enclosing scope, or by
+ * MPI_Reinit if there is none.  The mark lasts until the scope returns.
+ */
+int MPI_Restart_scope_invalidate();
+
+
+// ===========================================================================
+// Transactional regions
+// ===========================================================================
+
+/*!
+ * Begin a transactional region.  Inside a transaction, the implementation
+ * keeps an undo log of the old contents of memory the process modifies, and
+ * if a fault occurs before the matching MPI_Tx_commit, it writes the logged
+ * bytes back in reverse order before any cleanup handlers run.  Memory then
+ * looks exactly as it did at MPI_Tx_begin, so short critical phases such as
+ * particle migration or mesh adaptation can be rolled back without reloading
+ * a checkpoint.
+ *
+ * Writes are captured in two ways:
+ *
+ * 1. Explicit annotation: call MPI_Tx_log on a range before modifying it.
+ *
+ * 2. Page protection: ranges registered with MPI_Tx_register are write
+ *    protected while a transaction is open, and the first write to each page
+ *    logs the whole page automatically.
+ *
+ * Transactions nest.  Committing an inner transaction merges its undo log
+ * into the enclosing one; only the outermost commit discards the log.  A
+ * fault rolls back the transactions begun inside the restart scope that
+ * handles it (or all of them if it is handled by MPI_Reinit); transactions
+ * that enclose that scope stay open.
+ *
+ * Memory in the undo log must not be freed before the outermost commit.
+ */
+int MPI_Tx_begin();
+
+/*!
+ * Commit the innermost open transaction.
+ */
+int MPI_Tx_commit();
+
+/*!
+ * Annotate a write.  Saves the current contents of [base, base + size) in
+ * the undo log of the innermost open transaction.  Logging a range more than
+ * once is allowed; the oldest contents win on rollback.  Outside of a
+ * transaction this does nothing.
+ *
+ * @param[in] base  Start of the range about to be modified.
+ * @param[in] size  Size of the range in bytes.
+ */
+int MPI_Tx_log(void *base, MPI_Aint size);
+
+/*!
+ * Register a range for capture by page protection.  base and size must be
+ * multiples of the system page size, e.g. memory from MPI_Alloc_mem or
+ * posix_memalign.  The range stays registered across transactions until it
+ * is passed to MPI_Tx_unregister.
+ *
+ * Page protection costs nothing until a page is first written in a
+ * transaction, but that first write takes a fault and copies a whole page.
+ * Prefer MPI_Tx_log for small or scattered updates.
+ *
+ * @param[in] base  Page-aligned start of the range.
+ * @param[in] size  Size of the range in bytes, a multiple of the page size.
+ */
+int MPI_Tx_register(void *base, MPI_Aint size);
+
+/*!
+ * Remove a range previously passed to MPI_Tx_register.  Must not be called
+ * while a transaction is open.
+ *
+ * @param[in] base  Start of the registered range.
+ */
+int MPI_Tx_unregister(void *base);
+
 
 // ===========================================================================
 // Sending fault notification
@@ -97,7 +248,9 @@ typedef enum {
  * program to emulate stack unwinding when a fault occurs, just as an
  * exception handler would.  It also allows libraries to register their own
  * cleanup code separately from the main application, preserving
- * composability.
+ * composability.  Handlers pushed before MPI_Reinit are executed but stay on
+ * the stack, since the frames that pushed them are not unwound; they run
+ * again on the next fault.
  *
  * Each cleanup handler needs to return an MPI_Cleanup_code when it is done.
  * If any cleanup handler returns MPI_CLEANUP_ABORT, then the fault is
@@ -114,7 +267,7 @@ typedef enum {
  */
 typedef MPI_Cleanup_code (*MPI_Cleanup_handler)(
   MPI_Start_state start_state, void *state);
-#define MPI_CLEANUP_HANDLER_NULL ((MPI_Cleanup_handler*) 0)
+#define MPI_CLEANUP_HANDLER_NULL ((MPI_Cleanup_handler) 0)
 
 /*!
  * Push a cleanup handler onto this process's stack of cleanup handlers.  The
@@ -131,8 +284,7 @@ int MPI_Cleanup_handler_push(const MPI_Cleanup_handler handler, void *state);
  * @param[out] handler  Where to store the popped handler.
  * @param[out] state    State that was to be passed to the handler on invocation.
  */
-int MPI_Cleanup_handler_pop(
-  const MPI_Cleanup_handler *handler, void **state);
+int MPI_Cleanup_handler_pop(MPI_Cleanup_handler *handler, void **state);
 
 
 // ===========================================================================
@@ -175,3 +327,63 @@ int MPI_Get_fault_mode(MPI_Fault_mode *mode);
  * @param[in] mode to switch fault event receipt to.
  */
 int MPI_Set_fault_mode(MPI_Fault_mode mode);
+
+
+// ===========================================================================
+// Deterministic replay
+// ===========================================================================
+
+/*!
+ * A determinant records how one nondeterministic receive was matched.
+ *
+ * Receives posted with MPI_ANY_SOURCE or MPI_ANY_TAG (including probes) can
+ * match differently each time a program runs.  The MPI implementation logs a
+ * determinant for every such match, in the order receives complete on this
+ * process, so that a process rolled back to a restart point can be forced to
+ * match its receives exactly as it did before the fault.  Receives with a
+ * fully specified source and tag are deterministic and are not logged.
+ *
+ * Determinants are kept in a compact, fixed-size ring per process, and each
+ * new determinant is replicated to a partner process.  A restarted process
+ * recovers its log from its partner, so replay needs no global coordination.
+ */
+typedef struct {
+  int      source;  //!< Rank in the receive's communicator that was matched.
+  int      tag;     //!< Tag of the matched message.
+  unsigned seq;     //!< Receive sequence number since the last replay mark.
+} MPI_Determinant;
+
+/*!
+ * Mark a recovery line for deterministic replay.  Call this when the
+ * application commits a checkpoint it will restart from.
+ *
+ * All determinants logged before the mark are discarded, both locally and on
+ * the partner, and receive sequence numbers start again from zero.  If a
+ * fault occurs later, a restarted process replays the determinants logged
+ * since the most recent mark: its first nondeterministic receive is matched
+ * as the first logged one was, and so on until the log is exhausted, after
+ * which matching is nondeterministic again.
+ *
+ * The log ring has an implementation-defined capacity.  If more determinants
+ * are logged between two marks than fit, replay is disabled until the next
+ * mark and this call returns MPI_ERR_TRUNCATE to report that the interval
+ * that just ended could not have been replayed.
+ */
+int MPI_Replay_mark();
+
+/*!
+ * Choose the process that holds the replica of this process's determinant
+ * log.  By default this is (rank + 1) % size in MPI_COMM_WORLD.  Applications
+ * that already pair processes for in-memory checkpoints should use the same
+ * partner here, so that one partner failure cannot lose both.
+ *
+ * @param[in] partner  Rank in MPI_COMM_WORLD of the new log partner.
+ */
+int MPI_Replay_set_partner(int partner);
+
+/*!
+ * Find out whether this process is currently replaying logged determinants.
+ *
+ * @param[out] flag  Nonzero if replay is in progress, zero otherwise.
+ */
+int MPI_Replay_active(int *flag);
@@ -0,0 +1,339 @@
+// ===========================================================================
+// Jacobi proxy application.
+//
+// Implements the application routines that example.c leaves abstract, so
+// that example.c links into a real program: an implicit 3D heat equation on
+// an N^3 grid, decomposed into slabs along z.  Each time step solves
+// (I - a L) u' = u with Jacobi sweeps and halo exchanges, then adds a moving
+// heat source as the "mesh adaptation" transaction, then checkpoints.
+//
+// Usage: jacobi [-n N] [-s steps] [-f file_interval] [-t tol] [-r start]
+//
+// Rank 0 prints one line of key=value results at the end.  The checksum
+// only depends on N and the number of steps, so a run with faults must
+// match a run without.
+// ===========================================================================
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+#include "ckpt.h"
+
+#define HALO_TAG   1
+#define MAX_SWEEPS 10000
+
+int MAX_STEP = 20;
+
+static MPI_Comm comm;
+static int      rank, size;
+
+static int      n = 64;             //!< Global grid is n^3.
+static int      nz;                 //!< Planes owned by this rank.
+static int      file_interval = 5;  //!< Steps between file checkpoints.
+static double   tol = 1e-8;         //!< Residual tolerance of each solve.
+static double   alpha = 1.0;        //!< dt / h^2.
+
+static double  *u, *unew;           //!< (nz + 2) planes, with halos.
+static double  *rhs;                //!< u at the start of the step.
+static int      sweeps;             //!< Sweeps in the current solve.
+static int      step;               //!< Step being computed.
+
+static double   start_time;
+static int      rollbacks;          //!< Rollbacks to MPI_Reinit.
+static int      solve_restarts;     //!< Rollbacks to the solve scope.
+static long     total_sweeps;
+
+//! Cell (x, y, z) of a local array; z runs from -1 to nz for the halos.
+#define PLANE          ((size_t) n * n)
+#define AT(a, x, y, z) ((a)[((size_t) (z) + 1) * PLANE + (size_t) (y) * n + \
+                            (x)])
+
+// ===========================================================================
+// Setup and teardown
+// ===========================================================================
+// Slabs and their checkpoints belong to ranks, so a job that shrank for
+// want of spares, or grew back, cannot carry on.
+int can_run_at_size(int ranks) {
+  int old_size;
+  MPI_Reinit_remap(0, NULL, &old_size);
+  if (ranks != old_size) {
+    fprintf(stderr, "jacobi: cannot continue with %d of %d ranks\n", ranks,
+            old_size);
+    return 0;
+  }
+  return ranks <= n && n % ranks == 0;
+}
+
+int parse_start_step(int argc, char **argv) {
+  int start = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:f:t:r:")) != -1) {
+    switch (opt) {
+      case 'n': n = atoi(optarg); break;
+      case 's': MAX_STEP = atoi(optarg); break;
+      case 'f': file_interval = atoi(optarg); break;
+      case 't': tol = atof(optarg); break;
+      case 'r': start = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n N] [-s steps] [-f file_interval] "
+                "[-t tol] [-r start]\n", argv[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  return start;
+}
+
+int initialize_libraries(MPI_Comm c) {
+  comm = c;
+  start_time = MPI_Wtime();
+  return ckpt_init(comm, NULL) == MPI_SUCCESS;
+}
+
+int reinit_libraries(void) {
+  rollbacks++;
+  return ckpt_init(comm, NULL) == MPI_SUCCESS;
+}
+
+static void allocate_app_data(void) {
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  nz = n / size;
+  size_t cells = (nz + 2) * PLANE;
+  u    = calloc(cells, sizeof(double));
+  unew = calloc(cells, sizeof(double));
+  rhs  = calloc(cells, sizeof(double));
+}
+
+int deallocate_app_data(void) {
+  free(u);
+  free(unew);
+  free(rhs);
+  u = unew = rhs = NULL;
+  return 1;
+}
+
+static double checksum(void) {
+  double sum = 0;
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        sum += AT(u, x, y, z);
+      }
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+  return sum;
+}
+
+int finalize_libraries(void) {
+  double sum = checksum();
+  double elapsed = MPI_Wtime() - start_time;
+  MPI_Allreduce(MPI_IN_PLACE, &total_sweeps, 1, MPI_LONG, MPI_MAX, comm);
+  if (rank == 0) {
+    printf("app=jacobi n=%d ranks=%d steps=%d time=%.6f sweeps=%ld "
+           "rollbacks=%d solve_restarts=%d checksum=%.12e\n",
+           n, size, MAX_STEP, elapsed, total_sweeps, rollbacks,
+           solve_restarts, sum);
+  }
+  deallocate_app_data();
+  ckpt_finalize();
+  return 1;
+}
+
+// ===========================================================================
+// Checkpoints
+//
+// A checkpoint stored after step t is labeled t + 1, the step to resume at,
+// so that the step a process was in when it rolled back names the
+// checkpoint it needs.
+// ===========================================================================
+static void install(int at, const void *data, size_t bytes) {
+  if (data) {
+    memcpy(&AT(u, 0, 0, 0), data, bytes);
+  }
+  step = at;
+#ifdef MPIX_LOCAL
+  MPIX_Checkpoint_loaded();
+#endif
+}
+
+int store_checkpoint(int done) {
+  int tiers = CKPT_MEMORY | CKPT_PARTNER;
+  step = done + 1;
+  if (file_interval > 0 && step % file_interval == 0) {
+    tiers |= CKPT_FILE;
+  }
+  return ckpt_store(tiers, step, &AT(u, 0, 0, 0),
+                    nz * PLANE * sizeof(double)) == MPI_SUCCESS;
+}
+
+int can_load_checkpoint_from_memory(int at) {
+  size_t bytes;
+  return ckpt_memory(at, &bytes) != NULL;
+}
+
+int load_checkpoint_from_memory(int at) {
+  size_t bytes;
+  const void *data = ckpt_memory(at, &bytes);
+  if (!u) {
+    allocate_app_data();
+  }
+  install(at, data, bytes);
+  return 1;
+}
+
+// Step 0 is the initial condition, which needs no file.  Files from earlier
+// runs are dropped so that they are not mistaken for this run's.
+int load_checkpoint_from_filesystem(int at) {
+  if (!u) {
+    allocate_app_data();
+  }
+  if (at == 0) {
+    ckpt_discard(CKPT_FILE);
+    install(0, NULL, 0);
+    return 1;
+  }
+  size_t bytes;
+  void *data = ckpt_load_file(rank, at, &bytes);
+  if (!data || bytes != nz * PLANE * sizeof(double)) {
+    fprintf(stderr, "jacobi: rank %d: no checkpoint for step %d\n", rank,
+            at);
+    MPI_Abort(comm, 1);
+  }
+  install(at, data, bytes);
+  free(data);
+  return 1;
+}
+
+int last_checkpoint_on_disk(int r) {
+  int at = ckpt_file_step(r);
+  return at < 0 ? 0 : at;
+}
+
+int have_neighbor_checkpoint_for(int r) {
+  return ckpt_partner_step(r) >= 0;
+}
+
+int send_neighbor_checkpoint_to(int r) {
+  return ckpt_send_partner(r) == MPI_SUCCESS;
+}
+
+int receive_neighbor_checkpoint(void) {
+  int at;
+  size_t bytes;
+  if (!ckpt_recv_partner(&at, &bytes)) {
+    MPI_Abort(comm, 1);
+  }
+  return at;
+}
+
+// ===========================================================================
+// Solver
+// ===========================================================================
+// Called once at the start of every step.
+int save_solver_state(void) {
+#ifdef MPIX_LOCAL
+  MPIX_Work_step(step);
+#endif
+  memcpy(rhs, u, (nz + 2) * PLANE * sizeof(double));
+  sweeps = 0;
+  return 1;
+}
+
+int restore_solver_state(void) {
+  memcpy(u, rhs, (nz + 2) * PLANE * sizeof(double));
+  sweeps = 0;
+  solve_restarts++;
+  return 1;
+}
+
+// Fill the halo planes from the neighboring slabs.  Planes outside the
+// domain stay zero, which is the boundary condition.
+static void exchange_halos(double *a) {
+  int up   = rank + 1 < size ? rank + 1 : MPI_PROC_NULL;
+  int down = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+  MPI_Sendrecv(&AT(a, 0, 0, nz - 1), PLANE, MPI_DOUBLE, up, HALO_TAG,
+               &AT(a, 0, 0, -1), PLANE, MPI_DOUBLE, down, HALO_TAG,
+               comm, MPI_STATUS_IGNORE);
+  MPI_Sendrecv(&AT(a, 0, 0, 0), PLANE, MPI_DOUBLE, down, HALO_TAG,
+               &AT(a, 0, 0, nz), PLANE, MPI_DOUBLE, up, HALO_TAG,
+               comm, MPI_STATUS_IGNORE);
+}
+
+static double neighbors(const double *a, int x, int y, int z) {
+  double sum = AT(a, x, y, z - 1) + AT(a, x, y, z + 1);
+  sum += y > 0     ? AT(a, x, y - 1, z) : 0;
+  sum += y < n - 1 ? AT(a, x, y + 1, z) : 0;
+  sum += x > 0     ? AT(a, x - 1, y, z) : 0;
+  sum += x < n - 1 ? AT(a, x + 1, y, z) : 0;
+  return sum;
+}
+
+// One Jacobi sweep.  Returns nonzero once the update is below tolerance.
+int converged(void) {
+  exchange_halos(u);
+  double diag = 1 + 6 * alpha;
+  double change = 0;
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        double next = (AT(rhs, x, y, z) + alpha * neighbors(u, x, y, z)) /
+                      diag;
+        double d = next - AT(u, x, y, z);
+        change += d * d;
+        AT(unew, x, y, z) = next;
+      }
+    }
+  }
+  double *tmp = u;
+  u = unew;
+  unew = tmp;
+  sweeps++;
+  total_sweeps++;
+
+  MPI_Allreduce(MPI_IN_PLACE, &change, 1, MPI_DOUBLE, MPI_SUM, comm);
+  return sqrt(change) < tol || sweeps >= MAX_SWEEPS;
+}
+
+// ===========================================================================
+// Mesh adaptation
+// ===========================================================================
+
+// Add heat at a point that moves every step.  Every row touched is logged
+// first, so a fault before the commit undoes exactly these writes.
+int adapt_mesh(void) {
+  int cx = (step * 7) % (n - 2) + 1;
+  int cy = (step * 13) % (n - 2) + 1;
+  int cz = (step * 5) % (n - 2) + 1;
+  for (int z = cz - 1; z <= cz + 1; z++) {
+    int lz = z - rank * nz;
+    if (lz < 0 || lz >= nz) {
+      continue;
+    }
+    for (int y = cy - 1; y <= cy + 1; y++) {
+      double *row = &AT(u, cx - 1, y, lz);
+      MPI_Tx_log(row, 3 * sizeof(double));
+      for (int x = 0; x < 3; x++) {
+        row[x] += 1.0;
+      }
+    }
+  }
+  return 1;
+}
+
+int physics_looks_ridiculous(void) {
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        if (!isfinite(AT(u, x, y, z))) {
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
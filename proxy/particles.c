@@ -0,0 +1,668 @@
+// ===========================================================================
+// Particle proxy application.
+//
+// Monte Carlo transport of particles on the unit interval, split evenly
+// across ranks.  A narrow source that moves every step makes the number of
+// particles per rank, and so the size of each rank's checkpoint, differ by
+// an order of magnitude and change every step.  This stresses what the
+// Jacobi proxy cannot: imbalanced partner copies, striped restores, and
+// restarting from files at a different number of ranks.  When the job
+// shrinks for want of spares, the ranks that are left take over the
+// particles of lost ranks from partner copies and carry on, and when the
+// spares come back, the particles are spread over them again.
+//
+// Usage: particles [-p per_step] [-s steps] [-c ckpt_interval]
+//                  [-f file_interval] [-k stripes] [-r start]
+//
+// Every random number is a hash of the particle id and the step, so the
+// result does not depend on the number of ranks or on faults.  Rank 0
+// prints one line of key=value results at the end, with a checksum that
+// must match between any two runs of the same problem.  It also reports
+// where the wall time went, as fractions: useful work on steps that were
+// kept, storing checkpoints that were kept, work lost to rollbacks, and
+// recovery from the fault to the restart.  Run it under an mtbf injection
+// rule to measure efficiency at a failure rate (see `make efficiency`).
+// ===========================================================================
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+#include "ckpt.h"
+
+#define MIGRATE_TAG 2
+#define DT          0.01
+#define MAX_SPEED   1.0
+#define SPREAD      0.02
+
+//! One particle.  Weight drops as it is absorbed.
+struct particle {
+  uint64_t id;
+  double   x, v, w;
+};
+
+//! Where the time of the run went.  Checkpoints carry it, so that it rolls
+//! back with the state it describes.
+struct account {
+  double start;         //!< When the job started.
+  double at;            //!< When the last checkpoint was started.
+  double useful;        //!< Computing steps that were kept.
+  double checkpoint;    //!< Storing checkpoints that were kept.
+  double lost;          //!< Computing and storing what was rolled back.
+  double recovery;      //!< From faults to restarting.
+  int    rollbacks;
+};
+
+//! Head of a checkpoint, followed by count particles.
+struct state {
+  int32_t        step;
+  int32_t        ranks;
+  uint64_t       count;
+  struct account account;
+};
+
+static int rank, size;
+
+static int per_step = 20000;        //!< Particles the source adds per step.
+static int steps = 100;
+static int ckpt_interval = 1;       //!< Steps between checkpoints.
+static int file_interval = 10;      //!< Steps between file checkpoints.
+static int stripes = 1;             //!< Stripes per partner copy.
+static int start_step;              //!< Step to restart from files at.
+
+static struct particle *parts;      //!< Particles in this rank's domain.
+static size_t count, cap;
+static int step;                    //!< Step being computed.
+
+static double start_time;
+static struct account account;
+static size_t min_bytes = SIZE_MAX, max_bytes;
+
+// ===========================================================================
+// Particles
+// ===========================================================================
+
+static uint64_t mix(uint64_t z) {
+  z += 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+//! The k-th uniform number in [0, 1) for particle id at the current step.
+static double uniform(uint64_t id, int k) {
+  uint64_t h = mix(id ^ mix(((uint64_t) step << 8) | (uint64_t) k));
+  return (h >> 11) * 0x1.0p-53;
+}
+
+static int owner(double x) {
+  int r = (int) (x * size);
+  return r < 0 ? 0 : r >= size ? size - 1 : r;
+}
+
+static struct particle *grow(size_t n) {
+  if (n > cap) {
+    cap = n > 2 * cap ? n : 2 * cap;
+    parts = realloc(parts, cap * sizeof(*parts));
+    if (!parts) {
+      fprintf(stderr, "particles: rank %d: out of memory\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  return parts;
+}
+
+static void add(const struct particle *p) {
+  grow(count + 1);
+  parts[count++] = *p;
+}
+
+// Keep x in [0, 1) by reflecting off both walls.
+static void reflect(struct particle *p) {
+  while (p->x < 0 || p->x >= 1) {
+    if (p->x < 0) {
+      p->x = -p->x;
+    } else {
+      p->x = 2 - p->x;
+      if (p->x >= 1) {
+        p->x = nextafter(1, 0);
+      }
+    }
+    p->v = -p->v;
+  }
+}
+
+// Add this step's source particles that start in this rank's domain.
+static void emit(void) {
+  double center = 0.5 + 0.4 * sin(0.3 * step);
+  for (int i = 0; i < per_step; i++) {
+    struct particle p = { (uint64_t) step * per_step + i, 0, 0, 1 };
+    double offset = uniform(p.id, 0) + uniform(p.id, 1) +
+                    uniform(p.id, 2) - 1.5;
+    p.x = center + 2 * SPREAD * offset;
+    p.v = (2 * uniform(p.id, 3) - 1) * MAX_SPEED;
+    reflect(&p);
+    if (owner(p.x) == rank) {
+      add(&p);
+    }
+  }
+}
+
+// Move, scatter and absorb every particle, dropping the ones absorbed.
+static void advance(void) {
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    struct particle p = parts[i];
+    p.x += p.v * DT;
+    reflect(&p);
+    if (uniform(p.id, 4) < 0.3) {
+      p.v = (2 * uniform(p.id, 5) - 1) * MAX_SPEED;
+    }
+    p.w *= 0.9;
+    if (p.w < 0.1) {
+      // Russian roulette keeps the expected weight.
+      if (uniform(p.id, 6) < 0.5) {
+        continue;
+      }
+      p.w *= 2;
+    }
+    parts[kept++] = p;
+  }
+  count = kept;
+}
+
+// Pass particles that left this rank's domain to the neighbor toward their
+// owner, until none is left over anywhere.
+static void migrate(void) {
+  int left = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+  int right = rank + 1 < size ? rank + 1 : MPI_PROC_NULL;
+  for (;;) {
+    // Sort strays to the end: those going left, then those going right.
+    size_t kept = 0, nleft = 0;
+    struct particle *out = malloc((count + 1) * sizeof(*out));
+    for (size_t i = 0; i < count; i++) {
+      if (owner(parts[i].x) < rank) {
+        out[nleft++] = parts[i];
+      }
+    }
+    size_t nout = nleft;
+    for (size_t i = 0; i < count; i++) {
+      int o = owner(parts[i].x);
+      if (o > rank) {
+        out[nout++] = parts[i];
+      } else if (o == rank) {
+        parts[kept++] = parts[i];
+      }
+    }
+    count = kept;
+
+    long strays = (long) nout;
+    MPI_Allreduce(MPI_IN_PLACE, &strays, 1, MPI_LONG, MPI_SUM,
+                  MPI_COMM_WORLD);
+    if (!strays) {
+      free(out);
+      return;
+    }
+
+    // Counts first, then particles, in each direction.
+    int send[2] = { (int) nleft, (int) (nout - nleft) }, recv[2] = { 0, 0 };
+    MPI_Sendrecv(&send[0], 1, MPI_INT, left, MIGRATE_TAG,
+                 &recv[1], 1, MPI_INT, right, MIGRATE_TAG,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&send[1], 1, MPI_INT, right, MIGRATE_TAG,
+                 &recv[0], 1, MPI_INT, left, MIGRATE_TAG,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    grow(count + recv[0] + recv[1]);
+    MPI_Sendrecv(out, send[0] * sizeof(*out), MPI_BYTE, left, MIGRATE_TAG,
+                 parts + count, recv[1] * sizeof(*out), MPI_BYTE, right,
+                 MIGRATE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    count += recv[1];
+    MPI_Sendrecv(out + nleft, send[1] * sizeof(*out), MPI_BYTE, right,
+                 MIGRATE_TAG, parts + count, recv[0] * sizeof(*out),
+                 MPI_BYTE, left, MIGRATE_TAG, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+    count += recv[0];
+    free(out);
+  }
+}
+
+// ===========================================================================
+// Checkpoints
+//
+// As in the Jacobi proxy, the checkpoint stored after step t is labeled
+// t + 1, the step to resume at.  File checkpoints are only taken at steps
+// that are multiples of both intervals.
+// ===========================================================================
+static void store_checkpoint(int tiers) {
+  size_t bytes = sizeof(struct state) + count * sizeof(*parts);
+  char *buf = malloc(bytes);
+  struct state head = { step, size, count, account };
+  memcpy(buf, &head, sizeof(head));
+  memcpy(buf + sizeof(head), parts, count * sizeof(*parts));
+
+  if (ckpt_store(tiers, step, buf, bytes) != MPI_SUCCESS) {
+    fprintf(stderr, "particles: rank %d: checkpoint failed\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  free(buf);
+  min_bytes = bytes < min_bytes ? bytes : min_bytes;
+  max_bytes = bytes > max_bytes ? bytes : max_bytes;
+}
+
+// Replace this rank's particles and account with the ones in a checkpoint,
+// keeping only particles in its domain, or all of them with all set, for
+// migrate() to pass on.  With append set, add the particles instead and
+// leave the account alone.
+static void install(const void *data, size_t bytes, int append, int all) {
+  struct state head;
+  memcpy(&head, data, sizeof(head));
+  const struct particle *p =
+      (const struct particle *) ((const char *) data + sizeof(head));
+  if (!append) {
+    count = 0;
+    account = head.account;
+  }
+  for (uint64_t i = 0; i < head.count; i++) {
+    if (all || owner(p[i].x) == rank) {
+      add(&p[i]);
+    }
+  }
+  step = head.step;
+}
+
+static void checkpoint_loaded(void) {
+#ifdef MPIX_LOCAL
+  MPIX_Checkpoint_loaded();
+#endif
+}
+
+// The minimum of value over all ranks.  Restarting ranks agree on where to
+// restart with this, so it uses a persistent collective where there is one:
+// its schedule is built once and kept across rollbacks, and agreement does
+// not build or allocate anything while recovering.
+static int agree_min(int value) {
+#if defined(MPIX_LOCAL) || MPI_VERSION >= 4
+  static MPI_Request agree = MPI_REQUEST_NULL;
+  static int agreed;
+  if (agree == MPI_REQUEST_NULL) {
+    MPI_Allreduce_init(MPI_IN_PLACE, &agreed, 1, MPI_INT, MPI_MIN,
+                       MPI_COMM_WORLD, MPI_INFO_NULL, &agree);
+  }
+  agreed = value;
+  MPI_Start(&agree);
+  MPI_Wait(&agree, MPI_STATUS_IGNORE);
+  return agreed;
+#else
+  MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  return value;
+#endif
+}
+
+// Restart every rank at the newest step all of them hold in memory.
+// Returns zero if some rank holds none.
+static int load_from_memory(void) {
+  size_t bytes;
+  const void *data = ckpt_memory(-1, &bytes);
+  int at = INT32_MAX;
+  if (data) {
+    struct state head;
+    memcpy(&head, data, sizeof(head));
+    at = head.step;
+  }
+  at = agree_min(at);
+  data = at == INT32_MAX ? NULL : ckpt_memory(at, &bytes);
+  int ok = agree_min(data != NULL);
+  if (ok) {
+    install(data, bytes, 0, 0);
+  }
+  return ok;
+}
+
+// Read the files of every rank of the job that wrote them, which may have
+// had a different size, and keep the particles in this rank's domain.
+static void load_from_files(int at) {
+  size_t bytes;
+  void *data = ckpt_load_file(0, at, &bytes);
+  if (!data) {
+    fprintf(stderr, "particles: rank %d: no checkpoint for step %d\n", rank,
+            at);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  struct state head;
+  memcpy(&head, data, sizeof(head));
+  account = head.account;
+  count = 0;
+  for (int r = 0; r < head.ranks; r++) {
+    if (r) {
+      data = ckpt_load_file(r, at, &bytes);
+      if (!data) {
+        fprintf(stderr, "particles: rank %d: no checkpoint of rank %d for "
+                "step %d\n", rank, r, at);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+    }
+    install(data, bytes, 1, 0);
+    free(data);
+  }
+}
+
+static int last_step_on_disk(void) {
+  return agree_min(ckpt_file_step(rank));
+}
+
+// Start from initial conditions.  The account starts at the earliest start
+// of any process, since replacements started late.
+static void start_over(void) {
+  double start = account.start ? account.start : start_time;
+  MPI_Allreduce(MPI_IN_PLACE, &start, 1, MPI_DOUBLE, MPI_MIN,
+                MPI_COMM_WORLD);
+  ckpt_discard(CKPT_FILE);
+  count = 0;
+  step = 0;
+  account = (struct account) { start, start, 0, 0, 0, 0, 0 };
+}
+
+// Everything since the checkpoint restarted from was lost, up to the fault,
+// and the rest was recovery.  Without the runtime's recovery records the
+// fault time is unknown, and it all counts as lost.
+static void charge_rollback(void) {
+  double now = MPI_Wtime();
+  double fault = now;
+#ifdef MPIX_LOCAL
+  MPIX_Recovery_record record;
+  int n;
+  MPIX_Recovery_records(1, &record, &n);
+  if (n && record.fault_time >= account.at && record.fault_time <= now) {
+    fault = record.fault_time;
+  }
+#endif
+  account.lost += fault > account.at ? fault - account.at : 0;
+  account.recovery += now - fault;
+  account.at = now;
+  account.rollbacks++;
+}
+
+// Set up this rank's particles for a fresh start or after a fault.
+static void restore(MPI_Start_state start_state) {
+  if (start_state == MPI_START_NEW) {
+    if (start_step > 0) {
+      load_from_files(start_step);
+      account = (struct account) { start_time, start_time, 0, 0, 0, 0, 0 };
+      checkpoint_loaded();
+    } else {
+      start_over();
+    }
+    return;
+  }
+
+  // Replaced ranks get their copies back from their partners first.
+  int died[size];
+  int i_died = start_state == MPI_START_ADDED;
+  MPI_Allgather(&i_died, 1, MPI_INT, died, 1, MPI_INT, MPI_COMM_WORLD);
+  int ok = agree_min(ckpt_restore_partners(died) == MPI_SUCCESS);
+
+  if (!ok || !load_from_memory()) {
+    int at = last_step_on_disk();
+    if (at < 0) {
+      start_over();
+    } else {
+      load_from_files(at);
+    }
+  }
+  checkpoint_loaded();
+  charge_rollback();
+}
+
+// Send every particle straight to its owner.  After a resize, particles can
+// be anywhere, and passing them from neighbor to neighbor would take as
+// many rounds as ranks moved; this posts every transfer at once.
+static void rebalance(void) {
+  int sends[size], recvs[size], first[size + 1], fill[size];
+  memset(sends, 0, sizeof(sends));
+  for (size_t i = 0; i < count; i++) {
+    sends[owner(parts[i].x)]++;
+  }
+  first[0] = 0;
+  for (int r = 0; r < size; r++) {
+    first[r + 1] = first[r] + sends[r];
+    fill[r] = first[r];
+  }
+  struct particle *out = malloc((count + 1) * sizeof(*out));
+  for (size_t i = 0; i < count; i++) {
+    out[fill[owner(parts[i].x)]++] = parts[i];
+  }
+  MPI_Alltoall(sends, 1, MPI_INT, recvs, 1, MPI_INT, MPI_COMM_WORLD);
+
+  size_t total = 0;
+  for (int r = 0; r < size; r++) {
+    total += recvs[r];
+  }
+  grow(total);
+  MPI_Request reqs[2 * size];
+  int nreqs = 0;
+  size_t at = 0;
+  for (int r = 0; r < size; r++) {
+    if (r == rank) {
+      memcpy(parts + at, out + first[r], recvs[r] * sizeof(*out));
+    } else if (recvs[r]) {
+      MPI_Irecv(parts + at, recvs[r] * sizeof(*out), MPI_BYTE, r,
+                MIGRATE_TAG, MPI_COMM_WORLD, &reqs[nreqs++]);
+    }
+    at += recvs[r];
+  }
+  for (int r = 0; r < size; r++) {
+    if (r != rank && sends[r]) {
+      MPI_Isend(out + first[r], sends[r] * sizeof(*out), MPI_BYTE, r,
+                MIGRATE_TAG, MPI_COMM_WORLD, &reqs[nreqs++]);
+    }
+  }
+  MPI_Waitall(nreqs, reqs, MPI_STATUSES_IGNORE);
+  count = total;
+  free(out);
+}
+
+// The job restarted at a different size: smaller, after losing ranks it had
+// no spares for, or larger, when they came back.  Each rank of the old job
+// takes back its own particles, and those of the lost rank it adopted, at
+// the newest step all of them hold; added ranks start with none and the
+// account of the job so far.  Rebalancing then hands the particles to their
+// owners in the new decomposition, and the result is checkpointed at once.
+// Without the copies to do that, restart from files, which any number of
+// ranks can read.
+static void resize(int old_size) {
+  int map[old_size];
+  MPI_Reinit_remap(old_size, map, &old_size);
+  int ok = agree_min(ckpt_redistribute(MPI_COMM_WORLD, map, old_size) ==
+                     MPI_SUCCESS);
+  ckpt_init(MPI_COMM_WORLD, NULL);
+  ckpt_set_stripes(stripes);
+
+  int added = 1, root = size;
+  for (int r = 0; r < old_size; r++) {
+    added = added && map[r] != rank;
+    root = map[r] != MPI_UNDEFINED && map[r] < root ? map[r] : root;
+  }
+
+  size_t bytes, lost_bytes;
+  int lost_rank, at = INT32_MAX;
+  const void *data = NULL, *lost = NULL;
+  if (ok) {
+    struct state head;
+    const void *latest[2] = {
+      ckpt_memory(-1, &bytes), ckpt_adopted(-1, &lost_rank, &lost_bytes)
+    };
+    for (int i = 0; i < 2; i++) {
+      if (latest[i]) {
+        memcpy(&head, latest[i], sizeof(head));
+        at = head.step < at ? head.step : at;
+      }
+    }
+    at = agree_min(latest[0] ? at : INT32_MAX);
+    if (at != INT32_MAX) {
+      data = ckpt_memory(at, &bytes);
+      lost = ckpt_adopted(at, &lost_rank, &lost_bytes);
+    }
+    ok = agree_min((data || added) && (lost || !latest[1]));
+  }
+
+  if (ok) {
+    if (added) {
+      count = 0;
+      step = at;
+    } else {
+      install(data, bytes, 0, 1);
+    }
+    if (lost) {
+      install(lost, lost_bytes, 1, 1);
+    }
+    // The copies are of the old decomposition: a fault before the next
+    // store must not mix them with new ones.
+    ckpt_discard(CKPT_MEMORY);
+    struct account job = account;
+    MPI_Bcast(&job, sizeof(job), MPI_BYTE, root, MPI_COMM_WORLD);
+    if (added) {
+      account = (struct account) {
+        job.start, MPI_Wtime(), 0, 0, 0, 0, job.rollbacks
+      };
+    }
+    rebalance();
+    store_checkpoint(CKPT_MEMORY | CKPT_PARTNER);
+  } else {
+    at = last_step_on_disk();
+    if (at < 0) {
+      start_over();
+    } else {
+      load_from_files(at);
+    }
+  }
+  checkpoint_loaded();
+  charge_rollback();
+}
+
+// ===========================================================================
+// Driver
+// ===========================================================================
+
+// Sum of a hash of every particle, which does not depend on order.
+static uint64_t checksum(void) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t x, w;
+    memcpy(&x, &parts[i].x, sizeof(x));
+    memcpy(&w, &parts[i].w, sizeof(w));
+    sum += mix(parts[i].id ^ mix(x ^ mix(w)));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_UINT64_T, MPI_SUM,
+                MPI_COMM_WORLD);
+  return sum;
+}
+
+static void report(void) {
+  uint64_t sum = checksum();
+  unsigned long total = count;
+  unsigned long lo = min_bytes, hi = max_bytes;
+
+  // Average each part of the account over ranks, as a fraction of the time
+  // from the first start to the last finish.
+  double start = account.start, end = MPI_Wtime();
+  double shares[4] = {
+    account.useful, account.checkpoint, account.lost, account.recovery
+  };
+  MPI_Allreduce(MPI_IN_PLACE, &start, 1, MPI_DOUBLE, MPI_MIN,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &end, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, shares, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  double elapsed = end - start;
+  for (int i = 0; i < 4; i++) {
+    shares[i] /= size * elapsed;
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &lo, 1, MPI_UNSIGNED_LONG, MPI_MIN,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &hi, 1, MPI_UNSIGNED_LONG, MPI_MAX,
+                MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("app=particles ranks=%d steps=%d stripes=%d time=%.6f "
+           "particles=%lu ckpt_min_bytes=%lu ckpt_max_bytes=%lu "
+           "rollbacks=%d efficiency=%.4f checkpoint=%.4f lost=%.4f "
+           "recovery=%.4f checksum=%016llx\n",
+           size, steps, stripes, elapsed, total, lo, hi, account.rollbacks,
+           shares[0], shares[1], shares[2], shares[3],
+           (unsigned long long) sum);
+  }
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  int old_size;
+  MPI_Reinit_remap(0, NULL, &old_size);
+  if (old_size != size) {
+    resize(old_size);
+  } else {
+    ckpt_init(MPI_COMM_WORLD, NULL);
+    ckpt_set_stripes(stripes);
+    restore(start_state);
+  }
+
+  for (; step < steps; ) {
+#ifdef MPIX_LOCAL
+    MPIX_Work_step(step);
+    MPIX_Inject_point("step", step);
+#endif
+    double begin = MPI_Wtime();
+    emit();
+    advance();
+    migrate();
+    step++;
+    double end = MPI_Wtime();
+    account.useful += end - begin;
+    if (step % ckpt_interval == 0 || step == steps) {
+      account.at = end;
+      int tiers = CKPT_MEMORY | CKPT_PARTNER;
+      if (file_interval > 0 && step % file_interval == 0) {
+        tiers |= CKPT_FILE;
+      }
+      store_checkpoint(tiers);
+      account.checkpoint += MPI_Wtime() - end;
+    }
+  }
+  report();
+}
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+  start_time = MPI_Wtime();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:c:f:k:r:")) != -1) {
+    switch (opt) {
+      case 'p': per_step = atoi(optarg); break;
+      case 's': steps = atoi(optarg); break;
+      case 'c': ckpt_interval = atoi(optarg); break;
+      case 'f': file_interval = atoi(optarg); break;
+      case 'k': stripes = atoi(optarg); break;
+      case 'r': start_step = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-p per_step] [-s steps] "
+                "[-c ckpt_interval] [-f file_interval] [-k stripes] "
+                "[-r start]\n", argv[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  if (ckpt_interval < 1) {
+    ckpt_interval = 1;
+  }
+  MPI_Reinit(argc, argv, run);
+  ckpt_finalize();
+  free(parts);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,36 @@
+// ===========================================================================
+// Test that MPI_Error_string describes every error class.
+//
+// Each class below MPI_ERR_LASTCODE must have a message of its own, and
+// codes outside the range must read as an unknown error.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "1", 1);
+  MPI_Init(&argc, &argv);
+
+  char message[MPI_MAX_ERROR_STRING];
+  int len, missing = -1;
+  for (int code = 0; code < MPI_ERR_LASTCODE; code++) {
+    MPI_Error_string(code, message, &len);
+    if (!len || !strcmp(message, "unknown error")) {
+      missing = code;
+    }
+  }
+  int outside[] = { -1, MPI_ERR_LASTCODE, 1000 }, unknown = 0;
+  for (int i = 0; i < 3; i++) {
+    MPI_Error_string(outside[i], message, &len);
+    unknown += !strcmp(message, "unknown error") && len == strlen(message);
+  }
+
+  int failed = missing >= 0 || unknown != 3;
+  printf("test=error codes=%d missing=%d unknown=%d result=%s\n",
+         MPI_ERR_LASTCODE, missing, unknown, failed ? "FAIL" : "ok");
+  MPI_Finalize();
+  return failed;
+}
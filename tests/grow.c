@@ -0,0 +1,95 @@
+// ===========================================================================
+// Test that a dropped rank comes back as an added process, and that
+// checkpoints taken at the smaller size follow their owners.
+//
+// Rank 1 of four is killed with no spare left, so the job goes on with
+// three ranks, which checkpoint again.  Once the rank is repaired the job
+// must restart with four, with MPI_Reinit_remap mapping old ranks 0, 1 and
+// 2 to 0, 2 and 3.  After ckpt_redistribute the ranks of the smaller job
+// must have their checkpoints and the added one none.  The ranks wait for
+// the repair in barriers, for at most ten seconds.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+#include "ckpt.h"
+
+#define N 1000
+
+static int state[N];
+
+static void fill(int owner) {
+  for (int i = 0; i < N; i++) {
+    state[i] = owner * N + i;
+  }
+}
+
+static int is_state_of(const int *saved, size_t bytes, int owner) {
+  return saved && bytes == N * sizeof(int) && saved[0] == owner * N &&
+         saved[N - 1] == owner * N + N - 1;
+}
+
+static void fail(int rank, const char *where) {
+  printf("test=grow rank=%d at=%s result=FAIL\n", rank, where);
+  MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  if (start_state == MPI_START_NEW) {
+    fill(rank);
+    ckpt_init(MPI_COMM_WORLD, NULL);
+    ckpt_store(CKPT_MEMORY | CKPT_PARTNER, 1, state, sizeof(state));
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPIX_Inject_point("stored", 1);
+    MPI_Barrier(MPI_COMM_WORLD);
+    fail(rank, "kill");
+  }
+
+  int map[4], old_size, old = -1;
+  MPI_Reinit_remap(4, map, &old_size);
+  for (int r = 0; r < old_size; r++) {
+    old = map[r] == rank ? r : old;
+  }
+  int rc = ckpt_redistribute(MPI_COMM_WORLD, map, old_size);
+
+  // Shrunk: checkpoint at three ranks and wait for the fourth.
+  if (size == 3) {
+    ckpt_discard(CKPT_MEMORY);
+    fill(100 + rank);
+    ckpt_store(CKPT_MEMORY | CKPT_PARTNER, 2, state, sizeof(state));
+    double end = MPI_Wtime() + 10;
+    while (MPI_Wtime() < end) {
+      MPI_Barrier(MPI_COMM_WORLD);
+    }
+    fail(rank, "repair");
+  }
+
+  size_t bytes;
+  const int *own = ckpt_memory(2, &bytes);
+  int added = start_state == MPI_START_ADDED;
+  int failed = size != 4 || old_size != 3 || map[0] != 0 || map[1] != 2 ||
+               map[2] != 3 || rc != MPI_SUCCESS || added != (rank == 1) ||
+               (added ? own != NULL : !is_state_of(own, bytes, 100 + old));
+  printf("test=grow rank=%d old=%d added=%d result=%s\n", rank, old, added,
+         failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "4", 1);
+  setenv("MPI_LOCAL_SPARES", "0", 1);
+  setenv("MPI_LOCAL_REPAIR_MS", "200", 1);
+  setenv("MPI_LOCAL_INJECT", "kill rank=1 stored=1", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,42 @@
+// ===========================================================================
+// Test that MPI_Free_mem keeps the regions freed last when the cache is
+// over its bound.
+//
+// Four regions of 1 MiB are freed in turn under a bound of 2 MiB.  The two
+// freed last must come back from MPI_Alloc_mem with their contents; the
+// first two must have been unmapped.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#define MB (1 << 20)
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "1", 1);
+  setenv("MPI_LOCAL_MEM_CACHE_MB", "2", 1);
+  MPI_Init(&argc, &argv);
+
+  char *regions[4];
+  for (int i = 0; i < 4; i++) {
+    MPI_Alloc_mem(MB, NULL, &regions[i]);
+    regions[i][0] = 'A' + i;
+  }
+  for (int i = 0; i < 4; i++) {
+    MPI_Free_mem(regions[i]);
+  }
+
+  int kept = 0;
+  for (int i = 0; i < 2; i++) {
+    char *again;
+    MPI_Alloc_mem(MB, NULL, &again);
+    kept |= again[0] == 'C' ? 1 : again[0] == 'D' ? 2 : 0;
+  }
+
+  int failed = kept != 3;
+  printf("test=mem kept=%s%s result=%s\n", kept & 1 ? "C" : "",
+         kept & 2 ? "D" : "", failed ? "FAIL" : "ok");
+  MPI_Finalize();
+  return failed;
+}
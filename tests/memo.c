@@ -0,0 +1,81 @@
+// ===========================================================================
+// Test that communicators made again after a rollback come back as they
+// were, and that changed arguments cost one more rollback.
+//
+// The ranks dup MPI_COMM_WORLD and split it by rank % 2, with the keys
+// reversed, then rank 3 raises a fault.  After it the same calls must give
+// the same communicators, and so must the replacement of rank 3 after it is
+// killed.  The split is then asked for by rank / 2 instead: that must roll
+// back to MPI_Reinit once more, after which the new split is made.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+static int runs;
+
+// Check the split of world by color with keys reversed.
+static int check_split(MPI_Comm comm, int color) {
+  int rank, size, split_rank, split_size, sum, expected = 0, above = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm_rank(comm, &split_rank);
+  MPI_Comm_size(comm, &split_size);
+  for (int r = 0; r < size; r++) {
+    int other = color ? r / 2 : r % 2, mine = color ? rank / 2 : rank % 2;
+    if (other == mine) {
+      expected += r;
+      above += r > rank;
+    }
+  }
+  MPI_Allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, comm);
+  return split_size == 2 && split_rank == above && sum == expected;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (rank == 0) {
+    runs++;
+  }
+  MPI_Bcast(&runs, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  // By rank / 2 from the third run on.
+  int color = runs >= 3;
+  MPI_Comm dup, split;
+  MPI_Comm_dup(MPI_COMM_WORLD, &dup);
+  MPI_Comm_split(MPI_COMM_WORLD, color ? rank / 2 : rank % 2, -rank, &split);
+  int dup_rank, dup_size;
+  MPI_Comm_rank(dup, &dup_rank);
+  MPI_Comm_size(dup, &dup_size);
+  int ok = dup_rank == rank && dup_size == 4 && check_split(split, color);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, dup);
+
+  if (ok && runs == 1) {
+    if (rank == 3) {
+      MPI_Fault();
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+  } else if (ok && runs == 2) {
+    MPIX_Inject_point("made", runs);
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  int failed = !ok || runs != 4;
+  printf("test=memo rank=%d runs=%d ok=%d result=%s\n", rank, runs, ok,
+         failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "4", 1);
+  setenv("MPI_LOCAL_INJECT", "kill rank=3 made=2", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,83 @@
+// ===========================================================================
+// Test that a rollback frees the requests left outstanding, and that
+// messages sent before it are not received after it.
+//
+// Rank 0 posts three receives that never match, and rank 1 sends it a
+// message it never receives, without waiting.  After rank 1 raises a fault,
+// requests_reclaimed must count those requests on each rank, and the next
+// receive of the same tag must get the message sent after the rollback.
+// Rank 0 waits for the fault in MPI_Fault_probe, which posts nothing.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+#define POSTED 3
+
+static int runs;
+
+static unsigned long reclaimed(void) {
+  int provided, index, count;
+  MPI_T_pvar_session session;
+  MPI_T_pvar_handle handle;
+  unsigned long value = 0;
+  MPI_T_init_thread(MPI_THREAD_SINGLE, &provided);
+  MPI_T_pvar_get_index("requests_reclaimed", MPI_T_PVAR_CLASS_COUNTER,
+                       &index);
+  MPI_T_pvar_session_create(&session);
+  MPI_T_pvar_handle_alloc(session, index, NULL, &handle, &count);
+  MPI_T_pvar_read(session, handle, &value);
+  MPI_T_pvar_handle_free(session, &handle);
+  MPI_T_pvar_session_free(&session);
+  MPI_T_finalize();
+  return value;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  if (++runs == 1) {
+    static int never[POSTED], before = 1;
+    MPI_Request requests[POSTED];
+    int posted = 0;
+    if (rank == 0) {
+      for (int i = 0; i < POSTED; i++) {
+        MPI_Irecv(&never[i], 1, MPI_INT, 1, 9, MPI_COMM_WORLD, &requests[i]);
+      }
+      MPI_Send(&posted, 1, MPI_INT, 1, 5, MPI_COMM_WORLD);
+      // Wait without posting anything else.
+      for (;;) {
+        MPI_Fault_probe();
+      }
+    }
+    MPI_Recv(&posted, 1, MPI_INT, 0, 5, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Isend(&before, 1, MPI_INT, 0, 7, MPI_COMM_WORLD, &requests[0]);
+    MPI_Fault();
+  }
+
+  int value = 0, after = 2;
+  if (rank == 0) {
+    MPI_Recv(&value, 1, MPI_INT, 1, 7, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  } else {
+    MPI_Send(&after, 1, MPI_INT, 0, 7, MPI_COMM_WORLD);
+  }
+  unsigned long freed = reclaimed();
+  int failed = runs != 2 || freed != (rank == 0 ? POSTED : 1) ||
+               (rank == 0 && value != after);
+  printf("test=reclaim rank=%d reclaimed=%lu value=%d result=%s\n", rank,
+         freed, value, failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "2", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
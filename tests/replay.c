@@ -0,0 +1,80 @@
+// ===========================================================================
+// Test that a replacement replays the receives logged since the last replay
+// mark, from the copy of the log its partner held.
+//
+// Rank 1 sends rank 0 two messages before the mark and two after it, and
+// rank 0 takes each pair with MPI_ANY_TAG in the order they were sent:
+// tags 2, 1 before the mark and 1, 2 after it.  Rank 0 is then killed.  Its
+// replacement starts after the mark and rank 1 sends tags 2, 1 this time;
+// replay must still match 1, 2.  Without the mark, the determinants from
+// before it would pin 2, 1.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+static void send_pair(int first, int second) {
+  MPI_Send(&first, 1, MPI_INT, 0, first, MPI_COMM_WORLD);
+  MPI_Send(&second, 1, MPI_INT, 0, second, MPI_COMM_WORLD);
+}
+
+static void recv_pair(int tags[2]) {
+  MPI_Status status;
+  for (int i = 0; i < 2; i++) {
+    int value;
+    MPI_Recv(&value, 1, MPI_INT, 1, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    tags[i] = status.MPI_TAG;
+  }
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // The first run: a pair before the mark and a pair after it.
+  if (start_state == MPI_START_NEW) {
+    int tags[2];
+    if (rank == 1) {
+      send_pair(2, 1);
+    } else {
+      recv_pair(tags);
+    }
+    MPI_Replay_mark();
+    if (rank == 1) {
+      send_pair(1, 2);
+    } else {
+      recv_pair(tags);
+      MPIX_Inject_point("received", 1);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    printf("test=replay rank=%d result=FAIL\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // After the fault, from the mark.
+  int tags[2] = { 0, 0 }, active = 0;
+  if (rank == 1) {
+    send_pair(2, 1);
+  } else {
+    MPI_Replay_active(&active);
+    recv_pair(tags);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  int failed = rank == 0 && (!active || tags[0] != 1 || tags[1] != 2);
+  printf("test=replay rank=%d active=%d tags=%d,%d result=%s\n", rank,
+         active, tags[0], tags[1], failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "2", 1);
+  setenv("MPI_LOCAL_INJECT", "kill rank=0 received=1", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,87 @@
+// ===========================================================================
+// Test that a persistent collective can be freed while it is active.
+//
+// Rank 1 raises a fault once rank 0 is about to enter MPI_Start, and rank
+// 0's cleanup handler finds the request not done and frees it.  The free
+// must succeed and null the handle; the runtime frees the request once the
+// rollback has ended it.  The ranks meet in memory mapped before MPI_Init,
+// which every process of the job shares.  A fault that rank 0 finds before
+// its request is started does not count, and is raised again.
+// After the restart, a new request must work.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+#define MAX_TRIES 10
+
+static MPI_Request request = MPI_REQUEST_NULL;
+static int         starting;        // Inside MPI_Start.
+static int         runs;            // Restart point entered.
+
+//! Shared by the ranks.
+static struct {
+  int starting;                     // Run in which rank 0 starts.
+  int freed_active;                 // Freed from inside it, successfully.
+} *shared;
+
+static MPI_Cleanup_code cleanup(MPI_Start_state start_state, void *state) {
+  if (request != MPI_REQUEST_NULL) {
+    int done;
+    MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    int active = starting && !done;
+    int rc = MPI_Request_free(&request);
+    if (active && rc == MPI_SUCCESS && request == MPI_REQUEST_NULL) {
+      __atomic_store_n(&shared->freed_active, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  return MPI_CLEANUP_SUCCESS;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Cleanup_handler_push(cleanup, NULL);
+  runs++;
+
+  int in = rank, out = -1;
+  MPI_Allreduce_init(&in, &out, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD,
+                     MPI_INFO_NULL, &request);
+  int again = !__atomic_load_n(&shared->freed_active, __ATOMIC_SEQ_CST) &&
+              runs <= MAX_TRIES;
+  if (again && rank == 0) {
+    __atomic_store_n(&shared->starting, runs, __ATOMIC_SEQ_CST);
+  } else if (again && rank == 1) {
+    while (__atomic_load_n(&shared->starting, __ATOMIC_SEQ_CST) != runs) {
+    }
+    MPI_Fault();
+  }
+  starting = 1;
+  MPI_Start(&request);
+  starting = 0;
+  MPI_Wait(&request, MPI_STATUS_IGNORE);
+  MPI_Request_free(&request);
+
+  int freed_active = shared->freed_active;
+  int failed = out != size * (size - 1) / 2 || request != MPI_REQUEST_NULL ||
+               !freed_active;
+  printf("test=request_free rank=%d freed_active=%d sum=%d result=%s\n",
+         rank, freed_active, out, failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "2", 1);
+  shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,74 @@
+// ===========================================================================
+// Test that a fault is handled at the innermost consistent restart scope.
+//
+// The restart point enters two scopes in turn, and rank 1 raises a fault
+// the first time it is inside each.  The first fault must re-enter only
+// its scope, running the cleanup handler pushed inside it but not the one
+// pushed outside.  Rank 0 invalidates the second scope first, so the second
+// fault must roll back to MPI_Reinit and run both handlers.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+static int reinit_runs;
+static int scope_runs[2];
+static int restarted;           // Scope re-entered with MPI_START_RESTARTED.
+static int outer_cleanups, inner_cleanups;
+
+static MPI_Cleanup_code count(MPI_Start_state start_state, void *state) {
+  (*(int *) state)++;
+  return MPI_CLEANUP_SUCCESS;
+}
+
+static void scope(void *state, MPI_Start_state start_state) {
+  int which = *(int *) state, rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  restarted += start_state == MPI_START_RESTARTED;
+  MPI_Cleanup_handler_push(count, &inner_cleanups);
+  if (++scope_runs[which] == 1) {
+    if (which == 1 && rank == 0) {
+      MPI_Restart_scope_invalidate();
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 1) {
+      MPI_Fault();
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+  MPI_Cleanup_handler handler;
+  void *handler_state;
+  MPI_Cleanup_handler_pop(&handler, &handler_state);
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  reinit_runs++;
+  MPI_Cleanup_handler_push(count, &outer_cleanups);
+
+  int first = 0, second = 1;
+  MPI_Restart_scope(scope, &first);
+  MPI_Restart_scope(scope, &second);
+
+  int failed = reinit_runs != 2 || scope_runs[0] != 3 ||
+               scope_runs[1] != 2 || restarted != 1 ||
+               inner_cleanups != 2 || outer_cleanups != 1;
+  printf("test=scope rank=%d reinit=%d scopes=%d,%d restarted=%d "
+         "cleanups=%d,%d result=%s\n", rank, reinit_runs, scope_runs[0],
+         scope_runs[1], restarted, outer_cleanups, inner_cleanups,
+         failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "2", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,83 @@
+// ===========================================================================
+// Test that a job with no spare left continues without a lost rank, and
+// that the ranks left take over its checkpoint.
+//
+// Four ranks each store a checkpoint in memory and with their partner, and
+// rank 1 is then killed.  The job must restart with three ranks, with
+// MPI_Reinit_remap mapping old ranks 0, 2 and 3 to 0, 1 and 2.  After
+// ckpt_redistribute each rank must still have its own checkpoint, and
+// exactly one must have adopted that of old rank 1.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+#include "ckpt.h"
+
+#define N 1000
+
+static void fill(int *state, int owner) {
+  for (int i = 0; i < N; i++) {
+    state[i] = owner * N + i;
+  }
+}
+
+static int is_state_of(const int *state, size_t bytes, int owner) {
+  return state && bytes == N * sizeof(int) && state[0] == owner * N &&
+         state[N - 1] == owner * N + N - 1;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  if (start_state == MPI_START_NEW) {
+    static int state[N];
+    fill(state, rank);
+    ckpt_init(MPI_COMM_WORLD, NULL);
+    ckpt_store(CKPT_MEMORY | CKPT_PARTNER, 1, state, sizeof(state));
+    // Every partner copy is in place.
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPIX_Inject_point("stored", 1);
+    MPI_Barrier(MPI_COMM_WORLD);
+    printf("test=shrink rank=%d result=FAIL\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  int map[4], old_size, old = -1;
+  MPI_Reinit_remap(4, map, &old_size);
+  for (int r = 0; r < old_size; r++) {
+    old = map[r] == rank ? r : old;
+  }
+  int rc = ckpt_redistribute(MPI_COMM_WORLD, map, old_size);
+
+  size_t bytes, lost_bytes;
+  int owner = -1;
+  const int *own = ckpt_memory(1, &bytes);
+  const int *lost = ckpt_adopted(1, &owner, &lost_bytes);
+  int adopters = lost != NULL;
+  MPI_Allreduce(MPI_IN_PLACE, &adopters, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+  int failed = size != 3 || old_size != 4 || map[0] != 0 ||
+               map[1] != MPI_UNDEFINED || map[2] != 1 || map[3] != 2 ||
+               rc != MPI_SUCCESS || !is_state_of(own, bytes, old) ||
+               adopters != 1 ||
+               (lost && (owner != 1 || !is_state_of(lost, lost_bytes, 1)));
+  printf("test=shrink rank=%d old=%d size=%d adopted=%d result=%s\n", rank,
+         old, size, lost ? owner : -1, failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "4", 1);
+  setenv("MPI_LOCAL_SPARES", "0", 1);
+  setenv("MPI_LOCAL_INJECT", "kill rank=1 stored=1", 1);
+  MPI_Init(&argc, &argv);
+  MPI_Reinit(argc, argv, run);
+  MPI_Finalize();
+  return 0;
+}
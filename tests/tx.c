@@ -0,0 +1,88 @@
+// ===========================================================================
+// Test that a fault rolls back an open transaction before cleanup.
+//
+// Each rank commits one transaction, then opens another and changes memory
+// in it: an array through MPI_Tx_log, part of it in a nested transaction
+// that commits, and a registered page by writing to it.  Rank 1 then
+// raises a fault.  The cleanup handler must find the memory as it was when
+// the open transaction began, with the committed change kept.
+// ===========================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mpi.h>
+#include "mpi-resilience.h"
+
+static int   values[4] = { 1, 2, 3, 4 };
+static char *page;
+static long  page_size;
+static int   runs;
+static int   restored;          // Found as before by the cleanup handler.
+
+static int as_before(void) {
+  static const int expected[4] = { 1, 2, 30, 4 };
+  return !memcmp(values, expected, sizeof(values)) && page[0] == 'a' &&
+         page[page_size - 1] == 'z';
+}
+
+static MPI_Cleanup_code cleanup(MPI_Start_state start_state, void *state) {
+  restored = as_before();
+  return MPI_CLEANUP_SUCCESS;
+}
+
+static void run(int argc, char **argv, MPI_Start_state start_state) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Cleanup_handler_push(cleanup, NULL);
+
+  if (++runs == 1) {
+    MPI_Tx_begin();
+    MPI_Tx_log(&values[2], sizeof(int));
+    values[2] = 30;
+    MPI_Tx_commit();
+
+    MPI_Tx_begin();
+    MPI_Tx_log(values, sizeof(values));
+    values[0] = -1;
+    values[3] = -4;
+    MPI_Tx_begin();
+    MPI_Tx_log(&values[1], sizeof(int));
+    values[1] = -2;
+    MPI_Tx_commit();
+    page[0] = 'b';
+    page[page_size - 1] = 'y';
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 1) {
+      MPI_Fault();
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  int failed = runs != 2 || !restored || !as_before();
+  printf("test=tx rank=%d runs=%d restored=%d values=%d,%d,%d,%d page=%c%c "
+         "result=%s\n", rank, runs, restored, values[0], values[1],
+         values[2], values[3], page[0], page[page_size - 1],
+         failed ? "FAIL" : "ok");
+  if (failed) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  setenv("MPI_LOCAL_NP", "2", 1);
+  MPI_Init(&argc, &argv);
+  page_size = sysconf(_SC_PAGESIZE);
+  if (posix_memalign((void **) &page, page_size, page_size)) {
+    return 1;
+  }
+  memset(page, 'a', page_size);
+  page[page_size - 1] = 'z';
+  MPI_Tx_register(page, page_size);
+  MPI_Reinit(argc, argv, run);
+  MPI_Tx_unregister(page);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,778 @@
+// ===========================================================================
+// Discrete-event simulator of MPI_Reinit recovery at scale.
+//
+// Usage: reinit-sim [policy=name] [trace=file] [name=value ...]
+//
+// Simulates jobs that compute, checkpoint and recover from node failures,
+// following the protocol of the local runtime: a failure is detected,
+// spare nodes replace the failed ones while the survivors are told, every
+// rank meets in an agreement barrier, cleans up and resets, meets again in
+// a ready barrier, and restores its checkpoint from memory, from a partner
+// node, or from the file system if a partner was lost too.  A failure
+// during recovery starts it over, with the replacements already spawned
+// kept.  Runtime barriers and dissemination are trees of the given arity
+// whose messages cost latency plus a send overhead per child.
+//
+// Job-level events (failures, repairs, checkpoints) are drawn from a queue;
+// each recovery is then simulated message by message, which costs O(ranks)
+// time and memory, so a million ranks fit on a workstation.  Prints one line
+// of key=value results per checkpoint policy; `reinit-sim help` lists the
+// parameters.
+//
+// Failures come from Weibull node lifetimes, or are replayed from a trace
+// of "<seconds> <node>" lines, e.g. years of a machine's failure logs.
+// Trials spread over the trace: trial j starts j/trials of the way through
+// it, on the j-th block of nodes of the traced machine.  A node keeps its
+// trace after a spare replaces it.
+//
+// Policies pick when to checkpoint and to which tier:
+//
+//   fixed        every `interval` seconds, files every `file_every`.
+//   daly         Daly's interval for the mean checkpoint cost.
+//   multilevel   Daly's interval for memory and partner copies, and for
+//                files against the failures that also take out a partner.
+//   incremental  Daly's interval, storing only the `dirty` fraction of the
+//                state except in file checkpoints.  Increments are applied
+//                to the copies as they arrive, so restores are unchanged.
+//   all          each of the above, on the same failures.
+// ===========================================================================
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! Model parameters.  Times are in seconds, bandwidths in bytes/second.
+static struct {
+  double ranks, ppn, spares, mtbf, shape, repair;
+  double work, interval, file_every, bytes;
+  double mem_bw, nic_bw, pfs_bw, latency, overhead, arity;
+  double detect, spawn, cleanup, sigma, reinit;
+  double trials, samples, seed, limit, step, dirty, start;
+} cfg = {
+  .ranks = 1048576, .ppn = 64, .spares = 16, .mtbf = 1.6e8, .shape = 1,
+  .repair = 14400, .work = 86400, .interval = 0, .file_every = 10,
+  .bytes = 268435456, .mem_bw = 1e10, .nic_bw = 2.5e10, .pfs_bw = 1e12,
+  .latency = 2e-6, .overhead = 5e-7, .arity = 16, .detect = 1, .spawn = 2,
+  .cleanup = 1e-3, .sigma = 0.5, .reinit = 1e-4, .trials = 10,
+  .samples = 0, .seed = 1, .limit = 100, .step = 0, .dirty = 0.25,
+  .start = -1,
+};
+
+static const struct {
+  const char *name;
+  double     *value;
+  const char *desc;
+} params[] = {
+  { "ranks",      &cfg.ranks,      "Ranks in the job" },
+  { "ppn",        &cfg.ppn,        "Ranks per node" },
+  { "spares",     &cfg.spares,     "Spare nodes" },
+  { "mtbf",       &cfg.mtbf,       "Mean time between failures of a node" },
+  { "shape",      &cfg.shape,      "Weibull shape of node lifetimes; 1 is "
+                                   "exponential" },
+  { "repair",     &cfg.repair,     "Mean time to return a failed node to "
+                                   "the spares" },
+  { "work",       &cfg.work,       "Computation the job needs" },
+  { "interval",   &cfg.interval,   "Computation between checkpoints; 0 "
+                                   "uses Daly's optimum" },
+  { "file_every", &cfg.file_every, "Checkpoints per file checkpoint" },
+  { "bytes",      &cfg.bytes,      "Checkpoint size per rank" },
+  { "mem_bw",     &cfg.mem_bw,     "Bandwidth of a copy in memory" },
+  { "nic_bw",     &cfg.nic_bw,     "Bandwidth in and out of a node" },
+  { "pfs_bw",     &cfg.pfs_bw,     "Aggregate file system bandwidth" },
+  { "latency",    &cfg.latency,    "Latency of a message" },
+  { "overhead",   &cfg.overhead,   "Sender overhead per message" },
+  { "arity",      &cfg.arity,      "Fan-out of runtime trees" },
+  { "detect",     &cfg.detect,     "Mean detection time, uniform on "
+                                   "[detect/2, 3 detect/2]" },
+  { "spawn",      &cfg.spawn,      "Time to start replacements on a spare" },
+  { "cleanup",    &cfg.cleanup,    "Mean time in cleanup handlers" },
+  { "sigma",      &cfg.sigma,      "Log-normal sigma of cleanup times" },
+  { "reinit",     &cfg.reinit,     "Time to reset runtime state" },
+  { "trials",     &cfg.trials,     "Jobs to simulate" },
+  { "samples",    &cfg.samples,    "If nonzero, simulate this many single "
+                                   "recoveries instead of jobs" },
+  { "seed",       &cfg.seed,       "Random seed" },
+  { "limit",      &cfg.limit,      "Give up on a job after this many times "
+                                   "its work" },
+  { "step",       &cfg.step,       "Time of one application step; "
+                                   "checkpoints fall between steps" },
+  { "dirty",      &cfg.dirty,      "Fraction of the state an incremental "
+                                   "checkpoint stores" },
+  { "start",      &cfg.start,      "Trace time to spread jobs from; -1 "
+                                   "for the first failure" },
+};
+
+#define NUM_PARAMS ((int) (sizeof(params) / sizeof(params[0])))
+
+static int ranks, ppn, nodes, arity;
+
+enum { FIXED, DALY, MULTILEVEL, INCREMENTAL, NUM_POLICIES };
+
+static const char *policy_names[NUM_POLICIES] = {
+  "fixed", "daly", "multilevel", "incremental",
+};
+
+//! When and how much a job checkpoints.
+struct policy {
+  int    kind;
+  double interval;      //!< Work between checkpoints.
+  long   file_every;    //!< Checkpoints per file checkpoint.
+  double scale;         //!< Fraction of the state in other checkpoints.
+};
+
+//! A failure from a trace.
+struct failure {
+  double t;
+  int    node;
+};
+
+static struct failure *trace;
+static long            ntrace;
+static int             machine;     //!< Nodes in the traced machine.
+
+// ===========================================================================
+// Random numbers
+// ===========================================================================
+static uint64_t rng;
+
+static uint64_t next_u64(void) {
+  uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//! Uniform on (0, 1].
+static double uniform(void) {
+  return ((next_u64() >> 11) + 1) * 0x1p-53;
+}
+
+static double exponential(double mean) {
+  return -mean * log(uniform());
+}
+
+static double normal(void) {
+  return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+//! Lifetime of a node, with mean mtbf.
+static double lifetime(void) {
+  double scale = cfg.mtbf / tgamma(1 + 1 / cfg.shape);
+  return scale * pow(-log(uniform()), 1 / cfg.shape);
+}
+
+// ===========================================================================
+// Event queues: a binary min-heap of times with a payload.
+// ===========================================================================
+struct entry {
+  double t;
+  int    node;
+};
+
+struct heap {
+  struct entry *e;
+  int           n, cap;
+};
+
+static void heap_push(struct heap *h, double t, int node) {
+  if (h->n == h->cap) {
+    h->cap = h->cap ? 2 * h->cap : 64;
+    h->e = realloc(h->e, h->cap * sizeof(*h->e));
+  }
+  int i = h->n++;
+  while (i > 0 && h->e[(i - 1) / 2].t > t) {
+    h->e[i] = h->e[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->e[i] = (struct entry) { t, node };
+}
+
+static struct entry heap_pop(struct heap *h) {
+  struct entry top = h->e[0];
+  struct entry last = h->e[--h->n];
+  int i = 0;
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= h->n) {
+      break;
+    }
+    if (c + 1 < h->n && h->e[c + 1].t < h->e[c].t) {
+      c++;
+    }
+    if (last.t <= h->e[c].t) {
+      break;
+    }
+    h->e[i] = h->e[c];
+    i = c;
+  }
+  if (h->n) {
+    h->e[i] = last;
+  }
+  return top;
+}
+
+static double heap_min(const struct heap *h) {
+  return h->n ? h->e[0].t : INFINITY;
+}
+
+// ===========================================================================
+// Runtime trees
+// ===========================================================================
+
+// When each rank hears a message that rank 0 sends down the tree at t0.
+// A parent sends to its children one after another.
+static void broadcast(double t0, double *at) {
+  at[0] = t0;
+  for (int i = 1; i < ranks; i++) {
+    int parent = (i - 1) / arity;
+    int nth = (i - 1) % arity + 1;
+    at[i] = at[parent] + nth * cfg.overhead + cfg.latency;
+  }
+}
+
+// A barrier that ranks enter at arrive[]: arrivals are reduced up the tree,
+// and the release is broadcast down.  Fills in when each rank leaves.
+static void barrier(const double *arrive, double *leave) {
+  memcpy(leave, arrive, ranks * sizeof(double));
+  for (int i = ranks - 1; i > 0; i--) {
+    int parent = (i - 1) / arity;
+    double t = leave[i] + cfg.overhead + cfg.latency;
+    leave[parent] = t > leave[parent] ? t : leave[parent];
+  }
+  broadcast(leave[0], leave);
+}
+
+static int tree_depth(void) {
+  int depth = 0;
+  for (long span = 1; span < ranks; span = span * arity + 1) {
+    depth++;
+  }
+  return depth;
+}
+
+// ===========================================================================
+// Checkpoints
+// ===========================================================================
+static double max2(double a, double b) {
+  return a > b ? a : b;
+}
+
+// A checkpoint copies scale times the state in memory and to the next
+// node, and sometimes to the file system, then synchronizes.
+static double checkpoint_cost(int file, double scale) {
+  double bytes = cfg.bytes * scale;
+  double cost = bytes / cfg.mem_bw + ppn * bytes / cfg.nic_bw +
+                cfg.latency;
+  if (file) {
+    cost += max2(ranks * bytes / cfg.pfs_bw, ppn * bytes / cfg.nic_bw);
+  }
+  return cost + 2 * tree_depth() * (cfg.latency + cfg.overhead);
+}
+
+//! Daly's interval for checkpoints costing delta and an MTBF of m.
+static double daly(double delta, double m) {
+  return delta < 2 * m ? sqrt(2 * delta * m) - delta : m;
+}
+
+// Mean time between failures of the job's nodes: from the trace of the
+// first placement, or from the node MTBF.
+static double system_mtbf(void) {
+  if (!trace) {
+    return cfg.mtbf / nodes;
+  }
+  long n = 0;
+  for (long i = 0; i < ntrace; i++) {
+    n += trace[i].node < nodes;
+  }
+  double span = trace[ntrace - 1].t - trace[0].t;
+  return n ? span / n : span;
+}
+
+// Fraction of failures whose partner node also fails within an interval,
+// which files must cover.
+static double partner_fraction(double interval) {
+  if (nodes == 1) {
+    return 1;
+  }
+  if (!trace) {
+    return 2 * interval / cfg.mtbf < 1 ? 2 * interval / cfg.mtbf : 1;
+  }
+  long n = 0, both = 0;
+  for (long i = 0; i < ntrace; i++) {
+    if (trace[i].node >= nodes) {
+      continue;
+    }
+    n++;
+    for (long j = i + 1; j < ntrace && trace[j].t - trace[i].t < interval;
+         j++) {
+      int a = trace[i].node, b = trace[j].node;
+      both += b < nodes && (b == (a + 1) % nodes || a == (b + 1) % nodes);
+    }
+  }
+  return n ? (double) (both ? both : 1) / n : 1;
+}
+
+// Work out a policy's intervals.  Intervals are whole steps.
+static struct policy make_policy(int kind) {
+  struct policy p = {
+    kind, cfg.interval, (long) cfg.file_every, 1,
+  };
+  double m = system_mtbf();
+  double full = checkpoint_cost(0, 1);
+  double file = checkpoint_cost(1, 1);
+  switch (kind) {
+    case DALY:
+      p.interval = daly(full + (file - full) / p.file_every, m);
+      break;
+    case MULTILEVEL:
+      p.interval = daly(full, m);
+      p.file_every = lround(daly(file, m / partner_fraction(p.interval)) /
+                            p.interval);
+      p.file_every = p.file_every < 1 ? 1 : p.file_every;
+      break;
+    case INCREMENTAL:
+      p.scale = cfg.dirty;
+      full = checkpoint_cost(0, p.scale);
+      p.interval = daly(full + (file - full) / p.file_every, m);
+      break;
+  }
+  if (cfg.step > 0) {
+    p.interval = cfg.step * (p.interval > cfg.step
+                             ? lround(p.interval / cfg.step) : 1);
+  }
+  return p;
+}
+
+// ===========================================================================
+// Simulation state
+// ===========================================================================
+
+//! Critical path of one recovery, from the failure to the last rank
+//! finishing its restore.
+struct recovery {
+  double detect;        //!< Failure -> detection.
+  double disseminate;   //!< Detection -> last rank in the agree barrier,
+                        //!< including spawning replacements.
+  double agree;         //!< Time in the two barriers.
+  double cleanup;       //!< Cleanup handlers and reset.
+  double restore;       //!< Loading checkpoints.
+  double restarted;     //!< Attempts cut short by another failure.
+  double total;
+};
+
+static struct heap failures;    //!< Next failure of each node.
+static struct heap repairs;     //!< Failed nodes returning to the spares.
+static int         pool;        //!< Spare nodes available.
+static int         min_pool;
+static double      spare_wait;
+static long       *failed_at;   //!< Commit count at each node's last
+                                //!< failure, or -1.
+static long        commits;
+static int         file_restores;
+static long        nfailures;
+
+static double     *arrive, *leave;
+static double     *ready;       //!< Replacement ready time of each node, or
+                                //!< NAN if the node did not fail.
+
+static double      deadline;    //!< When to give up on the current job.
+
+static struct recovery *recoveries;
+static long             nrecoveries, recoveries_cap;
+
+static double next_failure(void) {
+  return cfg.samples ? INFINITY : heap_min(&failures);
+}
+
+// Fail a node at t, to be detected at td: take a spare, waiting for a
+// repair if there is none, and schedule the next failure.
+static void fail_node(int node, double t, double td) {
+  nfailures++;
+  while (repairs.n && heap_min(&repairs) <= td) {
+    heap_pop(&repairs);
+    pool++;
+  }
+  double start = td;
+  if (pool > 0) {
+    pool--;
+  } else {
+    start = heap_pop(&repairs).t;
+    spare_wait += start - td;
+  }
+  min_pool = pool < min_pool ? pool : min_pool;
+  heap_push(&repairs, t + exponential(cfg.repair), node);
+  ready[node] = start + cfg.spawn;
+  failed_at[node] = commits;
+  if (!cfg.samples && !trace) {
+    heap_push(&failures, ready[node] + lifetime(), node);
+  }
+}
+
+// Whether some failed node's partner failed since the last commit, so that
+// its partner copy is gone and everyone restarts from files.
+static int partner_lost(void) {
+  for (int n = 0; n < nodes; n++) {
+    int partner = (n + 1) % nodes;
+    if (!isnan(ready[n]) &&
+        (nodes == 1 || failed_at[partner] == commits)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Recover from a failure of node at tf.  Returns when the job resumes, and
+// sets *file if it restarts from files.
+static double recover(int node, double tf, int *file) {
+  struct recovery rec = { 0 };
+  double first = tf;
+  for (int n = 0; n < nodes; n++) {
+    ready[n] = NAN;
+  }
+  for (;;) {
+    double td = tf + cfg.detect * (0.5 + uniform());
+    fail_node(node, tf, td);
+
+    // Survivors hear of the failure from the root; replacements join once
+    // started.
+    broadcast(td + cfg.latency, arrive);
+    for (int i = 0; i < ranks; i++) {
+      if (!isnan(ready[i / ppn])) {
+        arrive[i] = ready[i / ppn];
+      }
+    }
+    double in_agree = 0;
+    for (int i = 0; i < ranks; i++) {
+      in_agree = max2(in_agree, arrive[i]);
+    }
+    barrier(arrive, leave);
+    double left_agree = 0, in_ready = 0;
+    for (int i = 0; i < ranks; i++) {
+      left_agree = max2(left_agree, leave[i]);
+      double clean = isnan(ready[i / ppn])
+        ? cfg.cleanup * exp(cfg.sigma * normal() - cfg.sigma * cfg.sigma / 2)
+        : 0;
+      arrive[i] = leave[i] + clean + cfg.reinit;
+      in_ready = max2(in_ready, arrive[i]);
+    }
+    barrier(arrive, leave);
+
+    *file = partner_lost();
+    double resume = 0, left_ready = 0;
+    for (int i = 0; i < ranks; i++) {
+      double load = cfg.bytes / cfg.mem_bw;
+      if (*file) {
+        load = max2(ranks * cfg.bytes / cfg.pfs_bw,
+                    ppn * cfg.bytes / cfg.nic_bw);
+      } else if (!isnan(ready[i / ppn])) {
+        load = ppn * cfg.bytes / cfg.nic_bw + cfg.latency;
+      }
+      left_ready = max2(left_ready, leave[i]);
+      resume = max2(resume, leave[i] + load);
+    }
+
+    double next = next_failure();
+    if (next < resume && next < deadline) {
+      rec.restarted += next - tf;
+      node = heap_pop(&failures).node;
+      tf = next;
+      continue;
+    }
+    rec.detect      = td - tf;
+    rec.disseminate = in_agree - td;
+    rec.agree       = (left_agree - in_agree) + (left_ready - in_ready);
+    rec.cleanup     = in_ready - left_agree;
+    rec.restore     = resume - left_ready;
+    rec.total       = resume - first;
+    if (nrecoveries == recoveries_cap) {
+      recoveries_cap = recoveries_cap ? 2 * recoveries_cap : 64;
+      recoveries = realloc(recoveries, recoveries_cap * sizeof(*recoveries));
+    }
+    recoveries[nrecoveries++] = rec;
+    file_restores += *file;
+    return resume;
+  }
+}
+
+// ===========================================================================
+// Jobs
+// ===========================================================================
+
+//! Where the wall time of a job went.
+struct account {
+  double wall, done, checkpoint, lost, recovery;
+  int    gave_up;
+};
+
+// Set up a job.  Trial j of a trace runs on nodes [j * nodes, (j + 1) *
+// nodes) of the traced machine, wrapping around, from (j + 1/2) / trials of
+// the way through the trace.
+static void reset(long trial) {
+  failures.n = repairs.n = 0;
+  pool = (int) cfg.spares;
+  commits = 0;
+  for (int n = 0; n < nodes; n++) {
+    failed_at[n] = -1;
+    if (!cfg.samples && !trace) {
+      heap_push(&failures, lifetime(), n);
+    }
+  }
+  if (trace && !cfg.samples) {
+    int first = (int) (trial * nodes % machine);
+    double from = cfg.start >= 0 ? cfg.start : trace[0].t;
+    double start = from + (trial + 0.5) / cfg.trials *
+                          (trace[ntrace - 1].t - from);
+    for (long i = 0; i < ntrace; i++) {
+      int node = (trace[i].node - first + machine) % machine;
+      if (node < nodes && trace[i].t >= start) {
+        heap_push(&failures, trace[i].t - start, node);
+      }
+    }
+  }
+}
+
+// Run one job: compute to the next checkpoint, checkpoint, and recover
+// whenever a failure comes first.  Work since the last usable checkpoint
+// is lost.
+static struct account run_job(const struct policy *p, long trial) {
+  struct account acct = { 0 };
+  double t = 0, progress = 0, committed = 0, file_committed = 0;
+  reset(trial);
+  deadline = cfg.limit * cfg.work;
+  while (progress < cfg.work) {
+    if (t >= deadline) {
+      acct.gave_up = 1;
+      break;
+    }
+    double target = committed + p->interval < cfg.work
+                    ? committed + p->interval : cfg.work;
+    int file = (commits + 1) % p->file_every == 0;
+    double cost = target < cfg.work
+                  ? checkpoint_cost(file, file ? 1 : p->scale) : 0;
+    double tf = next_failure();
+    if (tf >= t + (target - progress) + cost) {
+      t += target - progress + cost;
+      acct.checkpoint += cost;
+      progress = committed = target;
+      commits++;
+      if (file) {
+        file_committed = target;
+      }
+      continue;
+    }
+
+    // Computation and any partial checkpoint since the commit are lost.
+    acct.lost += tf - t + (progress - committed);
+    int node = heap_pop(&failures).node;
+    int from_file;
+    double resume = recover(node, tf, &from_file);
+    acct.recovery += resume - tf;
+    if (from_file) {
+      acct.lost += committed - file_committed;
+      committed = file_committed;
+    }
+    progress = committed;
+    t = resume;
+  }
+  acct.wall = t;
+  acct.done = progress;
+  return acct;
+}
+
+// ===========================================================================
+// Reports
+// ===========================================================================
+static int compare_totals(const void *x, const void *y) {
+  double a = ((const struct recovery *) x)->total;
+  double b = ((const struct recovery *) y)->total;
+  return a < b ? -1 : a > b;
+}
+
+static void print_recoveries(void) {
+  struct recovery mean = { 0 };
+  for (long i = 0; i < nrecoveries; i++) {
+    mean.detect      += recoveries[i].detect / nrecoveries;
+    mean.disseminate += recoveries[i].disseminate / nrecoveries;
+    mean.agree       += recoveries[i].agree / nrecoveries;
+    mean.cleanup     += recoveries[i].cleanup / nrecoveries;
+    mean.restore     += recoveries[i].restore / nrecoveries;
+    mean.restarted   += recoveries[i].restarted / nrecoveries;
+    mean.total       += recoveries[i].total / nrecoveries;
+  }
+  qsort(recoveries, nrecoveries, sizeof(*recoveries), compare_totals);
+  double p50 = nrecoveries ? recoveries[nrecoveries / 2].total : 0;
+  double p99 = nrecoveries ? recoveries[nrecoveries * 99 / 100].total : 0;
+  double max = nrecoveries ? recoveries[nrecoveries - 1].total : 0;
+  printf(" recoveries=%ld recovery_mean=%.6g recovery_p50=%.6g "
+         "recovery_p99=%.6g recovery_max=%.6g detect=%.6g disseminate=%.6g "
+         "agree=%.6g cleanup=%.6g restore=%.6g restarted=%.6g\n",
+         nrecoveries, mean.total, p50, p99, max, mean.detect,
+         mean.disseminate, mean.agree, mean.cleanup, mean.restore,
+         mean.restarted);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: reinit-sim [policy=fixed|daly|multilevel|"
+          "incremental|all] [trace=file]\n"
+          "                  [name=value ...]\n\n");
+  for (int i = 0; i < NUM_PARAMS; i++) {
+    fprintf(stderr, "  %-10s  %-10g  %s\n", params[i].name,
+            *params[i].value, params[i].desc);
+  }
+  exit(1);
+}
+
+static int compare_failures(const void *x, const void *y) {
+  double a = ((const struct failure *) x)->t;
+  double b = ((const struct failure *) y)->t;
+  return a < b ? -1 : a > b;
+}
+
+// Read "<seconds> <node>" lines; blank lines and # comments are skipped.
+static void read_trace(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  char line[256];
+  long cap = 0;
+  while (fgets(line, sizeof(line), f)) {
+    double t;
+    int node;
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || !*p) {
+      continue;
+    }
+    if (sscanf(p, "%lf %d", &t, &node) != 2 || node < 0) {
+      fprintf(stderr, "reinit-sim: %s: bad line: %s", path, line);
+      exit(1);
+    }
+    if (ntrace == cap) {
+      cap = cap ? 2 * cap : 1024;
+      trace = realloc(trace, cap * sizeof(*trace));
+    }
+    trace[ntrace++] = (struct failure) { t, node };
+    machine = node >= machine ? node + 1 : machine;
+  }
+  fclose(f);
+  if (!ntrace) {
+    fprintf(stderr, "reinit-sim: %s: no failures\n", path);
+    exit(1);
+  }
+  qsort(trace, ntrace, sizeof(*trace), compare_failures);
+  if (machine < nodes) {
+    fprintf(stderr, "reinit-sim: %s: trace has %d nodes, fewer than the "
+            "job's %d\n", path, machine, nodes);
+    machine = nodes;
+  }
+}
+
+// Run every trial under a policy and print its line.  Each policy sees the
+// same random numbers, and so the same failures.
+static void simulate(int kind) {
+  struct policy p = make_policy(kind);
+  rng = (uint64_t) cfg.seed;
+  nfailures = nrecoveries = 0;
+  file_restores = 0;
+  spare_wait = 0;
+  min_pool = (int) cfg.spares;
+
+  struct account total = { 0 };
+  for (long j = 0; j < (long) cfg.trials; j++) {
+    struct account a = run_job(&p, j);
+    total.wall       += a.wall;
+    total.done       += a.done;
+    total.gave_up    += a.gave_up;
+    total.checkpoint += a.checkpoint;
+    total.lost       += a.lost;
+    total.recovery   += a.recovery;
+  }
+  printf("sim=reinit policy=%s ranks=%d nodes=%d trials=%ld interval=%.6g "
+         "file_every=%ld checkpoint_cost=%.6g wall=%.6g efficiency=%.4f "
+         "checkpoint=%.4f lost=%.4f recovery=%.4f failures=%.6g "
+         "file_restores=%.6g spare_wait=%.6g min_spares=%d gave_up=%d",
+         policy_names[kind], ranks, nodes, (long) cfg.trials, p.interval,
+         p.file_every, checkpoint_cost(0, p.scale), total.wall / cfg.trials,
+         total.done / total.wall, total.checkpoint / total.wall,
+         total.lost / total.wall, total.recovery / total.wall,
+         (double) nfailures / cfg.trials, file_restores / cfg.trials,
+         spare_wait / cfg.trials, min_pool, total.gave_up);
+  print_recoveries();
+}
+
+int main(int argc, char **argv) {
+  const char *policy = NULL, *trace_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    char *eq = strchr(argv[i], '=');
+    if (!strncmp(argv[i], "policy=", 7)) {
+      policy = eq + 1;
+      continue;
+    } else if (!strncmp(argv[i], "trace=", 6)) {
+      trace_path = eq + 1;
+      continue;
+    }
+    int p = 0;
+    while (eq && p < NUM_PARAMS &&
+           (strncmp(argv[i], params[p].name, eq - argv[i]) ||
+            params[p].name[eq - argv[i]])) {
+      p++;
+    }
+    if (!eq || p == NUM_PARAMS) {
+      usage();
+    }
+    *params[p].value = atof(eq + 1);
+  }
+  ranks = (int) cfg.ranks;
+  ppn = (int) cfg.ppn;
+  arity = (int) cfg.arity;
+  if (ranks < 1 || ppn < 1 || arity < 1 || cfg.file_every < 1 ||
+      cfg.shape <= 0) {
+    usage();
+  }
+  nodes = (ranks + ppn - 1) / ppn;
+  if (trace_path) {
+    read_trace(trace_path);
+  }
+
+  int kind = cfg.interval > 0 ? FIXED : DALY;
+  int all = 0;
+  if (policy) {
+    all = !strcmp(policy, "all");
+    for (kind = 0; kind < NUM_POLICIES && !all; kind++) {
+      if (!strcmp(policy, policy_names[kind])) {
+        break;
+      }
+    }
+    if (kind == NUM_POLICIES) {
+      usage();
+    }
+  }
+  if ((all || kind == FIXED) && cfg.interval <= 0) {
+    fprintf(stderr, "reinit-sim: the fixed policy needs an interval\n");
+    return 1;
+  }
+
+  arrive    = malloc(ranks * sizeof(double));
+  leave     = malloc(ranks * sizeof(double));
+  ready     = malloc(nodes * sizeof(double));
+  failed_at = malloc(nodes * sizeof(long));
+
+  if (cfg.samples) {
+    rng = (uint64_t) cfg.seed;
+    deadline = INFINITY;
+    for (long s = 0; s < (long) cfg.samples; s++) {
+      int file;
+      reset(0);
+      recover((int) (uniform() * nodes) % nodes, 0, &file);
+    }
+    printf("sim=reinit ranks=%d nodes=%d", ranks, nodes);
+    print_recoveries();
+    return 0;
+  }
+  for (int k = all ? 0 : kind; k <= (all ? NUM_POLICIES - 1 : kind); k++) {
+    simulate(k);
+  }
+  return 0;
+}
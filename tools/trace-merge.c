@@ -0,0 +1,406 @@
+// ===========================================================================
+// Merge the local runtime's per-rank event traces into one timeline.
+//
+// Usage: trace-merge [-a] [-o file] (dir | trace file)...
+//
+// Reads the trace.<rank> files written with MPI_LOCAL_TRACE_DIR and writes
+// Chrome trace JSON, which chrome://tracing and ui.perfetto.dev both open.
+// Each rank is a process and each OS process that ran as that rank is a
+// thread in it, so replacements show up under the rank they replaced.
+// Recovery phases and barrier waits are slices; everything else is an
+// instant, and cleanup handlers are a counter.
+//
+// Ranks of the local runtime share one clock.  For traces whose ranks ran
+// on hosts without a common clock, -a aligns the clocks on the recovery
+// barriers: every rank leaves a barrier when the last one arrives, so the
+// departures are taken to be simultaneous, within the bounds the arrivals
+// allow.  Ranks that wake up late (e.g. on an oversubscribed host) skew
+// this by their wake-up latency.
+// ===========================================================================
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mpi.h"
+#include "trace.h"
+
+//! An event with its timestamps converted to seconds.
+struct event {
+  double   time;
+  double   arrived;   //!< Arrival time of a barrier event.
+  int      rank;
+  int      pid;
+  uint32_t type;
+  uint32_t epoch;
+  int64_t  a, b;
+};
+
+static struct event *events;
+static size_t        nevents, cap;
+static int           max_rank = -1;
+
+static const char *phase_names[MPIX_RECOVERY_NUM_PHASES] = {
+  [MPIX_RECOVERY_DETECT]      = "detect",
+  [MPIX_RECOVERY_DISSEMINATE] = "disseminate",
+  [MPIX_RECOVERY_CLEANUP]     = "cleanup",
+  [MPIX_RECOVERY_REINIT]      = "reinit",
+  [MPIX_RECOVERY_AGREE]       = "agree",
+  [MPIX_RECOVERY_CHECKPOINT]  = "checkpoint",
+  [MPIX_RECOVERY_FIRST_CALL]  = "first call",
+};
+
+static const char *barrier_names[] = { "agree barrier", "ready barrier" };
+
+static void die(const char *what) {
+  perror(what);
+  exit(1);
+}
+
+static struct event *add(void) {
+  if (nevents == cap) {
+    cap = cap ? 2 * cap : 1024;
+    events = realloc(events, cap * sizeof(*events));
+    if (!events) {
+      die("realloc");
+    }
+  }
+  return &events[nevents++];
+}
+
+// ===========================================================================
+// Reading
+// ===========================================================================
+static void read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    die(path);
+  }
+  struct local_trace_header h;
+  while (fread(&h, sizeof(h), 1, f) == 1) {
+    if (h.magic != LOCAL_TRACE_MAGIC) {
+      fprintf(stderr, "trace-merge: %s: not a trace file\n", path);
+      exit(1);
+    }
+    if (h.dropped) {
+      fprintf(stderr, "trace-merge: %s: rank %d dropped %llu events; raise "
+              "MPI_LOCAL_TRACE_EVENTS\n", path, h.rank,
+              (unsigned long long) h.dropped);
+    }
+    max_rank = h.rank > max_rank ? h.rank : max_rank;
+    for (uint64_t i = 0; i < h.count; i++) {
+      struct local_event r;
+      if (fread(&r, sizeof(r), 1, f) != 1) {
+        fprintf(stderr, "trace-merge: %s: truncated\n", path);
+        exit(1);
+      }
+      struct event *e = add();
+      e->time  = h.time - (double) (h.ticks - r.ticks) / h.ticks_per_sec;
+      e->rank  = h.rank;
+      e->pid   = h.pid;
+      e->type  = r.type;
+      e->epoch = r.epoch;
+      e->a     = r.a;
+      e->b     = r.b;
+      if (r.type == MPIX_EVENT_BARRIER) {
+        e->arrived = h.time - (double) (h.ticks - (uint64_t) r.b) /
+                              h.ticks_per_sec;
+      }
+    }
+    if (h.reason == LOCAL_DUMP_LOST) {
+      struct event *e = add();
+      *e = (struct event) {
+        .time = h.time, .rank = h.rank, .pid = h.pid, .type = UINT32_MAX,
+      };
+    }
+  }
+  fclose(f);
+}
+
+static void read_path(const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0) {
+    die(path);
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    read_file(path);
+    return;
+  }
+  DIR *dir = opendir(path);
+  if (!dir) {
+    die(path);
+  }
+  struct dirent *d;
+  while ((d = readdir(dir))) {
+    if (!strncmp(d->d_name, "trace.", 6)) {
+      char file[PATH_MAX];
+      snprintf(file, sizeof(file), "%s/%s", path, d->d_name);
+      read_file(file);
+    }
+  }
+  closedir(dir);
+}
+
+// ===========================================================================
+// Clock alignment
+//
+// With offset o_r between rank r's clock and rank 0's, a barrier that
+// released at true time T was entered by r no later than T + o_r and left
+// no earlier.  Each barrier thus bounds o_r to [arrived_r - left_0,
+// left_r - arrived_0]; the estimate is the median of left_r - left_0,
+// clamped to the bounds of all barriers.
+// ===========================================================================
+static int compare_doubles(const void *x, const void *y) {
+  double a = *(const double *) x, b = *(const double *) y;
+  return a < b ? -1 : a > b;
+}
+
+static const struct event *find_barrier(const struct event **list,
+                                        size_t n, const struct event *e) {
+  for (size_t i = 0; i < n; i++) {
+    if (list[i]->epoch == e->epoch && list[i]->a == e->a) {
+      return list[i];
+    }
+  }
+  return NULL;
+}
+
+// Offset of rank's clock from that of the rank whose barriers are in refs.
+static double rank_offset(int rank, const struct event **refs, size_t nrefs) {
+  double *samples = malloc(nrefs * sizeof(double));
+  size_t n = 0;
+  double lo = -INFINITY, hi = INFINITY;
+  for (size_t i = 0; i < nevents; i++) {
+    const struct event *e = &events[i];
+    if (e->type != MPIX_EVENT_BARRIER || e->rank != rank) {
+      continue;
+    }
+    const struct event *r = find_barrier(refs, nrefs, e);
+    if (!r || n == nrefs) {
+      continue;
+    }
+    samples[n++] = e->time - r->time;
+    lo = e->arrived - r->time > lo ? e->arrived - r->time : lo;
+    hi = e->time - r->arrived < hi ? e->time - r->arrived : hi;
+  }
+  double offset = 0;
+  if (n) {
+    qsort(samples, n, sizeof(double), compare_doubles);
+    offset = samples[n / 2];
+    if (lo <= hi) {
+      offset = offset < lo ? lo : offset > hi ? hi : offset;
+    }
+  }
+  free(samples);
+  return offset;
+}
+
+static void align(void) {
+  const struct event **refs = malloc(nevents * sizeof(*refs));
+  size_t nrefs = 0;
+  for (size_t i = 0; i < nevents; i++) {
+    if (events[i].type == MPIX_EVENT_BARRIER && events[i].rank == 0) {
+      refs[nrefs++] = &events[i];
+    }
+  }
+  double *offsets = calloc(max_rank + 1, sizeof(double));
+  for (int r = 1; r <= max_rank; r++) {
+    offsets[r] = rank_offset(r, refs, nrefs);
+    fprintf(stderr, "trace-merge: rank %d clock offset %+.3f us\n", r,
+            offsets[r] * 1e6);
+  }
+  free(refs);
+  for (size_t i = 0; i < nevents; i++) {
+    events[i].time    -= offsets[events[i].rank];
+    events[i].arrived -= offsets[events[i].rank];
+  }
+  free(offsets);
+}
+
+// ===========================================================================
+// Output
+// ===========================================================================
+static FILE  *out;
+static double origin;
+static int    first = 1;
+
+static double usecs(double t) {
+  return (t - origin) * 1e6;
+}
+
+// Start a record with the fields every event has.
+static void begin(const char *ph, const char *name, int pid, int tid,
+                  double ts) {
+  fprintf(out, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+          "\"ts\":%.3f", first ? "" : ",", ph, name, pid, tid, ts);
+  first = 0;
+}
+
+static void instant(const struct event *e, const char *name,
+                    const char *a, const char *b) {
+  begin("i", name, e->rank, e->pid, usecs(e->time));
+  fprintf(out, ",\"s\":\"t\",\"args\":{\"epoch\":%u", e->epoch);
+  if (a) {
+    fprintf(out, ",\"%s\":%lld", a, (long long) e->a);
+  }
+  if (b) {
+    fprintf(out, ",\"%s\":%lld", b, (long long) e->b);
+  }
+  fprintf(out, "}}");
+}
+
+static void write_event(const struct event *e) {
+  char name[32];
+  switch (e->type) {
+    case MPIX_EVENT_RECOVERY_PHASE:
+      if (e->a >= 0 && e->a < MPIX_RECOVERY_NUM_PHASES) {
+        begin("X", phase_names[e->a], e->rank, e->pid,
+              usecs(e->time) - e->b);
+        fprintf(out, ",\"dur\":%lld,\"cat\":\"recovery\","
+                "\"args\":{\"epoch\":%u}}", (long long) e->b, e->epoch);
+      }
+      break;
+    case MPIX_EVENT_BARRIER:
+      if (e->a >= 0 && e->a < 2) {
+        begin("X", barrier_names[e->a], e->rank, e->pid,
+              usecs(e->arrived));
+        fprintf(out, ",\"dur\":%.3f,\"cat\":\"recovery\","
+                "\"args\":{\"epoch\":%u}}", (e->time - e->arrived) * 1e6,
+                e->epoch);
+      }
+      break;
+    case MPIX_EVENT_HANDLER_PUSH:
+    case MPIX_EVENT_HANDLER_POP:
+      begin("C", "cleanup handlers", e->rank, e->pid, usecs(e->time));
+      fprintf(out, ",\"args\":{\"handlers\":%lld}}", (long long) e->a);
+      break;
+    case MPIX_EVENT_FAULT_RAISED:
+      instant(e, "MPI_Fault", "fault", NULL);
+      break;
+    case MPIX_EVENT_FAULT_FOUND:
+      instant(e, "fault found", "fault", NULL);
+      break;
+    case MPIX_EVENT_MODE:
+      instant(e, "fault mode", "mode", NULL);
+      break;
+    case MPIX_EVENT_RECOVERY_BEGIN:
+      instant(e, "recovery begin", "fault", "start_state");
+      break;
+    case MPIX_EVENT_RECOVERY_END:
+      instant(e, "recovery end", "fault", "level");
+      break;
+    case MPIX_EVENT_TX_ROLLBACK:
+      instant(e, "transaction rollback", "count", NULL);
+      break;
+    case MPIX_EVENT_RESTART:
+      instant(e, "restart", "start_state", "level");
+      break;
+    case MPIX_EVENT_CHECKPOINT_STORED:
+      instant(e, "checkpoint stored", "step", "bytes");
+      break;
+    case MPIX_EVENT_CHECKPOINT_LOADED:
+      instant(e, "checkpoint loaded", "step", "bytes");
+      break;
+    case MPIX_EVENT_INJECT:
+      instant(e, "injected fault", "action", "rule");
+      break;
+    case MPIX_EVENT_ABORT:
+      instant(e, "MPI_Abort", "code", NULL);
+      break;
+    case UINT32_MAX:
+      instant(e, "process lost", NULL, NULL);
+      break;
+    default:
+      snprintf(name, sizeof(name), "event %u", e->type);
+      instant(e, name, "a", "b");
+      break;
+  }
+}
+
+// Name the tracks: a process per rank, a thread per OS process.
+static void write_names(void) {
+  for (int r = 0; r <= max_rank; r++) {
+    begin("M", "process_name", r, 0, 0);
+    fprintf(out, ",\"args\":{\"name\":\"rank %d\"}}", r);
+    begin("M", "process_sort_index", r, 0, 0);
+    fprintf(out, ",\"args\":{\"sort_index\":%d}}", r);
+  }
+  int *pids = malloc(nevents * sizeof(int));
+  size_t npids = 0;
+  for (size_t i = 0; i < nevents; i++) {
+    const struct event *e = &events[i];
+    size_t j = 0;
+    while (j < npids && pids[j] != e->pid) {
+      j++;
+    }
+    if (j == npids) {
+      pids[npids++] = e->pid;
+      begin("M", "thread_name", e->rank, e->pid, 0);
+      fprintf(out, ",\"args\":{\"name\":\"pid %d\"}}", e->pid);
+    }
+  }
+  free(pids);
+}
+
+static int compare_events(const void *x, const void *y) {
+  const struct event *a = x, *b = y;
+  return a->time < b->time ? -1 : a->time > b->time;
+}
+
+int main(int argc, char **argv) {
+  int aligned = 0;
+  const char *output = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "ao:")) != -1) {
+    switch (opt) {
+      case 'a': aligned = 1; break;
+      case 'o': output = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-a] [-o file] (dir | trace file)...\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "usage: %s [-a] [-o file] (dir | trace file)...\n",
+            argv[0]);
+    return 1;
+  }
+  for (int i = optind; i < argc; i++) {
+    read_path(argv[i]);
+  }
+  if (aligned) {
+    align();
+  }
+  qsort(events, nevents, sizeof(*events), compare_events);
+
+  out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    die(output);
+  }
+  origin = nevents ? events[0].time : 0;
+  for (size_t i = 0; i < nevents; i++) {
+    if (events[i].type == MPIX_EVENT_BARRIER && events[i].arrived < origin) {
+      origin = events[i].arrived;
+    }
+    if (events[i].type == MPIX_EVENT_RECOVERY_PHASE &&
+        events[i].time - events[i].b * 1e-6 < origin) {
+      origin = events[i].time - events[i].b * 1e-6;
+    }
+  }
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  write_names();
+  for (size_t i = 0; i < nevents; i++) {
+    write_event(&events[i]);
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout && fclose(out) != 0) {
+    die(output);
+  }
+  return 0;
+}